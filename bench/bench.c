@@ -0,0 +1,703 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cten.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Emits one JSON object per line on stdout, e.g.
+ *   {"bench":"matmul","case":"256x256x256","iters":12,"seconds":0.2,"gflops":3.1}
+ * Usage: cten_bench [filter] [min_seconds]
+ */
+
+#ifndef CTEN_BENCH_COMMIT
+#define CTEN_BENCH_COMMIT "unknown"
+#endif
+
+#ifndef CTEN_BENCH_FLAGS
+#define CTEN_BENCH_FLAGS "unknown"
+#endif
+
+enum MemoryPoolIds {
+    PoolId_Default = 0,
+    PoolId_Model = 1,
+    PoolId_Optimizer = 2,
+};
+
+typedef void (*BenchFn)(void* ctx);
+
+static double g_min_seconds = 0.2;
+static const char* g_filter = NULL;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned int g_seed = 42;
+
+static float rand_uniform(float lo, float hi) {
+    g_seed = g_seed * 1664525u + 1013904223u;
+    return lo + (hi - lo) * ((g_seed >> 8) / 16777216.0f);
+}
+
+static Tensor rand_tensor(TensorShape shape, bool requires_grad, float scale) {
+    Tensor t = Tensor_new(shape, requires_grad);
+    for(int i = 0; i < t.data->numel; i++) {
+        t.data->flex[i] = rand_uniform(-scale, scale);
+    }
+    return t;
+}
+
+static bool selected(const char* bench) { return g_filter == NULL || strstr(bench, g_filter); }
+
+/* Runs `fn` until `g_min_seconds` have elapsed and returns seconds per iteration. Temporary
+ * tensors are allocated in PoolId_Default and freed after every iteration, so allocator cost is
+ * part of the measurement just like in a training loop. */
+static double run(BenchFn fn, void* ctx, int* out_iters) {
+    // warmup
+    cten_begin_malloc(PoolId_Default);
+    fn(ctx);
+    cten_end_malloc();
+    cten_free(PoolId_Default);
+
+    int iters = 0;
+    double start = now_seconds();
+    double elapsed = 0;
+    while(elapsed < g_min_seconds) {
+        cten_begin_malloc(PoolId_Default);
+        fn(ctx);
+        cten_end_malloc();
+        cten_free(PoolId_Default);
+        iters++;
+        elapsed = now_seconds() - start;
+    }
+    *out_iters = iters;
+    return elapsed / iters;
+}
+
+/* matmul */
+typedef struct {
+    Tensor a, b;
+} MatmulCtx;
+
+static void matmul_fn(void* ctx) {
+    MatmulCtx* c = ctx;
+    Tensor_matmul(c->a, c->b);
+}
+
+// tuned runs one autotuned call before timing, so the tuning itself is not measured
+static void bench_matmul(int m, int k, int n, bool tuned) {
+    if(!selected("matmul")) return;
+    cten_begin_malloc(PoolId_Model);
+    MatmulCtx ctx = {rand_tensor((TensorShape){m, k}, false, 1),
+                     rand_tensor((TensorShape){k, n}, false, 1)};
+    cten_end_malloc();
+    if(tuned) {
+        cten_set_autotune(true);
+        matmul_fn(&ctx);
+        cten_set_autotune(false);
+    }
+    int iters;
+    double t = run(matmul_fn, &ctx, &iters);
+    printf("{\"bench\":\"matmul\",\"case\":\"%s%dx%dx%d\",\"iters\":%d,\"seconds\":%.9f,"
+           "\"gflops\":%.4f}\n",
+           tuned ? "tuned_" : "",
+           m,
+           k,
+           n,
+           iters,
+           t,
+           2.0 * m * k * n / t * 1e-9);
+    // and forgotten again, so the following cases run with the default blocking
+    cten_autotune_clear();
+    cten_free(PoolId_Model);
+}
+
+/* conv2d */
+typedef struct {
+    Tensor input, weight, bias;
+    int padding;
+} Conv2dCtx;
+
+static void conv2d_fn(void* ctx) {
+    Conv2dCtx* c = ctx;
+    nn_conv2d(c->input, c->weight, c->bias, 1, c->padding, 1, 1);
+}
+
+static void bench_conv2d(int n, int c, int hw, int oc, int k) {
+    if(!selected("conv2d")) return;
+    cten_begin_malloc(PoolId_Model);
+    Conv2dCtx ctx = {rand_tensor((TensorShape){n, c, hw, hw}, false, 1),
+                     rand_tensor((TensorShape){oc, c, k, k}, false, 1),
+                     rand_tensor((TensorShape){oc}, false, 1),
+                     k / 2};
+    cten_end_malloc();
+    int iters;
+    double t = run(conv2d_fn, &ctx, &iters);
+    printf("{\"bench\":\"conv2d\",\"case\":\"n%d_c%d_hw%d_oc%d_k%d\",\"iters\":%d,"
+           "\"seconds\":%.9f,\"gflops\":%.4f}\n",
+           n,
+           c,
+           hw,
+           oc,
+           k,
+           iters,
+           t,
+           2.0 * n * oc * hw * hw * c * k * k / t * 1e-9);
+    cten_free(PoolId_Model);
+}
+
+/* attention */
+typedef struct {
+    Tensor q, k, v;
+} AttentionCtx;
+
+static void attention_fn(void* ctx) {
+    AttentionCtx* c = ctx;
+    nn_attention(c->q, c->k, c->v, (Tensor){0});
+}
+
+static void bench_attention(int batch_heads, int seq_len, int head_dim) {
+    if(!selected("attention")) return;
+    cten_begin_malloc(PoolId_Model);
+    TensorShape shape = {batch_heads, seq_len, head_dim};
+    AttentionCtx ctx = {rand_tensor(shape, false, 1),
+                        rand_tensor(shape, false, 1),
+                        rand_tensor(shape, false, 1)};
+    cten_end_malloc();
+    int iters;
+    double t = run(attention_fn, &ctx, &iters);
+    printf("{\"bench\":\"attention\",\"case\":\"bh%d_s%d_d%d\",\"iters\":%d,\"seconds\":%.9f,"
+           "\"gflops\":%.4f}\n",
+           batch_heads,
+           seq_len,
+           head_dim,
+           iters,
+           t,
+           4.0 * batch_heads * seq_len * seq_len * head_dim / t * 1e-9);
+    cten_free(PoolId_Model);
+}
+
+/* recurrent forward + backward */
+typedef struct {
+    Tensor input, w_ih, w_hh, bias;
+    bool gru;
+} RnnCtx;
+
+static void rnn_fn(void* ctx) {
+    RnnCtx* c = ctx;
+    // the previous iteration's gradients were freed with its pool
+    Tensor params[3] = {c->w_ih, c->w_hh, c->bias};
+    for(int i = 0; i < 3; i++) {
+        params[i].node->grad = (Tensor){0};
+    }
+    Tensor out;
+    if(c->gru) {
+        out = nn_gru(c->input, c->w_ih, c->w_hh, c->bias, (Tensor){0}, NULL);
+    } else {
+        out = nn_lstm(c->input, c->w_ih, c->w_hh, c->bias, (Tensor){0}, (Tensor){0}, NULL, NULL);
+    }
+    Tensor_backward(Tensor_sum(out), (Tensor){0});
+}
+
+static void bench_rnn(bool gru, int batch_size, int seq_len, int n_features, int hidden) {
+    const char* name = gru ? "gru_step" : "lstm_step";
+    if(!selected(name)) return;
+    int n_gates = gru ? 3 : 4;
+    float scale = 1.0f / sqrtf(hidden);
+    cten_begin_malloc(PoolId_Model);
+    RnnCtx ctx = {
+        rand_tensor((TensorShape){batch_size, seq_len, n_features}, false, 1),
+        rand_tensor((TensorShape){n_features, n_gates * hidden}, true, scale),
+        rand_tensor((TensorShape){hidden, n_gates * hidden}, true, scale),
+        rand_tensor(gru ? (TensorShape){2, n_gates * hidden} : (TensorShape){n_gates * hidden},
+                    true,
+                    scale),
+        gru,
+    };
+    cten_end_malloc();
+    int iters;
+    double t = run(rnn_fn, &ctx, &iters);
+    printf("{\"bench\":\"%s\",\"case\":\"b%d_t%d_i%d_h%d\",\"iters\":%d,\"seconds\":%.9f,"
+           "\"samples_per_sec\":%.4f}\n",
+           name,
+           batch_size,
+           seq_len,
+           n_features,
+           hidden,
+           iters,
+           t,
+           batch_size / t);
+    cten_free(PoolId_Model);
+}
+
+/* elementwise and reductions */
+typedef struct {
+    int n_inputs;
+    int n_outputs;
+    Tensor (*binary)(Tensor, Tensor);
+    Tensor (*unary)(Tensor);
+    Tensor a, b;
+} ElemwiseCtx;
+
+static void elemwise_fn(void* ctx) {
+    ElemwiseCtx* c = ctx;
+    if(c->binary) {
+        c->binary(c->a, c->b);
+    } else {
+        c->unary(c->a);
+    }
+}
+
+static void bench_elemwise(const char* name,
+                           Tensor (*binary)(Tensor, Tensor),
+                           Tensor (*unary)(Tensor),
+                           bool reduction,
+                           int numel) {
+    if(!selected(name)) return;
+    cten_begin_malloc(PoolId_Model);
+    ElemwiseCtx ctx = {binary ? 2 : 1,
+                       reduction ? 0 : 1,
+                       binary,
+                       unary,
+                       rand_tensor((TensorShape){numel}, false, 1),
+                       rand_tensor((TensorShape){numel}, false, 1)};
+    cten_end_malloc();
+    int iters;
+    double t = run(elemwise_fn, &ctx, &iters);
+    double bytes = sizeof(float) * (double)numel * (ctx.n_inputs + ctx.n_outputs);
+    printf("{\"bench\":\"%s\",\"case\":\"%d\",\"iters\":%d,\"seconds\":%.9f,\"gbps\":%.4f}\n",
+           name,
+           numel,
+           iters,
+           t,
+           bytes / t * 1e-9);
+    cten_free(PoolId_Model);
+}
+
+/* batch assembly: stack samples into a batch, pick rows of it, split it into column blocks */
+typedef struct {
+    Tensor samples[256];
+    int n_samples;
+    int rows[256];
+} BatchCtx;
+
+static void batch_fn(void* ctx) {
+    BatchCtx* c = ctx;
+    Tensor batch = Tensor_stack(c->samples, c->n_samples, 0);
+    Tensor picked = Tensor_index_select(batch, 0, c->rows, c->n_samples);
+    Tensor heads[8];
+    Tensor_split(picked, 1, 8, NULL, heads);
+}
+
+static void bench_batch(int n_samples, int n_features) {
+    if(!selected("batch")) return;
+    BatchCtx ctx = {.n_samples = n_samples};
+    cten_begin_malloc(PoolId_Model);
+    for(int i = 0; i < n_samples; i++) {
+        ctx.samples[i] = rand_tensor((TensorShape){n_features}, false, 1);
+        ctx.rows[i] = (i * 7) % n_samples;
+    }
+    cten_end_malloc();
+    int iters;
+    double t = run(batch_fn, &ctx, &iters);
+    // each op reads and writes the whole batch once
+    double bytes = 6 * sizeof(float) * (double)n_samples * n_features;
+    printf("{\"bench\":\"batch\",\"case\":\"b%d_f%d\",\"iters\":%d,\"seconds\":%.9f,"
+           "\"gbps\":%.4f}\n",
+           n_samples,
+           n_features,
+           iters,
+           t,
+           bytes / t * 1e-9);
+    cten_free(PoolId_Model);
+}
+
+/* top-k over the last dim, e.g. beam search over a vocabulary; k == d sorts */
+typedef struct {
+    Tensor x;
+    int k;
+    int* indices;
+} TopkCtx;
+
+static void topk_fn(void* ctx) {
+    TopkCtx* c = ctx;
+    Tensor_topk(c->x, -1, c->k, true, c->indices);
+}
+
+static void bench_topk(int n_rows, int d, int k) {
+    if(!selected("topk")) return;
+    cten_begin_malloc(PoolId_Model);
+    TopkCtx ctx = {rand_tensor((TensorShape){n_rows, d}, false, 1),
+                   k,
+                   malloc(sizeof(int) * n_rows * k)};
+    cten_end_malloc();
+    int iters;
+    double t = run(topk_fn, &ctx, &iters);
+    printf("{\"bench\":\"topk\",\"case\":\"%sr%d_d%d_k%d\",\"iters\":%d,\"seconds\":%.9f,"
+           "\"rows_per_sec\":%.4f}\n",
+           k == d ? "sort_" : "",
+           n_rows,
+           d,
+           k,
+           iters,
+           t,
+           n_rows / t);
+    free(ctx.indices);
+    cten_free(PoolId_Model);
+}
+
+/* end-to-end training step */
+typedef struct {
+    Tensor params[6];
+    optim_sgd* optimizer;
+    Tensor input;
+    Tensor y_true;
+    bool offload;
+} MLPCtx;
+
+static void mlp_step_fn(void* ctx) {
+    MLPCtx* c = ctx;
+    optim_sgd_zerograd(c->optimizer);
+    if(c->offload) cten_begin_offload();
+    Tensor x = nn_linear(c->input, c->params[0], c->params[1]);
+    x = nn_relu(x);
+    x = nn_linear(x, c->params[2], c->params[3]);
+    x = nn_relu(x);
+    x = nn_linear(x, c->params[4], c->params[5]);
+    x = nn_softmax(x);
+    Tensor loss = nn_crossentropy(c->y_true, x);
+    if(c->offload) cten_end_offload();
+    Tensor_backward(loss, (Tensor){0});
+    optim_sgd_step(c->optimizer);
+}
+
+// fused applies each parameter's update inside backward instead of in optim_sgd_step();
+// pool_flags is a placement policy for the model and per-step pools; offload spills the forward's
+// activations of 256 KiB and up
+static void bench_mlp(int batch_size, int width, bool fused, int pool_flags, bool offload) {
+    if(!selected("mlp_step")) return;
+    cten_pool_set_policy(PoolId_Default, (PoolPolicy){pool_flags, 0});
+    cten_pool_set_policy(PoolId_Model, (PoolPolicy){pool_flags, 0});
+    const int n_features = 64;
+    const int n_classes = 10;
+    MLPCtx ctx;
+    ctx.offload = offload;
+    if(offload) cten_offload_config(NULL, 256 << 10);
+    cten_begin_malloc(PoolId_Model);
+    int dims[4] = {n_features, width, width, n_classes};
+    for(int i = 0; i < 3; i++) {
+        float scale = 1.0f / sqrtf(dims[i]);
+        ctx.params[2 * i] = rand_tensor((TensorShape){dims[i], dims[i + 1]}, true, scale);
+        ctx.params[2 * i + 1] = Tensor_zeros((TensorShape){1, dims[i + 1]}, true);
+    }
+    ctx.input = rand_tensor((TensorShape){batch_size, n_features}, false, 1);
+    ctx.y_true = Tensor_zeros((TensorShape){batch_size, n_classes}, false);
+    for(int i = 0; i < batch_size; i++) {
+        Tensor_set(ctx.y_true, i, i % n_classes, 0, 0, 1.0f);
+    }
+    cten_end_malloc();
+    cten_begin_malloc(PoolId_Optimizer);
+    ctx.optimizer = optim_sgd_new(6, ctx.params);
+    optim_sgd_config(ctx.optimizer, 0.01f, 0.0f);
+    optim_sgd_config_fused(ctx.optimizer, fused);
+    cten_end_malloc();
+
+    int iters;
+    double t = run(mlp_step_fn, &ctx, &iters);
+    printf("{\"bench\":\"mlp_step\",\"case\":\"%s%s%sb%d_w%d\",\"iters\":%d,\"seconds\":%.9f,"
+           "\"steps_per_sec\":%.4f,\"samples_per_sec\":%.4f}\n",
+           pool_flags & CTEN_POOL_HUGEPAGE ? "hugepage_" : "",
+           offload ? "offload_" : "",
+           fused ? "fused_" : "",
+           batch_size,
+           width,
+           iters,
+           t,
+           1.0 / t,
+           batch_size / t);
+    optim_sgd_delete(ctx.optimizer);
+    cten_free(PoolId_Optimizer);
+    cten_free(PoolId_Model);
+    cten_pool_set_policy(PoolId_Default, (PoolPolicy){0});
+    cten_pool_set_policy(PoolId_Model, (PoolPolicy){0});
+    cten_pool_trim();
+}
+
+typedef struct SparseLinearCtx {
+    SparseTensor sparse;
+    Tensor dense, weight, bias;
+    bool use_sparse;
+} SparseLinearCtx;
+
+static void sparse_linear_fn(void* ctx) {
+    SparseLinearCtx* c = ctx;
+    Tensor y = c->use_sparse ? nn_linear_sparse(c->sparse, c->weight, c->bias)
+                             : nn_linear(c->dense, c->weight, c->bias);
+    Tensor_backward(Tensor_sum(y), (Tensor){0});
+    c->weight.node->grad = (Tensor){0};
+    c->bias.node->grad = (Tensor){0};
+}
+
+// forward + backward of an input layer whose (batch, n_features) input has the given density
+static void bench_sparse_linear(int batch_size, int n_features, int width, float density) {
+    if(!selected("sparse_linear")) return;
+    SparseLinearCtx ctx;
+    cten_begin_malloc(PoolId_Model);
+    ctx.dense = Tensor_zeros((TensorShape){batch_size, n_features}, false);
+    for(int i = 0; i < ctx.dense.data->numel; i++) {
+        if(rand_uniform(0, 1) < density) ctx.dense.data->flex[i] = rand_uniform(-1, 1);
+    }
+    ctx.sparse = SparseTensor_from_dense(ctx.dense, false);
+    ctx.weight = rand_tensor((TensorShape){n_features, width}, true, 0.05f);
+    ctx.bias = Tensor_zeros((TensorShape){1, width}, true);
+    cten_end_malloc();
+
+    for(int use_sparse = 0; use_sparse < 2; use_sparse++) {
+        ctx.use_sparse = use_sparse;
+        int iters;
+        double t = run(sparse_linear_fn, &ctx, &iters);
+        printf("{\"bench\":\"sparse_linear\",\"case\":\"%s_b%d_f%d_w%d_d%g\",\"iters\":%d,"
+               "\"seconds\":%.9f}\n",
+               use_sparse ? "csr" : "dense",
+               batch_size,
+               n_features,
+               width,
+               density,
+               iters,
+               t);
+    }
+    cten_free(PoolId_Model);
+}
+
+typedef struct LinearEvalCtx {
+    Tensor input, weight, bias;
+    bool prepacked;
+} LinearEvalCtx;
+
+static void linear_eval_fn(void* ctx) {
+    LinearEvalCtx* c = ctx;
+    cten_begin_eval();
+    // Tensor_matmul packs the weight on every call, as nn_linear did before prepacking
+    if(c->prepacked) {
+        nn_linear(c->input, c->weight, c->bias);
+    } else {
+        Tensor_add(Tensor_matmul(c->input, c->weight), c->bias);
+    }
+    cten_end_eval();
+}
+
+// small-batch inference, where packing the weight dominates the GEMM itself
+static void bench_linear_eval(int batch_size, int in_features, int out_features) {
+    if(!selected("linear_eval")) return;
+    LinearEvalCtx ctx;
+    cten_begin_malloc(PoolId_Model);
+    ctx.input = rand_tensor((TensorShape){batch_size, in_features}, false, 1.0f);
+    ctx.weight = rand_tensor((TensorShape){in_features, out_features}, true, 0.05f);
+    ctx.bias = Tensor_zeros((TensorShape){1, out_features}, true);
+    cten_end_malloc();
+
+    for(int prepacked = 0; prepacked < 2; prepacked++) {
+        ctx.prepacked = prepacked;
+        int iters;
+        double t = run(linear_eval_fn, &ctx, &iters);
+        printf("{\"bench\":\"linear_eval\",\"case\":\"%s_b%d_%dx%d\",\"iters\":%d,"
+               "\"seconds\":%.9f}\n",
+               prepacked ? "prepacked" : "matmul",
+               batch_size,
+               in_features,
+               out_features,
+               iters,
+               t);
+    }
+    cten_free(PoolId_Model);
+}
+
+typedef struct ServeCtx {
+    Tensor params[4];
+    cten_server* server;
+    int n_features;
+    int n_classes;
+    double deadline;
+    int64_t requests;
+} ServeCtx;
+
+static Tensor serve_forward(void* model, Tensor x) {
+    ServeCtx* c = model;
+    x = nn_relu(nn_linear(x, c->params[0], c->params[1]));
+    return nn_softmax(nn_linear(x, c->params[2], c->params[3]));
+}
+
+static void* serve_client(void* arg) {
+    ServeCtx* c = arg;
+    float input[64], output[16];
+    for(int i = 0; i < c->n_features; i++) {
+        input[i] = 0.01f * i;
+    }
+    int64_t n = 0;
+    while(now_seconds() < c->deadline) {
+        cten_server_infer(c->server, input, output);
+        n++;
+    }
+    __atomic_fetch_add(&c->requests, n, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// n_clients threads each keep one single-sample request in flight
+static void bench_serve(int n_clients, int max_batch, int max_delay_us) {
+    if(!selected("serve")) return;
+    ServeCtx ctx = {.n_features = 64, .n_classes = 10};
+    cten_begin_malloc(PoolId_Model);
+    ctx.params[0] = rand_tensor((TensorShape){ctx.n_features, 512}, false, 0.05f);
+    ctx.params[1] = Tensor_zeros((TensorShape){1, 512}, false);
+    ctx.params[2] = rand_tensor((TensorShape){512, ctx.n_classes}, false, 0.05f);
+    ctx.params[3] = Tensor_zeros((TensorShape){1, ctx.n_classes}, false);
+    cten_end_malloc();
+    ctx.server = cten_server_new(
+        serve_forward, &ctx, ctx.n_features, ctx.n_classes, max_batch, max_delay_us, 1);
+
+    pthread_t clients[64];
+    double start = now_seconds();
+    ctx.deadline = start + g_min_seconds;
+    for(int i = 0; i < n_clients; i++) {
+        pthread_create(&clients[i], NULL, serve_client, &ctx);
+    }
+    for(int i = 0; i < n_clients; i++) {
+        pthread_join(clients[i], NULL);
+    }
+    double elapsed = now_seconds() - start;
+    ServerStats stats = cten_server_stats(ctx.server);
+    printf("{\"bench\":\"serve\",\"case\":\"c%d_b%d_d%d\",\"requests\":%lld,\"seconds\":%.9f,"
+           "\"requests_per_sec\":%.4f,\"avg_batch\":%.2f}\n",
+           n_clients,
+           max_batch,
+           max_delay_us,
+           (long long)ctx.requests,
+           elapsed,
+           ctx.requests / elapsed,
+           stats.batches > 0 ? (double)stats.requests / stats.batches : 0);
+    cten_server_delete(ctx.server);
+    cten_free(PoolId_Model);
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1 && strcmp(argv[1], "all") != 0) g_filter = argv[1];
+    if(argc > 2) g_min_seconds = atof(argv[2]);
+
+    cten_initilize();
+    // results must not depend on a cache left by earlier tuned runs
+    cten_autotune_clear();
+    printf("{\"bench\":\"meta\",\"commit\":\"%s\",\"compiler\":\"%s\",\"flags\":\"%s\","
+           "\"min_seconds\":%g}\n",
+           CTEN_BENCH_COMMIT,
+           __VERSION__,
+           CTEN_BENCH_FLAGS,
+           g_min_seconds);
+    fflush(stdout);
+
+    int matmul_shapes[][3] = {
+        {64,  64,  64 },
+        {128, 128, 128},
+        {256, 256, 256},
+        {512, 512, 512},
+        {1,   512, 512},
+        {32,  784, 128},
+        {256, 64,  1024},
+    };
+    for(int i = 0; i < sizeof(matmul_shapes) / sizeof(matmul_shapes[0]); i++) {
+        bench_matmul(matmul_shapes[i][0], matmul_shapes[i][1], matmul_shapes[i][2], false);
+        bench_matmul(matmul_shapes[i][0], matmul_shapes[i][1], matmul_shapes[i][2], true);
+        fflush(stdout);
+    }
+
+    int conv_shapes[][5] = {
+        {8, 3,   32, 32,  3},
+        {8, 32,  16, 64,  3},
+        {8, 64,  32, 64,  1},
+        {8, 128, 14, 128, 3},
+    };
+    for(int i = 0; i < sizeof(conv_shapes) / sizeof(conv_shapes[0]); i++) {
+        int* s = conv_shapes[i];
+        bench_conv2d(s[0], s[1], s[2], s[3], s[4]);
+        fflush(stdout);
+    }
+
+    int attention_shapes[][3] = {
+        {8, 128,  64},
+        {8, 512,  64},
+        {4, 2048, 64},
+    };
+    for(int i = 0; i < sizeof(attention_shapes) / sizeof(attention_shapes[0]); i++) {
+        int* s = attention_shapes[i];
+        bench_attention(s[0], s[1], s[2]);
+        fflush(stdout);
+    }
+
+    bench_rnn(false, 32, 64, 16, 128);
+    bench_rnn(true, 32, 64, 16, 128);
+    fflush(stdout);
+
+    int sizes[] = {1 << 10, 1 << 16, 1 << 20, 1 << 22};
+    for(int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_elemwise("add", Tensor_add, NULL, false, sizes[i]);
+        bench_elemwise("mul", Tensor_mul, NULL, false, sizes[i]);
+        bench_elemwise("relu", NULL, nn_relu, false, sizes[i]);
+        bench_elemwise("softmax", NULL, nn_softmax, false, sizes[i]);
+        bench_elemwise("sum", NULL, Tensor_sum, true, sizes[i]);
+        bench_elemwise("mean", NULL, Tensor_mean, true, sizes[i]);
+        bench_elemwise("max", NULL, Tensor_max, true, sizes[i]);
+        // the fixed block tree of deterministic mode, against the per-thread slices above
+        cten_set_deterministic(true);
+        bench_elemwise("sum_det", NULL, Tensor_sum, true, sizes[i]);
+        bench_elemwise("mean_det", NULL, Tensor_mean, true, sizes[i]);
+        cten_set_deterministic(false);
+        fflush(stdout);
+    }
+
+    bench_batch(64, 1024);
+    bench_batch(256, 4096);
+    bench_batch(256, 65536);
+    fflush(stdout);
+
+    bench_topk(1, 32000, 10);
+    bench_topk(64, 32000, 10);
+    bench_topk(64, 32000, 1000);
+    bench_topk(1024, 1024, 1024);
+    fflush(stdout);
+
+    int batch_sizes[] = {8, 64, 256};
+    int widths[] = {32, 128, 512};
+    for(int i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+        for(int j = 0; j < sizeof(widths) / sizeof(widths[0]); j++) {
+            bench_mlp(batch_sizes[i], widths[j], false, 0, false);
+            bench_mlp(batch_sizes[i], widths[j], true, 0, false);
+            if(widths[j] >= 512) {
+                bench_mlp(batch_sizes[i], widths[j], false, CTEN_POOL_HUGEPAGE, false);
+                bench_mlp(batch_sizes[i], widths[j], false, 0, true);
+            }
+            fflush(stdout);
+        }
+    }
+
+    bench_sparse_linear(256, 4096, 256, 0.01f);
+    bench_sparse_linear(256, 4096, 256, 0.05f);
+    fflush(stdout);
+
+    bench_linear_eval(1, 1024, 1024);
+    bench_linear_eval(8, 1024, 1024);
+    bench_linear_eval(64, 1024, 1024);
+    fflush(stdout);
+
+    // max_batch 1 is the one-sample-at-a-time baseline
+    bench_serve(32, 1, 0);
+    bench_serve(32, 32, 500);
+    fflush(stdout);
+
+    cten_finalize();
+    return 0;
+}
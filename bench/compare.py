@@ -0,0 +1,43 @@
+"""Compare two cten_bench result files.
+
+Usage: python3 bench/compare.py baseline.txt candidate.txt
+"""
+
+import json
+import sys
+
+METRICS = ["gflops", "gbps", "steps_per_sec"]
+
+
+def load(path):
+    results = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith("{"):
+                continue
+            r = json.loads(line)
+            if r["bench"] == "meta":
+                continue
+            for metric in METRICS:
+                if metric in r:
+                    results[(r["bench"], r["case"])] = (metric, r[metric])
+    return results
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__.strip())
+        sys.exit(1)
+    base = load(sys.argv[1])
+    cand = load(sys.argv[2])
+    print(f"{'bench':<10} {'case':<14} {'metric':<14} {'base':>12} {'new':>12} {'change':>8}")
+    for key in sorted(base.keys() & cand.keys()):
+        metric, b = base[key]
+        _, c = cand[key]
+        change = (c / b - 1) * 100 if b > 0 else float("nan")
+        print(f"{key[0]:<10} {key[1]:<14} {metric:<14} {b:>12.4f} {c:>12.4f} {change:>+7.1f}%")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,15 @@
+set -e
+
+SRC=$(find src/ -name "*.c")
+
+# kernels.c is compiled once here, so only the generic kernels are built; the CMake build adds the
+# AVX2/AVX-512 variants picked at runtime
+FLAGS="-std=c11 -Iinclude -O3 -DNDEBUG"
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+echo "Compiling benchmark..."
+${CC:-cc} $FLAGS -DCTEN_BENCH_COMMIT="\"$COMMIT\"" -DCTEN_BENCH_FLAGS="\"$FLAGS\"" \
+    $SRC bench/bench.c -pthread -lm -o cten_bench
+
+echo "Run: ./cten_bench [filter] [min_seconds] > bench_output.txt"
@@ -9,6 +9,7 @@ typedef int TensorShape[4];
 typedef struct GradNode GradNode;
 
 typedef struct FloatBuffer {
+    uint32_t version;  // bumped by in-place writes, so data derived from the buffer can revalidate
     int numel;
     float flex[];
 } FloatBuffer;
@@ -24,6 +25,16 @@ typedef struct GradNode {
     struct Tensor (*grad_fn)(struct Tensor self, int i);
     struct Tensor inputs[4];
     int n_inputs;
+    const char* name;
+    void* ctx;        // op-specific state saved for grad_fn
+    int n_pending;    // consumers not yet visited by Tensor_backward
+    int* grad_rows;   // non-NULL when grad is row-sparse: grad row r is input row grad_rows[r]
+    FloatBuffer* grad_buffer;  // owned by this node, so backward may accumulate into it in place
+    // a leaf's row-sparse gradient storage, reused across steps: row_capacity rows of data, then
+    // their indices
+    FloatBuffer* row_buffer;
+    int row_capacity;
+    bool transient_grad;  // a grad hook consumes it during backward: no buffer outside its pool
 } GradNode;
 
 void cten_initilize();
@@ -39,13 +50,24 @@ int TensorShape_tostring(TensorShape shape, char* buf, int size);
 Tensor Tensor_new(TensorShape shape, bool requires_grad);
 Tensor Tensor_zeros(TensorShape shape, bool requires_grad);
 Tensor Tensor_ones(TensorShape shape, bool requires_grad);
+Tensor Tensor_uniform(TensorShape shape, float low, float high, bool requires_grad);
+Tensor Tensor_normal(TensorShape shape, float mean, float std, bool requires_grad);
+void Tensor_uniform_(Tensor self, float low, float high);
+void Tensor_normal_(Tensor self, float mean, float std);
 
 float Tensor_get(Tensor self, int i, int j, int k, int l);
 void Tensor_set(Tensor self, int i, int j, int k, int l, float value);
+// marks self as modified after writing data->flex directly; the library's own writes do it already
+void Tensor_bump_version(Tensor self);
 
 Tensor Tensor_detach(Tensor self);
 void Tensor_backward(Tensor self, Tensor grad);
 int Tensor_backward_apply(Tensor self, void (*f)(Tensor, void*), void* ctx);
+/* hooks run inside Tensor_backward as soon as the gradient of leaf `self` is final, i.e. once every
+ * consumer in the graph has contributed; they are kept by the current context */
+typedef void (*cten_grad_hook)(Tensor self, void* ctx);
+void Tensor_register_grad_hook(Tensor self, cten_grad_hook fn, void* ctx);
+void Tensor_remove_grad_hook(Tensor self, cten_grad_hook fn, void* ctx);
 
 void Tensor_print(Tensor self);
 
@@ -72,8 +94,32 @@ Tensor Tensor_mean(Tensor self);
 Tensor Tensor_max(Tensor self);
 Tensor Tensor_min(Tensor self);
 
+// along the last dim
 void Tensor_argmax(Tensor self, int* out);
 
+/* Indexing and joining along dim (negative counts from the end). Index arrays are plain ints */
+// the n_indices slabs self[.., indices[j], ..] along dim
+Tensor Tensor_index_select(Tensor self, int dim, const int* indices, int n_indices);
+// indices has `shape`, which equals self's shape except along dim; out[.., j, ..] takes each
+// element from self[.., indices[.., j, ..], ..]
+Tensor Tensor_gather(Tensor self, int dim, const int* indices, TensorShape shape);
+// self with every element of src added at self[.., indices[.., j, ..], ..]; indices has src's shape
+Tensor Tensor_scatter_add(Tensor self, int dim, const int* indices, Tensor src);
+Tensor Tensor_concat(const Tensor* tensors, int n, int dim);
+// joins n tensors of one shape along a new dim
+Tensor Tensor_stack(const Tensor* tensors, int n, int dim);
+// writes n parts of sizes[i] along dim to out, or n equal parts when sizes is NULL
+void Tensor_split(Tensor self, int dim, int n, const int* sizes, Tensor* out);
+
+/* Selection along dim. Index outputs are laid out like the values, so they feed Tensor_gather();
+ * equal values keep their order, and NaN ranks above every number */
+// the k largest (or smallest) elements along dim, best first; indices may be NULL
+Tensor Tensor_topk(Tensor self, int dim, int k, bool largest, int* indices);
+Tensor Tensor_sort(Tensor self, int dim, bool descending, int* indices);
+// out has self's shape without dim; the first of equal values wins
+void Tensor_argmax_dim(Tensor self, int dim, int* out);
+void Tensor_argmin_dim(Tensor self, int dim, int* out);
+
 /* Neural Networks */
 Tensor nn_log(Tensor self);
 Tensor nn_exp(Tensor self);
@@ -82,7 +128,12 @@ Tensor nn_sin(Tensor self);
 Tensor nn_cos(Tensor self);
 Tensor nn_tan(Tensor self);
 
+/* in eval mode a 2-D weight is multiplied in the GEMM's packed layout, cached across calls and
+ * threads and repacked when the weight's version changes. cten_prepack() packs ahead of time, e.g.
+ * before serving; cten_prepack_clear() drops every cached pack */
 Tensor nn_linear(Tensor input, Tensor weight, Tensor bias);
+void cten_prepack(Tensor weight);
+void cten_prepack_clear();
 Tensor nn_relu(Tensor input);
 Tensor nn_sigmoid(Tensor input);
 Tensor nn_tanh(Tensor input);
@@ -90,6 +141,101 @@ Tensor nn_softmax(Tensor input);
 
 Tensor nn_crossentropy(Tensor y_true, Tensor y_pred);
 
+/* zeroes elements with probability p and scales the rest by 1 / (1 - p); identity in eval mode.
+ * The mask is regenerated from its random counter in backward rather than stored */
+Tensor nn_dropout(Tensor input, float p);
+
+/* in-place initializers; 2-D weights are (in, out), higher-rank ones (out, in, ...) */
+void nn_init_xavier_uniform(Tensor self);
+void nn_init_xavier_normal(Tensor self);
+void nn_init_kaiming_uniform(Tensor self);
+void nn_init_kaiming_normal(Tensor self);
+
+/* weight: (vocab, dim); returns (n_indices, dim). The weight gradient is row-sparse */
+Tensor nn_embedding(Tensor weight, const int* indices, int n_indices);
+
+/* input: (N, C, H, W); weight: (OC, C / groups, KH, KW); bias: (OC) or (Tensor){0} */
+Tensor nn_conv2d(Tensor input,
+                 Tensor weight,
+                 Tensor bias,
+                 int stride,
+                 int padding,
+                 int dilation,
+                 int groups);
+Tensor nn_maxpool2d(Tensor input, int kernel_size, int stride, int padding);
+Tensor nn_avgpool2d(Tensor input, int kernel_size, int stride, int padding);
+
+/* input: (B, T, I); w_ih: (I, 4H); w_hh: (H, 4H); bias: (4H) or (Tensor){0}; gates in i, f, g, o
+ * order. h0, c0: (B, H) initial states, or (Tensor){0} for zeros; they get no gradient. Returns
+ * every hidden state (B, T, H) and copies the final states to *h_n / *c_n unless NULL; gradients
+ * flow back through both */
+Tensor nn_lstm(Tensor input,
+               Tensor w_ih,
+               Tensor w_hh,
+               Tensor bias,
+               Tensor h0,
+               Tensor c0,
+               Tensor* h_n,
+               Tensor* c_n);
+/* w_ih: (I, 3H); w_hh: (H, 3H); bias: (2, 3H) holding the input and hidden biases, or
+ * (Tensor){0}; gates in r, z, n order */
+Tensor nn_gru(Tensor input, Tensor w_ih, Tensor w_hh, Tensor bias, Tensor h0, Tensor* h_n);
+
+/* softmax(q @ k^T / sqrt(D) + mask) @ v without materializing the score matrix
+ * q: (B, H, Sq, D) or (B, Sq, D); k, v: (B, H, Sk, D) or (B, Sk, D);
+ * mask: additive (Sq, Sk), e.g. -INFINITY above the diagonal for causal attention, or
+ * (Tensor){0} */
+Tensor nn_attention(Tensor q, Tensor k, Tensor v, Tensor mask);
+
+/* normalizes over the last dim; weight, bias: (D) or (Tensor){0} */
+Tensor nn_layernorm(Tensor input, Tensor weight, Tensor bias, float eps);
+/* input: (N, C, ...), normalized per channel; weight, bias, running_mean, running_var: (C) or
+ * (Tensor){0}. Training updates the running statistics in place, eval mode normalizes with them */
+Tensor nn_batchnorm(Tensor input,
+                    Tensor weight,
+                    Tensor bias,
+                    Tensor running_mean,
+                    Tensor running_var,
+                    float momentum,
+                    float eps);
+
+/* Context: memory pools, eval mode and profiler state. Each thread starts with its own default
+ * context, so threads using the API concurrently never share pools; cten_context_set() switches the
+ * calling thread to an explicit context, e.g. one per request. A context is used by one thread at
+ * a time, and tensors must not outlive the context whose pools they came from. */
+typedef struct cten_context cten_context;
+
+cten_context* cten_context_new();
+// frees every pool block still owned by ctx
+void cten_context_delete(cten_context* ctx);
+// returns the previous context; NULL goes back to the thread's default context
+cten_context* cten_context_set(cten_context* ctx);
+cten_context* cten_context_get();
+
+/* Sparse: CSR matrices as the left operand of a matmul. The index arrays and values live in the
+ * current pool; gradients flow to `values` (at the nonzero pattern) and to the dense operand */
+typedef struct SparseTensor {
+    int n_rows;
+    int n_cols;
+    int nnz;
+    int* row_ptr;   // n_rows + 1
+    int* col_idx;   // nnz, ascending within each row
+    Tensor values;  // nnz
+} SparseTensor;
+
+SparseTensor SparseTensor_from_dense(Tensor dense, bool requires_grad);
+// COO triplets in any order; duplicates are summed
+SparseTensor SparseTensor_from_coo(int n_rows,
+                                   int n_cols,
+                                   int nnz,
+                                   const int* rows,
+                                   const int* cols,
+                                   const float* values,
+                                   bool requires_grad);
+Tensor SparseTensor_to_dense(SparseTensor self);
+Tensor SparseTensor_matmul(SparseTensor self, Tensor other);
+Tensor nn_linear_sparse(SparseTensor input, Tensor weight, Tensor bias);
+
 /* Memory Management */
 typedef int64_t PoolId;
 
@@ -97,16 +243,213 @@ void cten_begin_malloc(PoolId id);
 void cten_end_malloc();
 void cten_free(PoolId id);
 
+typedef struct PoolStats {
+    PoolId id;
+    int64_t live_bytes;
+    int64_t peak_bytes;
+    int64_t live_allocs;
+    int64_t total_bytes;
+    int64_t total_allocs;
+} PoolStats;
+
+typedef struct PoolSite {
+    PoolId id;
+    const char* op;  // requires CTEN_PROFILE, otherwise "<untracked>"
+    int64_t bytes;
+    int64_t allocs;
+} PoolSite;
+
+PoolStats cten_pool_stats(PoolId id);
+int cten_pool_snapshot(PoolStats* out, int max_pools);
+void cten_pool_reset_peak(PoolId id);
+void cten_begin_track_sites();
+void cten_end_track_sites();
+int cten_pool_sites(PoolSite* out, int max_sites);
+void cten_pool_print();
+
+/* Placement of a pool's large blocks (256 KiB and up), which then get a mapping of their own.
+ * Huge pages cut TLB misses on big weights and activations. On multi-socket hosts INTERLEAVE
+ * spreads shared weights over every node's memory bandwidth, while BIND and LOCAL keep the pools
+ * of a per-thread context next to the thread that computes with them. Best effort: requests the
+ * system cannot honor fall back to normal pages. Policies belong to the current context. */
+enum {
+    CTEN_POOL_HUGEPAGE = 1,    // transparent huge pages
+    CTEN_POOL_HUGETLB = 2,     // reserved huge pages (vm.nr_hugepages), else transparent ones
+    CTEN_POOL_INTERLEAVE = 4,  // pages round-robin over all NUMA nodes
+    CTEN_POOL_BIND = 8,        // pages on NUMA node `node`
+    CTEN_POOL_LOCAL = 16,      // pages on the node of the CPU that allocates the block
+};
+
+typedef struct PoolPolicy {
+    int flags;
+    int node;
+} PoolPolicy;
+
+void cten_pool_set_policy(PoolId id, PoolPolicy policy);
+PoolPolicy cten_pool_get_policy(PoolId id);
+// freed mappings are kept for reuse by the next block of the same size; this unmaps them
+void cten_pool_trim();
+
+/* Activation offload: between cten_begin_offload() and cten_end_offload(), blocks of min_bytes and
+ * up are mapped from an unlinked spill file in dir. As the forward moves on, a background thread
+ * writes older blocks out and drops them from RAM; Tensor_backward reads them back a few nodes
+ * ahead of the grad_fns that use them. Wrap only the forward, so gradients stay in RAM. The spill
+ * file belongs to the current context and lives until it is reconfigured or deleted. */
+typedef struct OffloadStats {
+    int64_t spilled_bytes;     // mapped from the spill file
+    int64_t evicted_bytes;     // written out and dropped from RAM
+    int64_t prefetched_bytes;  // read back ahead of backward
+} OffloadStats;
+
+// dir NULL means $CTEN_OFFLOAD_DIR or /var/tmp; false if no spill file can be created there.
+// Without a call, the first cten_begin_offload() uses those and 1 MiB
+bool cten_offload_config(const char* dir, size_t min_bytes);
+void cten_begin_offload();
+bool cten_is_offload();
+void cten_end_offload();
+OffloadStats cten_offload_stats();
+
 /* Optimizer */
 typedef struct optim_sgd optim_sgd;
 
 optim_sgd* optim_sgd_new(int n_params, Tensor* params);
 void optim_sgd_config(optim_sgd* self, float lr, float momentum);
+/* clips the global gradient norm to max_norm inside optim_sgd_step(), folding the scale into the
+ * update instead of rewriting the gradients first; 0 disables */
+void optim_sgd_config_clip(optim_sgd* self, float max_norm);
+/* fused: every parameter is updated by a grad hook as soon as its gradient is final inside
+ * Tensor_backward, and the gradient is dropped right after, so optim_sgd_step() and zerograd have
+ * nothing left to do. Each backward is then one step: no clipping, accumulation or all-reduce.
+ * The hooks are kept by the current context, so configure it in the context that runs backward */
+void optim_sgd_config_fused(optim_sgd* self, bool fused);
 void optim_sgd_zerograd(optim_sgd* self);
 void optim_sgd_step(optim_sgd* self);
 void optim_sgd_delete(optim_sgd* self);
+int optim_sgd_state(optim_sgd* self, Tensor* out);
+// copies state into the optimizer's velocity buffers, so the source may be freed afterwards
+void optim_sgd_load_state(optim_sgd* self, const Tensor* state);
+
+/* Gradients accumulate across backward passes until the optimizer's zerograd, so several
+ * micro-batches can make up one step. Scales all gradients by max_norm / norm when their global
+ * L2 norm exceeds max_norm and returns the norm */
+float cten_clip_grad_norm(int n_params, Tensor* params, float max_norm);
+
+/* Checkpoint */
+#define CTEN_CHECKPOINT_NAME_MAX 64
+
+enum { CTEN_DTYPE_F32 = 0 };
+
+typedef struct cten_checkpoint cten_checkpoint;
+
+bool cten_save(const char* path, int n_tensors, const char* const* names, const Tensor* tensors);
+cten_checkpoint* cten_load(const char* path);
+int cten_checkpoint_size(cten_checkpoint* self);
+const char* cten_checkpoint_name(cten_checkpoint* self, int i);
+bool cten_checkpoint_has(cten_checkpoint* self, const char* name);
+/* version 2 files are mapped, and their tensors point into the mapping: they are valid only until
+ * cten_checkpoint_close(), so copy whatever must outlive it. Version 1 tensors are copied into the
+ * current pool */
+Tensor cten_checkpoint_get(cten_checkpoint* self, const char* name, bool requires_grad);
+void cten_checkpoint_close(cten_checkpoint* self);
+
+/* Data parallel: world_size local processes (ranks 0 .. world_size - 1) attach to the shared
+ * memory segment `name` (e.g. "/myjob", unique per job) and train replicas that start from the same
+ * parameters. cten_dist_allreduce() replaces every parameter's gradient with the average over all
+ * ranks and is called once per step, after backward and before the optimizer step. */
+typedef struct cten_dist cten_dist;
+
+cten_dist* cten_dist_new(const char* name, int rank, int world_size, int n_params, Tensor* params);
+void cten_dist_allreduce(cten_dist* self);
+/* on by default: a parameter is reduced while backward is still running, as soon as its gradient
+ * is final. Turn it off while accumulating gradients over several backward passes per step */
+void cten_dist_set_overlap(cten_dist* self, bool overlap);
+int cten_dist_rank(cten_dist* self);
+int cten_dist_world_size(cten_dist* self);
+void cten_dist_delete(cten_dist* self);
+
+/* Serving: single-sample requests are queued and coalesced into batches of up to max_batch rows,
+ * waiting at most max_delay_us for a batch to fill. Each batch runs as one forward(model, input)
+ * in eval mode on one of n_workers threads, with input (B, n_inputs); forward must return
+ * (B, n_outputs) and may only read the model. */
+typedef Tensor (*cten_forward_fn)(void* model, Tensor input);
+typedef struct cten_server cten_server;
+
+typedef struct ServerStats {
+    int64_t requests;
+    int64_t batches;
+} ServerStats;
+
+cten_server* cten_server_new(cten_forward_fn forward,
+                             void* model,
+                             int n_inputs,
+                             int n_outputs,
+                             int max_batch,
+                             int max_delay_us,
+                             int n_workers);
+// blocks until the request's batch has run; false if the server was shut down first
+bool cten_server_infer(cten_server* self, const float* input, float* output);
+/* accepts connections on a Unix domain socket; every frame of n_inputs native-endian floats is
+ * answered with n_outputs floats */
+bool cten_server_listen(cten_server* self, const char* path);
+ServerStats cten_server_stats(cten_server* self);
+// fails queued requests, closes connections and waits for in-flight callers
+void cten_server_delete(cten_server* self);
+
+/* Ahead-of-time compilation: cten_begin_trace() enters eval mode and records the forward that
+ * follows, until cten_end_trace(). cten_compile() then writes `path`, a standalone C file defining
+ *     void name([const float* weights,] const float* in0, ..., float* out)
+ * for exactly the traced shapes. Its inputs are the tensors passed to cten_trace_input(), in call
+ * order; every other tensor the output depends on is a constant, embedded in the source or, given
+ * weights_path, written there as raw floats for the caller to map and pass as `weights`.
+ * Elementwise chains run as one loop, fused into the matmul before them, and intermediates share
+ * a static per-thread arena. Compiles Tensor_add/sub/mul/div/pow (broadcasting), Tensor_addf/
+ * subf/mulf, Tensor_neg/abs, Tensor_matmul, nn_linear, nn_relu, nn_softmax and eval-mode
+ * nn_dropout; an output that depends on any other op fails the assertion in cten_compile() */
+void cten_begin_trace();
+bool cten_is_trace();
+// the next parameter of the compiled function
+void cten_trace_input(Tensor input);
+// false if a file cannot be written
+bool cten_compile(Tensor output, const char* name, const char* path, const char* weights_path);
+void cten_end_trace();
+
+/* Profiler (records only when built with CTEN_PROFILE) */
+void cten_begin_profile();
+bool cten_is_profile();
+void cten_end_profile();
+void cten_profile_reset();
+void cten_profile_print();
+bool cten_profile_export_trace(const char* path);
+
+/* Random (Philox4x32-10, one stream per thread) */
+void cten_seed(uint64_t seed);
 
 /* Misc */
+const char* cten_kernel_isa();
+/* worker threads for ops that parallelize over batch/heads; defaults to $CTEN_NUM_THREADS or the
+ * number of online CPUs */
+void cten_set_num_threads(int n);
+int cten_get_num_threads();
+/* Autotuning: in autotune mode the first GEMM of each shape is timed with the available kernel
+ * variants, a few block sizes and thread counts, and the fastest is used for that shape from then
+ * on. Choices persist in $CTEN_AUTOTUNE_CACHE (default $XDG_CACHE_HOME/cten-autotune or
+ * ~/.cache/cten-autotune), loaded at cten_initilize() and written back at cten_finalize() if
+ * anything new was tuned. CTEN_AUTOTUNE=1 turns the mode on from the start */
+void cten_set_autotune(bool enable);
+bool cten_is_autotune();
+// merges a cache file into the tuned shapes; false if it cannot be read
+bool cten_autotune_load(const char* path);
+bool cten_autotune_save(const char* path);
+// forgets every tuned shape; GEMMs go back to the default blocking
+void cten_autotune_clear();
+/* Deterministic mode: reductions split across threads (Tensor_sum, Tensor_mean) use a fixed
+ * block tree, and autotuned GEMMs keep the default K blocking and micro-kernel (variants may differ
+ * in FMA contraction), so results are bit-identical for any thread count and tuning cache, at
+ * some cost on large reductions. Softmax rows, broadcast gradients and gradient accumulation in
+ * Tensor_backward keep a fixed order in both modes. CTEN_DETERMINISTIC=1 turns it on from the
+ * start */
+void cten_set_deterministic(bool enable);
+bool cten_is_deterministic();
 void cten_begin_eval();
 bool cten_is_eval();
 void cten_end_eval();
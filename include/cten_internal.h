@@ -1,6 +1,260 @@
 #pragma once
 
 #include "cten.h"
+#include "common/vector.h"
 
 void* _cten_malloc(size_t size);
-void _cten_zero_grad(Tensor* params, int n_params);
\ No newline at end of file
+// pool of a block returned by _cten_malloc()
+PoolId _cten_pool_of(const void* ptr);
+
+/* Context: every piece of mutable library state that ops touch, so threads holding different
+ * contexts never share anything. Random streams and GEMM packing buffers stay per-thread. */
+typedef struct PoolAllocator PoolAllocator;
+typedef struct Profiler Profiler;
+typedef struct Tracer Tracer;
+
+typedef struct GradHook {
+    GradNode* node;
+    cten_grad_hook fn;
+    void* ctx;
+} GradHook;
+
+struct cten_context {
+    PoolAllocator* allocator;
+    Profiler* profiler;
+    const char* current_op;  // innermost op under CTEN_PROFILE, for allocation sites
+    int eval_depth;
+    c11_vector /*GradHook*/ grad_hooks;
+    Tracer* tracer;  // between cten_begin_trace() and cten_end_trace()
+};
+
+// the calling thread's default context, created on first use
+cten_context* _cten_default_context();
+PoolAllocator* _cten_pool_new();
+void _cten_pool_delete(PoolAllocator* self);
+Profiler* _cten_profiler_new();
+void _cten_profiler_delete(Profiler* self);
+void _cten_zero_grad(Tensor* params, int n_params);
+// a leaf's gradient storage, allocated once in the pool that holds the leaf itself
+FloatBuffer* _cten_grad_buffer(Tensor self);
+// L2 norm over the gradients of all params together; params without a gradient are skipped
+float _cten_grad_norm(int n_params, const Tensor* params);
+// adds rows[r] to row indices[r] of self's gradient, keeping it row-sparse when possible
+void _cten_accumulate_sparse_grad(Tensor self, Tensor rows, const int* indices);
+// self's dense gradient, zeroed on first use and owned by its node, for grad_fns that add into it in
+// place and return (Tensor){0}
+float* _cten_grad_dense(Tensor self);
+
+/* Kernels: src/kernel/kernels.c is compiled once per ISA and selected at cten_initilize() */
+#define CTEN_GEMM_MR 4
+#define CTEN_GEMM_NR 16
+// output channels per block of the direct convolution (NCHW16c)
+#define CTEN_CONV_OC_BLOCK 16
+
+typedef struct KernelTable {
+    const char* isa;
+    // c[MR x NR] (row stride ldc) += packed a[k x MR] * packed b[k x NR]
+    void (*gemm_ukernel)(int k, const float* a, const float* b, float* c, int ldc);
+    void (*add)(int n, const float* a, const float* b, float* out);
+    void (*sub)(int n, const float* a, const float* b, float* out);
+    void (*mul)(int n, const float* a, const float* b, float* out);
+    void (*div)(int n, const float* a, const float* b, float* out);
+    void (*relu)(int n, const float* x, float* out);
+    void (*axpy)(int n, float alpha, const float* x, float* y);
+    float (*sum)(int n, const float* x);
+    float (*max)(int n, const float* x);
+    float (*dot)(int n, const float* x, const float* y);
+    // out[ow x 16] = sum over (c, kh, kw) of x[c][kh][ow * stride + kw] * w[c][kh][kw][16]
+    // x is already padded and addressed by channel stride x_cs and row stride x_rs
+    void (*conv_row16)(int ow,
+                       int c,
+                       int kh,
+                       int kw,
+                       int stride,
+                       const float* x,
+                       int x_cs,
+                       int x_rs,
+                       const float* w,
+                       float* out);
+    // out[i] = uniform [0, 1) from Philox4x32-10 counter block (offset + i / 4, stream), lane i % 4
+    void (*philox_uniform)(uint64_t seed, uint32_t stream, uint64_t offset, int n, float* out);
+} KernelTable;
+
+extern KernelTable _cten_kernels;
+
+void _cten_kernels_select();
+// the tables of every variant this CPU can run, generic first and _cten_kernels last
+const KernelTable* _cten_kernel_variants(int* n);
+
+/* c[m x n] (+)= a[m x k] @ b[k x n]; operands are addressed through row/col strides, so
+ * transposed inputs need no copy */
+void _cten_gemm(int m,
+                int n,
+                int k,
+                const float* a,
+                int a_rs,
+                int a_cs,
+                const float* b,
+                int b_rs,
+                int b_cs,
+                float* c,
+                int ldc,
+                bool accumulate);
+// packs b[k x n] once into _cten_gemm_packed_size(k, n) floats of 64-byte aligned dst
+size_t _cten_gemm_packed_size(int k, int n);
+void _cten_gemm_pack_b(int k, int n, const float* b, int b_rs, int b_cs, float* dst);
+// _cten_gemm() with b already packed by _cten_gemm_pack_b()
+void _cten_gemm_prepacked(int m,
+                          int n,
+                          int k,
+                          const float* a,
+                          int a_rs,
+                          int a_cs,
+                          const float* packed_b,
+                          float* c,
+                          int ldc,
+                          bool accumulate);
+// frees the calling thread's GEMM packing buffer
+void _cten_gemm_release();
+
+/* GEMM blocking, chosen per shape by the autotuner (src/kernel/autotune.c) */
+typedef struct GemmConfig {
+    const char* isa;  // variant the micro-kernel comes from
+    void (*ukernel)(int k, const float* a, const float* b, float* c, int ldc);
+    int mc, kc, nc;
+    int n_threads;  // MC row blocks are split across this many pool threads
+} GemmConfig;
+
+// compile-time blocking with the selected micro-kernel on the calling thread
+GemmConfig _cten_gemm_default_config();
+// _cten_gemm() / _cten_gemm_prepacked() with explicit blocking; prepacked needs the default kc, nc
+void _cten_gemm_run(const GemmConfig* cfg,
+                    int m,
+                    int n,
+                    int k,
+                    const float* a,
+                    int a_rs,
+                    int a_cs,
+                    const float* b,
+                    int b_rs,
+                    int b_cs,
+                    const float* prepacked,
+                    float* c,
+                    int ldc,
+                    bool accumulate);
+// the blocking to run this GEMM with: tuned or loaded for its shape, else the default. In autotune
+// mode an unseen shape is timed first against scratch output, using a and b as they are
+GemmConfig _cten_gemm_config(int m,
+                             int n,
+                             int k,
+                             const float* a,
+                             int a_rs,
+                             int a_cs,
+                             const float* b,
+                             int b_rs,
+                             int b_cs,
+                             const float* prepacked);
+// loads $CTEN_AUTOTUNE_CACHE (or the per-user default) and $CTEN_AUTOTUNE; at cten_initilize()
+void _cten_autotune_init();
+// writes back shapes tuned since the cache was loaded; at cten_finalize()
+void _cten_autotune_finalize();
+
+/* Activation offload (src/offload.c): one spill file per context, driven by its pool allocator */
+typedef struct Offload Offload;
+
+// NULL if no spill file can be created in dir
+Offload* _cten_offload_new(const char* dir, size_t min_bytes);
+void _cten_offload_delete(Offload* self);
+size_t _cten_offload_min_bytes(const Offload* self);
+// a page-aligned block of length bytes backed by the spill file, or NULL
+void* _cten_offload_map(Offload* self, size_t length);
+void _cten_offload_unmap(Offload* self, void* base);
+// ptr is about to be used by backward: read its block and the ones allocated before it back in
+void _cten_offload_touch(Offload* self, const void* ptr);
+OffloadStats _cten_offload_stats(Offload* self);
+// _cten_offload_touch() for a block of the current context, if it was spilled
+void _cten_pool_prefetch(const void* ptr);
+
+/* Tracing for ahead-of-time compilation (src/aot.c). Both hooks do nothing unless the current
+ * context is tracing */
+typedef enum TraceOp {
+    TRACE_ADD,  // a op b, either side broadcast
+    TRACE_SUB,
+    TRACE_MUL,
+    TRACE_DIV,
+    TRACE_POW,
+    TRACE_ADDF,  // a op scalar
+    TRACE_SUBF,
+    TRACE_MULF,
+    TRACE_NEG,  // op a
+    TRACE_ABS,
+    TRACE_RELU,
+    TRACE_SOFTMAX,  // along the last dim
+    TRACE_MATMUL,   // b is 2-D or batched like a
+} TraceOp;
+
+void _cten_tracer_delete(Tracer* self);
+// a buffer handed out by Tensor_new()
+void _cten_trace_alloc(Tensor self);
+// res was computed as op(a, b, scalar) from the operands the op was called with, before any
+// broadcast copy; an enclosing op recording the same res replaces the inner record
+void _cten_trace_op(TraceOp op, Tensor res, Tensor a, Tensor b, float scalar);
+
+/* Prepacked weights (src/prepack.c), shared by all threads */
+typedef struct PackedWeight {
+    const FloatBuffer* key;
+    uint32_t version;
+    int k, n;
+    int refs;     // the cache's own reference plus one per holder
+    float* data;  // _cten_gemm_pack_b() layout
+} PackedWeight;
+
+// the cached pack of a 2-D weight, repacked first if it is stale; release after the GEMM
+PackedWeight* _cten_prepack_acquire(Tensor weight);
+void _cten_prepack_release(PackedWeight* self);
+// drops the pack of storage that is about to be freed
+void _cten_prepack_forget(const FloatBuffer* data);
+
+/* runs fn(ctx, 0 .. n-1) on the worker pool; the calling thread takes part. Tasks run outside the
+ * caller's context, so they must not allocate from the memory pools */
+void _cten_parallel_for(int n, void (*fn)(void* ctx, int i), void* ctx);
+void _cten_parallel_shutdown();
+// whether the calling thread is running a _cten_parallel_for() task
+bool _cten_in_parallel();
+
+/* Reductions (src/reduce.c); see cten_set_deterministic() for the summation order */
+float _cten_reduce_sum(int n, const float* x);
+// reads $CTEN_DETERMINISTIC; at cten_initilize()
+void _cten_reduce_init();
+
+// makes the calling thread random stream 0
+void _cten_random_init();
+
+typedef struct {
+    double start;
+    const char* prev_op;
+} _cten_ProfileScope;
+
+_cten_ProfileScope _cten_profile_start(const char* op);
+void _cten_profile_record(_cten_ProfileScope scope,
+                          const char* name,
+                          bool backward,
+                          const int* shape,
+                          double flops,
+                          double bytes);
+const char* _cten_current_op();
+
+#ifdef CTEN_PROFILE
+#define CTEN_PROFILE_BEGIN() _cten_ProfileScope _cten_profile_scope = _cten_profile_start(__func__)
+#define CTEN_PROFILE_BEGIN_GRAD(name)                                                              \
+    _cten_ProfileScope _cten_profile_scope = _cten_profile_start(name)
+#define CTEN_PROFILE_END(shape, flops, bytes)                                                      \
+    _cten_profile_record(_cten_profile_scope, __func__, false, shape, flops, bytes)
+#define CTEN_PROFILE_END_GRAD(name, shape, flops, bytes)                                           \
+    _cten_profile_record(_cten_profile_scope, name, true, shape, flops, bytes)
+#else
+#define CTEN_PROFILE_BEGIN()
+#define CTEN_PROFILE_BEGIN_GRAD(name)
+#define CTEN_PROFILE_END(shape, flops, bytes)
+#define CTEN_PROFILE_END_GRAD(name, shape, flops, bytes)
+#endif
\ No newline at end of file
@@ -0,0 +1,701 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Ahead-of-time compilation. While a trace is open, Tensor_new() registers every buffer it hands
+ * out and each supported op records what it computed and from which operands, so the node list is
+ * in allocation order, which is also a topological order of the forward. Buffers that show up
+ * only as operands are constants. cten_compile() walks back from the output and emits one loop
+ * nest per materialized node:
+ *   - an elementwise node read once, by an elementwise op of the same shape, is evaluated inside
+ *     its consumer's loop instead of being stored;
+ *   - a matmul read once like that is finished by that loop, applied to each block of rows while
+ *     they are still in cache;
+ *   - the remaining intermediates are packed into one arena, reusing the space of buffers whose
+ *     last reader has run. */
+
+// floats; arena slices and mapped weights start on 64-byte boundaries
+#define AOT_ALIGN 16
+// matmul rows sharing each pass over a row of the right operand
+#define AOT_ROW_BLOCK 4
+
+enum { NODE_UNKNOWN = -1, NODE_INPUT = -2, NODE_CONST = -3 };
+
+typedef struct TraceNode {
+    const FloatBuffer* data;
+    TensorShape shape;
+    int op;                   // TraceOp or NODE_*
+    int in[2];                // operand nodes, -1 if unused
+    TensorShape in_shape[2];  // as the op saw them
+    float scalar;
+    int input;  // parameter number of an input
+} TraceNode;
+
+struct Tracer {
+    c11_vector /*TraceNode*/ nodes;
+    int n_inputs;
+};
+
+static const char* g_op_names[] = {
+    "Tensor_add",
+    "Tensor_sub",
+    "Tensor_mul",
+    "Tensor_div",
+    "Tensor_pow",
+    "Tensor_addf",
+    "Tensor_subf",
+    "Tensor_mulf",
+    "Tensor_neg",
+    "Tensor_abs",
+    "nn_relu",
+    "nn_softmax",
+    "Tensor_matmul",
+};
+
+static bool _is_elementwise(int op) { return op >= TRACE_ADD && op <= TRACE_RELU; }
+
+static int _rank(const int* shape) {
+    int rank = 0;
+    while(rank < 4 && shape[rank] != 0) rank++;
+    return rank;
+}
+
+static int _numel(const int* shape) {
+    int numel = 1;
+    for(int i = 0; i < _rank(shape); i++) {
+        numel *= shape[i];
+    }
+    return numel;
+}
+
+static bool _same_shape(const int* a, const int* b) {
+    return memcmp(a, b, sizeof(TensorShape)) == 0;
+}
+
+static Tracer* _tracer() { return cten_context_get()->tracer; }
+
+static TraceNode* _node(const Tracer* self, int i) { return c11__at(TraceNode, &self->nodes, i); }
+
+// the newest node of a buffer, or -1
+static int _find(const Tracer* self, const FloatBuffer* data) {
+    for(int i = self->nodes.length - 1; i >= 0; i--) {
+        if(_node(self, i)->data == data) return i;
+    }
+    return -1;
+}
+
+static int _push(Tracer* self, Tensor t, int op) {
+    TraceNode node = {t.data, {0}, op, {-1, -1}, {{0}}, 0, -1};
+    memcpy(node.shape, t.shape, sizeof(TensorShape));
+    c11_vector__push(TraceNode, &self->nodes, node);
+    return self->nodes.length - 1;
+}
+
+void _cten_tracer_delete(Tracer* self) {
+    if(self == NULL) return;
+    c11_vector__dtor(&self->nodes);
+    free(self);
+}
+
+void _cten_trace_alloc(Tensor self) {
+    Tracer* tracer = _tracer();
+    if(tracer != NULL) _push(tracer, self, NODE_UNKNOWN);
+}
+
+static int _operand(Tracer* self, Tensor t) {
+    int i = _find(self, t.data);
+    return i >= 0 ? i : _push(self, t, NODE_CONST);
+}
+
+void _cten_trace_op(TraceOp op, Tensor res, Tensor a, Tensor b, float scalar) {
+    Tracer* self = _tracer();
+    if(self == NULL) return;
+    int in[2] = {_operand(self, a), b.data != NULL ? _operand(self, b) : -1};
+    int i = _find(self, res.data);
+    if(i < 0) i = _push(self, res, NODE_UNKNOWN);
+    TraceNode* node = _node(self, i);
+    node->op = op;
+    memcpy(node->shape, res.shape, sizeof(TensorShape));
+    node->in[0] = in[0];
+    node->in[1] = in[1];
+    memcpy(node->in_shape[0], a.shape, sizeof(TensorShape));
+    memcpy(node->in_shape[1], b.shape, sizeof(TensorShape));
+    node->scalar = scalar;
+}
+
+void cten_begin_trace() {
+    cten_context* ctx = cten_context_get();
+    cten_assert(ctx->tracer == NULL, "cten_begin_trace(): already tracing");
+    Tracer* self = calloc(1, sizeof(Tracer));
+    cten_assert(self != NULL, "cten_begin_trace(): out of memory");
+    c11_vector__ctor(&self->nodes, sizeof(TraceNode));
+    ctx->tracer = self;
+    cten_begin_eval();
+}
+
+bool cten_is_trace() { return _tracer() != NULL; }
+
+void cten_end_trace() {
+    cten_context* ctx = cten_context_get();
+    cten_assert(ctx->tracer != NULL, "cten_end_trace(): not tracing");
+    _cten_tracer_delete(ctx->tracer);
+    ctx->tracer = NULL;
+    cten_end_eval();
+}
+
+void cten_trace_input(Tensor input) {
+    Tracer* self = _tracer();
+    cten_assert(self != NULL, "cten_trace_input(): not tracing");
+    int i = _find(self, input.data);
+    if(i < 0) i = _push(self, input, NODE_CONST);
+    TraceNode* node = _node(self, i);
+    cten_assert(node->op == NODE_UNKNOWN || node->op == NODE_CONST,
+                "cten_trace_input(): the tensor is already an input or the result of a traced op");
+    node->op = NODE_INPUT;
+    memcpy(node->shape, input.shape, sizeof(TensorShape));
+    node->input = self->n_inputs++;
+}
+
+/* cten_compile */
+typedef struct NodePlan {
+    bool live;
+    int uses;
+    int consumer;
+    bool inlined;    // evaluated inside its consumer's expression
+    int fused_into;  // a matmul: the node whose loop finishes its rows, else -1
+    int matmul;      // the matmul this node finishes, else -1
+    int slot;        // weight number of a constant
+    int last_use;    // the last node whose loop reads it
+    int offset;      // in the arena, -1 if not there
+} NodePlan;
+
+typedef struct Compiler {
+    const Tracer* tracer;
+    NodePlan* plan;
+    int out;
+    int n_weights;
+    int arena_size;
+    const char* name;
+    FILE* f;
+} Compiler;
+
+static bool _is_identifier(const char* name) {
+    if(name == NULL || !(isalpha((unsigned char)name[0]) || name[0] == '_')) return false;
+    for(const char* p = name; *p; p++) {
+        if(!(isalnum((unsigned char)*p) || *p == '_')) return false;
+    }
+    return true;
+}
+
+// whether operand k of node c can be computed inside c's loop
+static bool _can_inline(const Compiler* c, int consumer, int k) {
+    const TraceNode* node = _node(c->tracer, consumer);
+    const TraceNode* x = _node(c->tracer, node->in[k]);
+    return _is_elementwise(node->op) && _same_shape(x->shape, node->shape) &&
+           _same_shape(node->in_shape[k], node->shape);
+}
+
+static int _root(const Compiler* c, int n) {
+    while(c->plan[n].inlined) n = c->plan[n].consumer;
+    return n;
+}
+
+// a node whose loop is emitted: computed by an op, neither inlined nor fused into another loop
+static bool _is_root(const Compiler* c, int n) {
+    const NodePlan* p = &c->plan[n];
+    return p->live && _node(c->tracer, n)->op >= 0 && !p->inlined && p->fused_into < 0;
+}
+
+// buffers read by the loop of root, with everything evaluated inside it
+static void _mark_reads(Compiler* c, int n, int root) {
+    const TraceNode* node = _node(c->tracer, n);
+    for(int k = 0; k < 2; k++) {
+        int x = node->in[k];
+        if(x < 0) continue;
+        if(c->plan[x].inlined || c->plan[x].fused_into == root) {
+            _mark_reads(c, x, root);
+        } else if(c->plan[x].last_use < root) {
+            c->plan[x].last_use = root;
+        }
+    }
+}
+
+static void _plan(Compiler* c) {
+    const Tracer* t = c->tracer;
+    int n = t->nodes.length;
+    for(int i = 0; i < n; i++) {
+        c->plan[i] = (NodePlan){false, 0, -1, false, -1, -1, -1, -1, -1};
+    }
+
+    // live set, from the output back
+    int* stack = malloc(sizeof(int) * n);
+    cten_assert(stack != NULL, "cten_compile(): out of memory");
+    int top = 0;
+    stack[top++] = c->out;
+    c->plan[c->out].live = true;
+    while(top > 0) {
+        int i = stack[--top];
+        const TraceNode* node = _node(t, i);
+        cten_assert(node->op != NODE_UNKNOWN,
+                    "cten_compile(): the output depends on a tensor computed inside the trace by "
+                    "an op that cannot be compiled; create constants before cten_begin_trace()");
+        for(int k = 0; k < 2; k++) {
+            int x = node->in[k];
+            if(x < 0) continue;
+            c->plan[x].uses++;
+            c->plan[x].consumer = i;
+            if(!c->plan[x].live) {
+                c->plan[x].live = true;
+                stack[top++] = x;
+            }
+        }
+    }
+    free(stack);
+
+    for(int i = 0; i < n; i++) {
+        NodePlan* p = &c->plan[i];
+        const TraceNode* node = _node(t, i);
+        if(!p->live) continue;
+        if(node->op == NODE_CONST) p->slot = c->n_weights++;
+        if(i == c->out || p->uses != 1 || node->op < 0) continue;
+        const TraceNode* consumer = _node(t, p->consumer);
+        int k = consumer->in[0] == i ? 0 : 1;
+        if(!_can_inline(c, p->consumer, k)) continue;
+        if(_is_elementwise(node->op)) p->inlined = true;
+    }
+    // after inlining, so the loop a matmul joins is the one that evaluates its consumer
+    for(int i = 0; i < n; i++) {
+        NodePlan* p = &c->plan[i];
+        const TraceNode* node = _node(t, i);
+        if(!p->live || i == c->out || p->uses != 1 || node->op != TRACE_MATMUL) continue;
+        const TraceNode* consumer = _node(t, p->consumer);
+        int k = consumer->in[0] == i ? 0 : 1;
+        if(!_can_inline(c, p->consumer, k)) continue;
+        int root = _root(c, p->consumer);
+        if(c->plan[root].matmul >= 0) continue;
+        p->fused_into = root;
+        c->plan[root].matmul = i;
+    }
+
+    // lifetimes, then first-fit offsets in emission order
+    for(int i = 0; i < n; i++) {
+        if(_is_root(c, i)) _mark_reads(c, i, i);
+    }
+    int* active = malloc(sizeof(int) * n);
+    cten_assert(active != NULL, "cten_compile(): out of memory");
+    int n_active = 0;
+    for(int i = 0; i < n; i++) {
+        if(!_is_root(c, i) || i == c->out) continue;
+        int kept = 0;
+        for(int j = 0; j < n_active; j++) {
+            if(c->plan[active[j]].last_use >= i) active[kept++] = active[j];
+        }
+        n_active = kept;
+        int size = (_numel(_node(t, i)->shape) + AOT_ALIGN - 1) / AOT_ALIGN * AOT_ALIGN;
+        int offset = 0;
+        for(bool moved = true; moved;) {
+            moved = false;
+            for(int j = 0; j < n_active; j++) {
+                int o = c->plan[active[j]].offset;
+                int end = o + (_numel(_node(t, active[j])->shape) + AOT_ALIGN - 1) / AOT_ALIGN *
+                                  AOT_ALIGN;
+                if(offset < end && o < offset + size) {
+                    offset = end;
+                    moved = true;
+                }
+            }
+        }
+        c->plan[i].offset = offset;
+        if(offset + size > c->arena_size) c->arena_size = offset + size;
+        active[n_active++] = i;
+    }
+    free(active);
+}
+
+static void _print_shape(FILE* f, const int* shape) {
+    fputc('(', f);
+    for(int i = 0; i < _rank(shape); i++) {
+        fprintf(f, "%s%d", i == 0 ? "" : ", ", shape[i]);
+    }
+    fputc(')', f);
+}
+
+static void _print_float(FILE* f, float x) {
+    if(isnan(x)) {
+        fputs("NAN", f);
+    } else if(isinf(x)) {
+        fputs(x > 0 ? "INFINITY" : "-INFINITY", f);
+    } else {
+        fprintf(f, "%af", (double)x);
+    }
+}
+
+// the variable holding node n's buffer in the generated function
+static void _print_var(const Compiler* c, int n) {
+    const TraceNode* node = _node(c->tracer, n);
+    const NodePlan* p = &c->plan[n];
+    if(p->fused_into >= 0) n = p->fused_into;
+    if(n == c->out) {
+        fputs("out", c->f);
+    } else if(node->op == NODE_INPUT) {
+        fprintf(c->f, "in%d", node->input);
+    } else if(node->op == NODE_CONST) {
+        fprintf(c->f, "w%d", p->slot);
+    } else {
+        fprintf(c->f, "t%d", n);
+    }
+}
+
+// element e of a root with the given shape, read from a buffer of shape x that broadcasts to it
+static void _print_load(const Compiler* c, int n, const int* x, const int* shape) {
+    _print_var(c, n);
+    if(_same_shape(x, shape)) {
+        fputs("[e]", c->f);
+        return;
+    }
+    fputc('[', c->f);
+    bool any = false;
+    int inner = 1, stride = 1;
+    for(int d = _rank(shape) - 1; d >= 0; d--) {
+        if(x[d] == shape[d] && shape[d] > 1) {
+            fputs(any ? " + " : "", c->f);
+            if(inner == 1) {
+                fputc('e', c->f);
+            } else {
+                fprintf(c->f, "e / %d", inner);
+            }
+            if(d > 0) fprintf(c->f, " %% %d", shape[d]);
+            if(stride != 1) fprintf(c->f, " * %d", stride);
+            any = true;
+        }
+        inner *= shape[d];
+        stride *= x[d];
+    }
+    fputs(any ? "]" : "0]", c->f);
+}
+
+static void _print_op(const Compiler* c, int n, const int* shape);
+
+static void _print_operand(const Compiler* c, int n, int k, const int* shape) {
+    const TraceNode* node = _node(c->tracer, n);
+    int x = node->in[k];
+    if(c->plan[x].inlined) {
+        _print_op(c, x, shape);
+    } else {
+        _print_load(c, x, node->in_shape[k], shape);
+    }
+}
+
+// the expression for element e of an elementwise node
+static void _print_op(const Compiler* c, int n, const int* shape) {
+    static const char* infix[] = {" + ", " - ", " * ", " / "};
+    const TraceNode* node = _node(c->tracer, n);
+    FILE* f = c->f;
+    switch(node->op) {
+        case TRACE_ADD:
+        case TRACE_SUB:
+        case TRACE_MUL:
+        case TRACE_DIV:
+            fputc('(', f);
+            _print_operand(c, n, 0, shape);
+            fputs(infix[node->op - TRACE_ADD], f);
+            _print_operand(c, n, 1, shape);
+            fputc(')', f);
+            break;
+        case TRACE_POW:
+            fputs("powf(", f);
+            _print_operand(c, n, 0, shape);
+            fputs(", ", f);
+            _print_operand(c, n, 1, shape);
+            fputc(')', f);
+            break;
+        case TRACE_ADDF:
+        case TRACE_SUBF:
+        case TRACE_MULF:
+            fputc('(', f);
+            _print_operand(c, n, 0, shape);
+            fputs(infix[node->op - TRACE_ADDF], f);
+            _print_float(f, node->scalar);
+            fputc(')', f);
+            break;
+        case TRACE_NEG:
+            fputs("(-", f);
+            _print_operand(c, n, 0, shape);
+            fputc(')', f);
+            break;
+        case TRACE_ABS:
+            fputs("fabsf(", f);
+            _print_operand(c, n, 0, shape);
+            fputc(')', f);
+            break;
+        case TRACE_RELU:
+            fprintf(f, "%s_relu(", c->name);
+            _print_operand(c, n, 0, shape);
+            fputc(')', f);
+            break;
+    }
+}
+
+// the ops a root's loop computes, operands first
+static void _print_op_names(const Compiler* c, int n, int root, bool* first) {
+    const TraceNode* node = _node(c->tracer, n);
+    for(int k = 0; k < 2; k++) {
+        int x = node->in[k];
+        if(x >= 0 && (c->plan[x].inlined || c->plan[x].fused_into == root)) {
+            _print_op_names(c, x, root, first);
+        }
+    }
+    fprintf(c->f, "%s%s", *first ? "" : " -> ", g_op_names[node->op]);
+    *first = false;
+}
+
+// rows [r0, r1) of matmul m in blocks of `block`, then the rest of root's expression on them
+static void _emit_matmul_rows(const Compiler* c, int m, int root, int r0, int r1, int block) {
+    const TraceNode* node = _node(c->tracer, m);
+    const int* a_shape = node->in_shape[0];
+    const int* b_shape = node->in_shape[1];
+    int k = a_shape[_rank(a_shape) - 1], n = b_shape[_rank(b_shape) - 1];
+    FILE* f = c->f;
+    fprintf(f, "    for(int r = %d; r < %d; r += %d) {\n", r0, r1, block);
+    fputs("        const float* restrict a = ", f);
+    _print_var(c, node->in[0]);
+    fprintf(f, " + r * %d;\n", k);
+    fputs("        const float* restrict b = ", f);
+    _print_var(c, node->in[1]);
+    if(_numel(b_shape) != k * n) {
+        fprintf(f, " + r / %d * %d", a_shape[_rank(a_shape) - 2], k * n);
+    }
+    fputs(";\n        float* y = ", f);
+    _print_var(c, root);
+    fprintf(f, " + r * %d;\n", n);
+    fprintf(f, "        for(int i = 0; i < %d; i++) {\n", block * n);
+    fputs("            y[i] = 0.0f;\n", f);
+    fputs("        }\n", f);
+    fprintf(f, "        for(int p = 0; p < %d; p++) {\n", k);
+    fprintf(f, "            const float* bp = b + p * %d;\n", n);
+    fprintf(f, "            for(int i = 0; i < %d; i++) {\n", block);
+    fprintf(f, "                const float ap = a[i * %d + p];\n", k);
+    fprintf(f, "                float* restrict yi = y + i * %d;\n", n);
+    fprintf(f, "                for(int j = 0; j < %d; j++) {\n", n);
+    fputs("                    yi[j] += ap * bp[j];\n", f);
+    fputs("                }\n", f);
+    fputs("            }\n", f);
+    fputs("        }\n", f);
+    if(root != m) {
+        fprintf(f, "        for(int e = r * %d; e < r * %d + %d; e++) {\n", n, n, block * n);
+        fputs("            ", f);
+        _print_var(c, root);
+        fputs("[e] = ", f);
+        _print_op(c, root, _node(c->tracer, root)->shape);
+        fputs(";\n        }\n", f);
+    }
+    fputs("    }\n", f);
+}
+
+static void _emit_matmul(const Compiler* c, int m, int root) {
+    const TraceNode* node = _node(c->tracer, m);
+    const int* a_shape = node->in_shape[0];
+    const int* b_shape = node->in_shape[1];
+    int rank = _rank(a_shape);
+    int k = a_shape[rank - 1], n = b_shape[_rank(b_shape) - 1];
+    int rows = _numel(a_shape) / k;
+    // a block must not straddle two batches of a batched right operand
+    bool batched = _numel(b_shape) != k * n;
+    int block = batched && a_shape[rank - 2] % AOT_ROW_BLOCK != 0 ? 1 : AOT_ROW_BLOCK;
+    int main_rows = rows / block * block;
+    if(main_rows > 0) _emit_matmul_rows(c, m, root, 0, main_rows, block);
+    if(main_rows < rows) _emit_matmul_rows(c, m, root, main_rows, rows, rows - main_rows);
+}
+
+static void _emit_softmax(const Compiler* c, int n) {
+    const TraceNode* node = _node(c->tracer, n);
+    int d = node->shape[_rank(node->shape) - 1];
+    FILE* f = c->f;
+    fprintf(f, "    for(int r = 0; r < %d; r++) {\n", _numel(node->shape) / d);
+    fputs("        const float* x = ", f);
+    _print_var(c, node->in[0]);
+    fprintf(f, " + r * %d;\n", d);
+    fputs("        float* y = ", f);
+    _print_var(c, n);
+    fprintf(f, " + r * %d;\n", d);
+    fputs("        float max_val = -INFINITY;\n", f);
+    fputs("        float sum = 0;\n", f);
+    fprintf(f, "        for(int d = 0; d < %d; d++) {\n", d);
+    fputs("            max_val = fmaxf(max_val, x[d]);\n", f);
+    fputs("        }\n", f);
+    fprintf(f, "        for(int d = 0; d < %d; d++) {\n", d);
+    fputs("            y[d] = expf(x[d] - max_val);\n", f);
+    fputs("            sum += y[d];\n", f);
+    fputs("        }\n", f);
+    fprintf(f, "        for(int d = 0; d < %d; d++) {\n", d);
+    fputs("            y[d] /= sum;\n", f);
+    fputs("        }\n", f);
+    fputs("    }\n", f);
+}
+
+static void _emit_root(const Compiler* c, int n) {
+    const TraceNode* node = _node(c->tracer, n);
+    const NodePlan* p = &c->plan[n];
+    FILE* f = c->f;
+    bool first = true;
+    fputs("\n    // ", f);
+    _print_op_names(c, n, n, &first);
+    fputc(' ', f);
+    _print_shape(f, node->shape);
+    fputc('\n', f);
+    if(node->op == TRACE_MATMUL) {
+        _emit_matmul(c, n, n);
+    } else if(node->op == TRACE_SOFTMAX) {
+        _emit_softmax(c, n);
+    } else if(p->matmul >= 0) {
+        _emit_matmul(c, p->matmul, n);
+    } else {
+        fprintf(f, "    for(int e = 0; e < %d; e++) {\n        ", _numel(node->shape));
+        _print_var(c, n);
+        fputs("[e] = ", f);
+        _print_op(c, n, node->shape);
+        fputs(";\n    }\n", f);
+    }
+}
+
+static int _weights_offset(const Compiler* c, int slot) {
+    int offset = 0;
+    for(int i = 0; i < c->tracer->nodes.length; i++) {
+        const NodePlan* p = &c->plan[i];
+        if(p->slot < 0 || p->slot >= slot) continue;
+        offset += (_node(c->tracer, i)->data->numel + AOT_ALIGN - 1) / AOT_ALIGN * AOT_ALIGN;
+    }
+    return offset;
+}
+
+static bool _write_weights(const Compiler* c, const char* path) {
+    FILE* f = fopen(path, "wb");
+    if(f == NULL) return false;
+    static const float zeros[AOT_ALIGN];
+    bool ok = true;
+    for(int i = 0; i < c->tracer->nodes.length; i++) {
+        if(c->plan[i].slot < 0) continue;
+        const FloatBuffer* data = _node(c->tracer, i)->data;
+        int pad = (AOT_ALIGN - data->numel % AOT_ALIGN) % AOT_ALIGN;
+        ok = ok && fwrite(data->flex, sizeof(float), data->numel, f) == (size_t)data->numel;
+        ok = ok && fwrite(zeros, sizeof(float), pad, f) == (size_t)pad;
+    }
+    return fclose(f) == 0 && ok;
+}
+
+static void _emit(const Compiler* c, const char* weights_path) {
+    const Tracer* t = c->tracer;
+    FILE* f = c->f;
+    int n = t->nodes.length;
+    int* inputs = malloc(sizeof(int) * (t->n_inputs + 1));
+    cten_assert(inputs != NULL, "cten_compile(): out of memory");
+    for(int i = 0; i < n; i++) {
+        if(_node(t, i)->op == NODE_INPUT) inputs[_node(t, i)->input] = i;
+    }
+
+    fputs("/* Generated by cten_compile(); do not edit.\n *\n *     void ", f);
+    fprintf(f, "%s(%s", c->name, weights_path != NULL ? "const float* weights, " : "");
+    for(int i = 0; i < t->n_inputs; i++) {
+        fprintf(f, "const float* in%d, ", i);
+    }
+    fputs("float* out);\n *\n", f);
+    for(int i = 0; i < t->n_inputs; i++) {
+        fprintf(f, " * in%d: ", i);
+        _print_shape(f, _node(t, inputs[i])->shape);
+        fputc('\n', f);
+    }
+    fputs(" * out: ", f);
+    _print_shape(f, _node(t, c->out)->shape);
+    fputc('\n', f);
+    if(weights_path != NULL) {
+        fprintf(f,
+                " * weights: %d tensors, %zu bytes of native-endian floats written to %s; map the\n"
+                " * file and pass its start.\n",
+                c->n_weights,
+                sizeof(float) * _weights_offset(c, c->n_weights),
+                weights_path);
+    }
+    fputs(" * Shapes are fixed at the traced ones. Intermediates live in a per-thread arena, so\n"
+          " * calls on different threads may overlap; out must not overlap the inputs. */\n\n",
+          f);
+    fputs("#include <math.h>\n\n", f);
+    fprintf(f, "static inline float %s_relu(float x) { return x > 0 ? x : 0.0f; }\n", c->name);
+
+    if(weights_path == NULL) {
+        for(int i = 0; i < n; i++) {
+            if(c->plan[i].slot < 0) continue;
+            const FloatBuffer* data = _node(t, i)->data;
+            fprintf(f,
+                    "\nstatic _Alignas(64) const float %s_w%d[%d] = {",
+                    c->name,
+                    c->plan[i].slot,
+                    data->numel);
+            for(int j = 0; j < data->numel; j++) {
+                fputs(j % 6 == 0 ? "\n    " : " ", f);
+                _print_float(f, data->flex[j]);
+                fputc(',', f);
+            }
+            fputs("\n};\n", f);
+        }
+    }
+    if(c->arena_size > 0) {
+        fprintf(f,
+                "\nstatic _Thread_local _Alignas(64) float %s_arena[%d];\n",
+                c->name,
+                c->arena_size);
+    }
+
+    fprintf(f, "\nvoid %s(%s", c->name, weights_path != NULL ? "const float* weights, " : "");
+    for(int i = 0; i < t->n_inputs; i++) {
+        fprintf(f, "const float* in%d, ", i);
+    }
+    fputs("float* out) {\n", f);
+    for(int i = 0; i < n; i++) {
+        const NodePlan* p = &c->plan[i];
+        if(p->slot >= 0 && weights_path != NULL) {
+            int offset = _weights_offset(c, p->slot);
+            fprintf(f, "    const float* w%d = weights + %d;\n", p->slot, offset);
+        } else if(p->slot >= 0) {
+            fprintf(f, "    const float* w%d = %s_w%d;\n", p->slot, c->name, p->slot);
+        } else if(p->offset >= 0) {
+            fprintf(f, "    float* t%d = %s_arena + %d;\n", i, c->name, p->offset);
+        }
+    }
+    if(weights_path != NULL && c->n_weights == 0) fputs("    (void)weights;\n", f);
+    for(int i = 0; i < n; i++) {
+        if(_is_root(c, i)) _emit_root(c, i);
+    }
+    fputs("}\n", f);
+    free(inputs);
+}
+
+bool cten_compile(Tensor output, const char* name, const char* path, const char* weights_path) {
+    Tracer* self = _tracer();
+    cten_assert(self != NULL, "cten_compile(): not tracing");
+    cten_assert(_is_identifier(name), "cten_compile(): `%s` is not a C identifier", name);
+    int out = _find(self, output.data);
+    cten_assert(out >= 0 && _node(self, out)->op != NODE_INPUT &&
+                    _node(self, out)->op != NODE_CONST,
+                "cten_compile(): the output was not computed inside the trace");
+
+    Compiler c = {self, malloc(sizeof(NodePlan) * self->nodes.length), out, 0, 0, name, NULL};
+    cten_assert(c.plan != NULL, "cten_compile(): out of memory");
+    _plan(&c);
+    bool ok = weights_path == NULL || _write_weights(&c, weights_path);
+    if(ok) {
+        c.f = fopen(path, "w");
+        ok = c.f != NULL;
+    }
+    if(ok) {
+        _emit(&c, weights_path);
+        ok = !ferror(c.f);
+        ok = fclose(c.f) == 0 && ok;
+    }
+    free(c.plan);
+    return ok;
+}
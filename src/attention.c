@@ -0,0 +1,244 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Flash-attention style: queries are processed in blocks of ATTN_BLOCK_Q rows against key/value
+ * blocks of ATTN_BLOCK_K rows, keeping a running max and normalizer per query row (online
+ * softmax). Only a BLOCK_Q x BLOCK_K score tile exists at any time, and the backward recomputes
+ * the tiles from the saved per-row logsumexp instead of storing the (Sq, Sk) probabilities. */
+
+#define ATTN_BLOCK_Q 64
+#define ATTN_BLOCK_K 64
+
+typedef struct AttentionCtx {
+    int bh, sq, sk, d, dv;
+    float scale;
+    const float *q, *k, *v, *mask;
+    float* out;
+    float* lse;  // logsumexp of every score row, +INFINITY for fully masked rows
+    // backward only
+    const float* dout;
+    float *dq, *dk, *dv_;
+    Tensor grads[3];
+} AttentionCtx;
+
+static int _min(int a, int b) { return a < b ? a : b; }
+
+static void* _workspace(size_t numel) {
+    float* p = malloc(sizeof(float) * numel);
+    cten_assert(p != NULL, "nn_attention(): out of memory");
+    return p;
+}
+
+// s[bq x bk] = q_blk @ k_blk^T * scale + mask_blk
+static void _scores(const AttentionCtx* c,
+                    const float* q,
+                    const float* k,
+                    int q0,
+                    int k0,
+                    int bq,
+                    int bk,
+                    float* s) {
+    _cten_gemm(bq, bk, c->d, q + q0 * c->d, c->d, 1, k + k0 * c->d, 1, c->d, s, bk, false);
+    for(int r = 0; r < bq; r++) {
+        float* row = s + r * bk;
+        const float* m = c->mask != NULL ? c->mask + (q0 + r) * c->sk + k0 : NULL;
+        for(int j = 0; j < bk; j++) {
+            row[j] = row[j] * c->scale + (m != NULL ? m[j] : 0);
+        }
+    }
+}
+
+static void _attention_forward_task(void* ctx, int task) {
+    const AttentionCtx* c = ctx;
+    int n_qblocks = (c->sq + ATTN_BLOCK_Q - 1) / ATTN_BLOCK_Q;
+    int bh = task / n_qblocks;
+    int q0 = task % n_qblocks * ATTN_BLOCK_Q;
+    int bq = _min(ATTN_BLOCK_Q, c->sq - q0);
+    const float* q = c->q + (size_t)bh * c->sq * c->d;
+    const float* k = c->k + (size_t)bh * c->sk * c->d;
+    const float* v = c->v + (size_t)bh * c->sk * c->dv;
+    float* out = c->out + ((size_t)bh * c->sq + q0) * c->dv;
+
+    float* s = _workspace(ATTN_BLOCK_Q * ATTN_BLOCK_K);
+    float row_max[ATTN_BLOCK_Q], row_sum[ATTN_BLOCK_Q];
+    for(int r = 0; r < bq; r++) {
+        row_max[r] = -INFINITY;
+        row_sum[r] = 0;
+    }
+    memset(out, 0, sizeof(float) * bq * c->dv);
+
+    for(int k0 = 0; k0 < c->sk; k0 += ATTN_BLOCK_K) {
+        int bk = _min(ATTN_BLOCK_K, c->sk - k0);
+        _scores(c, q, k, q0, k0, bq, bk, s);
+        for(int r = 0; r < bq; r++) {
+            float* row = s + r * bk;
+            float m = row_max[r];
+            for(int j = 0; j < bk; j++) {
+                m = row[j] > m ? row[j] : m;
+            }
+            if(m == -INFINITY) {
+                // everything so far is masked out
+                memset(row, 0, sizeof(float) * bk);
+                continue;
+            }
+            float alpha = expf(row_max[r] - m);
+            float sum = 0;
+            for(int j = 0; j < bk; j++) {
+                row[j] = expf(row[j] - m);
+                sum += row[j];
+            }
+            row_max[r] = m;
+            row_sum[r] = row_sum[r] * alpha + sum;
+            if(alpha != 1.0f) {
+                for(int j = 0; j < c->dv; j++) {
+                    out[r * c->dv + j] *= alpha;
+                }
+            }
+        }
+        // out += p @ v_blk
+        _cten_gemm(bq, c->dv, bk, s, bk, 1, v + k0 * c->dv, c->dv, 1, out, c->dv, true);
+    }
+
+    for(int r = 0; r < bq; r++) {
+        float inv = row_sum[r] > 0 ? 1.0f / row_sum[r] : 0;
+        for(int j = 0; j < c->dv; j++) {
+            out[r * c->dv + j] *= inv;
+        }
+        if(c->lse != NULL) {
+            c->lse[bh * c->sq + q0 + r] =
+                row_sum[r] > 0 ? row_max[r] + logf(row_sum[r]) : INFINITY;
+        }
+    }
+    free(s);
+}
+
+// one task per batch/head, so the dk and dv accumulations never race
+static void _attention_backward_task(void* ctx, int bh) {
+    const AttentionCtx* c = ctx;
+    size_t q_off = (size_t)bh * c->sq, k_off = (size_t)bh * c->sk;
+    const float* q = c->q + q_off * c->d;
+    const float* k = c->k + k_off * c->d;
+    const float* v = c->v + k_off * c->dv;
+    const float* out = c->out + q_off * c->dv;
+    const float* dout = c->dout + q_off * c->dv;
+    const float* lse = c->lse + q_off;
+    float* dq = c->dq + q_off * c->d;
+    float* dk = c->dk + k_off * c->d;
+    float* dv = c->dv_ + k_off * c->dv;
+
+    float* p = _workspace(ATTN_BLOCK_Q * ATTN_BLOCK_K);
+    float* dp = _workspace(ATTN_BLOCK_Q * ATTN_BLOCK_K);
+    float* delta = _workspace(c->sq);
+    // delta = rowsum(dout * out), the softmax backward term shared by every key block
+    for(int r = 0; r < c->sq; r++) {
+        delta[r] = _cten_kernels.dot(c->dv, dout + r * c->dv, out + r * c->dv);
+    }
+
+    for(int q0 = 0; q0 < c->sq; q0 += ATTN_BLOCK_Q) {
+        int bq = _min(ATTN_BLOCK_Q, c->sq - q0);
+        for(int k0 = 0; k0 < c->sk; k0 += ATTN_BLOCK_K) {
+            int bk = _min(ATTN_BLOCK_K, c->sk - k0);
+            _scores(c, q, k, q0, k0, bq, bk, p);
+            for(int r = 0; r < bq; r++) {
+                for(int j = 0; j < bk; j++) {
+                    p[r * bk + j] = expf(p[r * bk + j] - lse[q0 + r]);
+                }
+            }
+            // dv_blk += p^T @ dout_blk
+            const float* dout_blk = dout + q0 * c->dv;
+            _cten_gemm(bk, c->dv, bq, p, 1, bk, dout_blk, c->dv, 1, dv + k0 * c->dv, c->dv, true);
+            // dp = dout_blk @ v_blk^T; ds = p * (dp - delta) * scale, stored in dp
+            _cten_gemm(bq, bk, c->dv, dout_blk, c->dv, 1, v + k0 * c->dv, 1, c->dv, dp, bk, false);
+            for(int r = 0; r < bq; r++) {
+                for(int j = 0; j < bk; j++) {
+                    int idx = r * bk + j;
+                    dp[idx] = p[idx] * (dp[idx] - delta[q0 + r]) * c->scale;
+                }
+            }
+            // dq_blk += ds @ k_blk; dk_blk += ds^T @ q_blk
+            _cten_gemm(bq, c->d, bk, dp, bk, 1, k + k0 * c->d, c->d, 1, dq + q0 * c->d, c->d, true);
+            _cten_gemm(bk, c->d, bq, dp, 1, bk, q + q0 * c->d, c->d, 1, dk + k0 * c->d, c->d, true);
+        }
+    }
+    free(delta);
+    free(dp);
+    free(p);
+}
+
+static Tensor GradFn_attention(Tensor self, int i) {
+    AttentionCtx* c = self.node->ctx;
+    if(c->grads[0].data == NULL) {
+        // all three gradients come out of the same recomputation; keep them for the other inputs
+        for(int j = 0; j < 3; j++) {
+            c->grads[j] = Tensor_zeros(self.node->inputs[j].shape, false);
+        }
+        c->out = self.data->flex;
+        c->dout = self.node->grad.data->flex;
+        c->dq = c->grads[0].data->flex;
+        c->dk = c->grads[1].data->flex;
+        c->dv_ = c->grads[2].data->flex;
+        _cten_parallel_for(c->bh, _attention_backward_task, c);
+    }
+    return c->grads[i];
+}
+
+Tensor nn_attention(Tensor q, Tensor k, Tensor v, Tensor mask) {
+    CTEN_PROFILE_BEGIN();
+    int dim = TensorShape_dim(q.shape);
+    cten_assert(dim == 3 || dim == 4, "nn_attention(): q must be (B, Sq, D) or (B, H, Sq, D)");
+    cten_assert_dim("nn_attention() k dim", TensorShape_dim(k.shape), dim);
+    cten_assert_dim("nn_attention() v dim", TensorShape_dim(v.shape), dim);
+    for(int i = 0; i < dim - 2; i++) {
+        cten_assert_dim("nn_attention() k batch dims", k.shape[i], q.shape[i]);
+        cten_assert_dim("nn_attention() v batch dims", v.shape[i], q.shape[i]);
+    }
+    cten_assert_dim("nn_attention() k head dim", k.shape[dim - 1], q.shape[dim - 1]);
+    cten_assert_dim("nn_attention() v seq len", v.shape[dim - 2], k.shape[dim - 2]);
+
+    bool requires_grad = !cten_is_eval() && (q.node != NULL || k.node != NULL || v.node != NULL);
+    AttentionCtx local;
+    AttentionCtx* c = requires_grad ? _cten_malloc(sizeof(AttentionCtx)) : &local;
+    memset(c, 0, sizeof(AttentionCtx));
+    c->sq = q.shape[dim - 2];
+    c->sk = k.shape[dim - 2];
+    c->d = q.shape[dim - 1];
+    c->dv = v.shape[dim - 1];
+    c->bh = q.data->numel / (c->sq * c->d);
+    c->scale = 1.0f / sqrtf(c->d);
+    if(mask.data != NULL) {
+        cten_assert_dim("nn_attention() mask numel", mask.data->numel, c->sq * c->sk);
+        c->mask = mask.data->flex;
+    }
+
+    TensorShape out_shape;
+    memcpy(out_shape, q.shape, sizeof(TensorShape));
+    out_shape[dim - 1] = c->dv;
+    Tensor res = Tensor_new(out_shape, requires_grad);
+    c->q = q.data->flex;
+    c->k = k.data->flex;
+    c->v = v.data->flex;
+    c->out = res.data->flex;
+    if(requires_grad) c->lse = _cten_malloc(sizeof(float) * c->bh * c->sq);
+
+    int n_qblocks = (c->sq + ATTN_BLOCK_Q - 1) / ATTN_BLOCK_Q;
+    _cten_parallel_for(c->bh * n_qblocks, _attention_forward_task, c);
+
+    if(requires_grad) {
+        res.node->grad_fn = GradFn_attention;
+        res.node->name = "nn_attention";
+        res.node->ctx = c;
+        res.node->inputs[0] = q;
+        res.node->inputs[1] = k;
+        res.node->inputs[2] = v;
+        res.node->n_inputs = 3;
+    }
+    CTEN_PROFILE_END(res.shape,
+                     2.0 * c->bh * c->sq * c->sk * (c->d + c->dv),
+                     sizeof(float) *
+                         (q.data->numel + k.data->numel + v.data->numel + res.data->numel));
+    return res;
+}
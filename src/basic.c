@@ -1,6 +1,7 @@
 #include "cten.h"
 #include "cten_internal.h"
 
+#include "common/vector.h"
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,6 +39,7 @@ Tensor Tensor_new(TensorShape shape, bool requires_grad) {
     memcpy(self.shape, shape, sizeof(TensorShape));
     int numel = TensorShape_numel(shape);
     self.data = _cten_malloc(sizeof(FloatBuffer) + sizeof(float) * numel);
+    self.data->version = 0;
     self.data->numel = numel;
     if(requires_grad) {
         self.node = _cten_malloc(sizeof(GradNode));
@@ -45,6 +47,7 @@ Tensor Tensor_new(TensorShape shape, bool requires_grad) {
     } else {
         self.node = NULL;
     }
+    _cten_trace_alloc(self);
     return self;
 }
 
@@ -78,30 +81,304 @@ void Tensor_set(Tensor self, int i, int j, int k, int l, float value) {
     assert((self.shape[3] == 0 && l == 0) || (l >= 0 && l < self.shape[3]));
     self.data->flex[i * self.shape[1] * self.shape[2] * self.shape[3] +
                     j * self.shape[2] * self.shape[3] + k * self.shape[3] + l] = value;
+    self.data->version++;
 }
 
+void Tensor_bump_version(Tensor self) { self.data->version++; }
+
 Tensor Tensor_detach(Tensor self) {
     Tensor detached = self;
     detached.node = NULL;
     return detached;
 }
 
+static void _scatter_add_rows_into(float* dense, Tensor rows, const int* grad_rows) {
+    int n_rows = rows.shape[0], dim = rows.shape[1];
+    for(int r = 0; r < n_rows; r++) {
+        float* dst = dense + grad_rows[r] * dim;
+        _cten_kernels.add(dim, dst, rows.data->flex + r * dim, dst);
+    }
+}
+
+// dense[grad_rows[r]] += rows[r] on a copy, since dense may be shared with other nodes
+static Tensor _scatter_add_rows(Tensor dense, Tensor rows, const int* grad_rows) {
+    Tensor res = Tensor_new(dense.shape, false);
+    memcpy(res.data->flex, dense.data->flex, sizeof(float) * dense.data->numel);
+    _scatter_add_rows_into(res.data->flex, rows, grad_rows);
+    return res;
+}
+
+FloatBuffer* _cten_grad_buffer(Tensor self) {
+    GradNode* node = self.node;
+    if(node->grad_buffer == NULL) {
+        cten_begin_malloc(_cten_pool_of(node));
+        node->grad_buffer = _cten_malloc(sizeof(FloatBuffer) + sizeof(float) * self.data->numel);
+        node->grad_buffer->version = 0;
+        node->grad_buffer->numel = self.data->numel;
+        cten_end_malloc();
+    }
+    return node->grad_buffer;
+}
+
+/* Leaves (parameters) accumulate into their own buffer, so a gradient outlives the pool backward
+ * ran in and later micro-batches add to it in place. Other nodes, and leaves whose gradient is
+ * consumed within backward, adopt the first upstream tensor and allocate only once a second
+ * contribution arrives, adding in place from then on. */
+static void _accumulate_grad(Tensor self, Tensor grad) {
+    GradNode* node = self.node;
+    int numel = grad.data->numel;
+    Tensor cur = node->grad;
+    if(node->n_inputs == 0 && !node->transient_grad) {
+        FloatBuffer* buf = _cten_grad_buffer(self);
+        if(cur.data == NULL) {
+            memcpy(buf->flex, grad.data->flex, sizeof(float) * numel);
+        } else if(node->grad_rows != NULL) {
+            memcpy(buf->flex, grad.data->flex, sizeof(float) * numel);
+            _scatter_add_rows_into(buf->flex, cur, node->grad_rows);
+            node->grad_rows = NULL;
+        } else {
+            _cten_kernels.add(numel, cur.data->flex, grad.data->flex, buf->flex);
+        }
+        node->grad = (Tensor){.data = buf};
+        memcpy(node->grad.shape, grad.shape, sizeof(TensorShape));
+        return;
+    }
+    if(cur.data == NULL) {
+        node->grad = grad;
+    } else if(node->grad_rows != NULL) {
+        node->grad = _scatter_add_rows(grad, cur, node->grad_rows);
+        node->grad_rows = NULL;
+        node->grad_buffer = node->grad.data;
+    } else if(cur.data == node->grad_buffer) {
+        _cten_kernels.add(numel, cur.data->flex, grad.data->flex, cur.data->flex);
+    } else {
+        node->grad = Tensor_new(cur.shape, false);
+        _cten_kernels.add(numel, cur.data->flex, grad.data->flex, node->grad.data->flex);
+        node->grad_buffer = node->grad.data;
+    }
+}
+
+// a leaf's row buffer with room for n rows, allocated in the leaf's pool and regrown only past its
+// high-water mark, so steps touching a similar number of rows allocate nothing
+static FloatBuffer* _grad_row_buffer(Tensor self, int n) {
+    GradNode* node = self.node;
+    if(node->row_buffer == NULL || node->row_capacity < n) {
+        int capacity = node->row_capacity * 2 > n ? node->row_capacity * 2 : n;
+        if(capacity > self.shape[0]) capacity = self.shape[0];
+        cten_begin_malloc(_cten_pool_of(node));
+        node->row_buffer = _cten_malloc(sizeof(FloatBuffer) +
+                                        (sizeof(float) * self.shape[1] + sizeof(int)) * capacity);
+        node->row_buffer->version = 0;
+        cten_end_malloc();
+        node->row_capacity = capacity;
+    }
+    return node->row_buffer;
+}
+
+typedef struct {
+    int index;
+    int row;
+} RowRef;
+
+static int RowRef__cmp(const void* a, const void* b) {
+    const RowRef* x = a;
+    const RowRef* y = b;
+    if(x->index != y->index) return x->index < y->index ? -1 : 1;
+    return x->row - y->row;
+}
+
+void _cten_accumulate_sparse_grad(Tensor self, Tensor rows, const int* indices) {
+    GradNode* node = self.node;
+    int dim = self.shape[1];
+    if(node->grad.data != NULL && node->grad_rows == NULL) {
+        if(node->grad.data == node->grad_buffer) {
+            _scatter_add_rows_into(node->grad.data->flex, rows, indices);
+        } else {
+            node->grad = _scatter_add_rows(node->grad, rows, indices);
+        }
+        return;
+    }
+
+    // merge with the rows accumulated so far and sum duplicate indices, so the optimizer sees
+    // every row at most once
+    int n_old = node->grad.data != NULL ? node->grad.shape[0] : 0;
+    int n = n_old + rows.shape[0];
+    const float* old_data = n_old > 0 ? node->grad.data->flex : NULL;
+    RowRef* refs = malloc(sizeof(RowRef) * n);
+    cten_assert(refs != NULL, "_cten_accumulate_sparse_grad(): out of memory");
+    for(int r = 0; r < n; r++) {
+        refs[r].index = r < n_old ? node->grad_rows[r] : indices[r - n_old];
+        refs[r].row = r;
+    }
+    qsort(refs, n, sizeof(RowRef), RowRef__cmp);
+    int n_unique = 0;
+    for(int r = 0; r < n; r++) {
+        if(r == 0 || refs[r].index != refs[r - 1].index) n_unique++;
+    }
+
+    // a leaf's gradient outlives the pool backward ran in, so it goes to the leaf's row buffer;
+    // rows already held there are merged through scratch memory first
+    bool persistent = node->n_inputs == 0 && !node->transient_grad;
+    FloatBuffer* res = NULL;
+    float* scratch = NULL;
+    float* data;
+    int* grad_rows;
+    if(persistent && n_old > 0) {
+        scratch = malloc((sizeof(float) * dim + sizeof(int)) * n_unique);
+        cten_assert(scratch != NULL, "_cten_accumulate_sparse_grad(): out of memory");
+        data = scratch;
+        grad_rows = (int*)(scratch + n_unique * dim);
+    } else if(persistent) {
+        res = _grad_row_buffer(self, n_unique);
+        data = res->flex;
+        grad_rows = (int*)(res->flex + node->row_capacity * dim);
+    } else {
+        res = Tensor_new((TensorShape){n_unique, dim}, false).data;
+        data = res->flex;
+        grad_rows = _cten_malloc(sizeof(int) * n_unique);
+    }
+    memset(data, 0, sizeof(float) * n_unique * dim);
+    int u = -1;
+    for(int r = 0; r < n; r++) {
+        if(r == 0 || refs[r].index != refs[r - 1].index) grad_rows[++u] = refs[r].index;
+        int row = refs[r].row;
+        const float* src =
+            row < n_old ? old_data + row * dim : rows.data->flex + (row - n_old) * dim;
+        float* dst = data + u * dim;
+        _cten_kernels.add(dim, dst, src, dst);
+    }
+    free(refs);
+    if(scratch != NULL) {
+        res = _grad_row_buffer(self, n_unique);
+        int* dst_rows = (int*)(res->flex + node->row_capacity * dim);
+        memcpy(res->flex, scratch, sizeof(float) * n_unique * dim);
+        memcpy(dst_rows, grad_rows, sizeof(int) * n_unique);
+        grad_rows = dst_rows;
+        free(scratch);
+    }
+    res->numel = n_unique * dim;
+    node->grad = (Tensor){.shape = {n_unique, dim}, .data = res};
+    node->grad_rows = grad_rows;
+}
+
+float* _cten_grad_dense(Tensor self) {
+    GradNode* node = self.node;
+    Tensor cur = node->grad;
+    int numel = self.data->numel;
+    if(node->n_inputs == 0 && !node->transient_grad) {
+        FloatBuffer* buf = _cten_grad_buffer(self);
+        if(cur.data == NULL || node->grad_rows != NULL) {
+            memset(buf->flex, 0, sizeof(float) * numel);
+            if(cur.data != NULL) _scatter_add_rows_into(buf->flex, cur, node->grad_rows);
+            node->grad_rows = NULL;
+        }
+        node->grad = (Tensor){.data = buf};
+        memcpy(node->grad.shape, self.shape, sizeof(TensorShape));
+        return buf->flex;
+    }
+    if(cur.data == NULL) {
+        node->grad = Tensor_zeros(self.shape, false);
+        node->grad_buffer = node->grad.data;
+    } else if(node->grad_rows != NULL) {
+        node->grad = _scatter_add_rows(Tensor_zeros(self.shape, false), cur, node->grad_rows);
+        node->grad_rows = NULL;
+        node->grad_buffer = node->grad.data;
+    } else if(cur.data != node->grad_buffer) {
+        node->grad = Tensor_new(cur.shape, false);
+        memcpy(node->grad.data->flex, cur.data->flex, sizeof(float) * numel);
+        node->grad_buffer = node->grad.data;
+    }
+    return node->grad.data->flex;
+}
+
+void Tensor_register_grad_hook(Tensor self, cten_grad_hook fn, void* ctx) {
+    cten_assert(self.node != NULL, "Tensor_register_grad_hook(): tensor does not require grad");
+    GradHook hook = {self.node, fn, ctx};
+    c11_vector__push(GradHook, &cten_context_get()->grad_hooks, hook);
+}
+
+void Tensor_remove_grad_hook(Tensor self, cten_grad_hook fn, void* ctx) {
+    c11_vector* hooks = &cten_context_get()->grad_hooks;
+    for(int i = hooks->length - 1; i >= 0; i--) {
+        GradHook* h = c11__at(GradHook, hooks, i);
+        if(h->node == self.node && h->fn == fn && h->ctx == ctx) {
+            c11_vector__erase(GradHook, hooks, i);
+        }
+    }
+}
+
+// whether any hook of this context was registered for `leaf`
+static bool _run_grad_hooks(const c11_vector* hooks, Tensor leaf) {
+    bool found = false;
+    c11__foreach(GradHook, hooks, h) {
+        if(h->node != leaf.node) continue;
+        h->fn(leaf, h->ctx);
+        found = true;
+    }
+    return found;
+}
+
 void Tensor_backward(Tensor self, Tensor grad) {
     if(self.node == NULL) return;
     if(grad.data == NULL) {
         assert(self.data->numel == 1);
-        grad = Tensor_ones((TensorShape){0}, false);
+        grad = Tensor_ones(self.shape, false);
     }
     assert(grad.node == NULL);
-    if(self.node->grad.data == NULL) {
-        self.node->grad = grad;
-    } else {
-        self.node->grad = Tensor_add(self.node->grad, grad);
+    cten_assert_dim("Tensor_backward() grad numel", grad.data->numel, self.data->numel);
+
+    // count the consumers of every node reachable from `self`
+    c11_vector stack;
+    c11_vector__ctor(&stack, sizeof(Tensor));
+    c11_vector__push(Tensor, &stack, self);
+    while(stack.length > 0) {
+        Tensor t = c11_vector__back(Tensor, &stack);
+        c11_vector__pop(&stack);
+        for(int i = 0; i < t.node->n_inputs; i++) {
+            GradNode* input = t.node->inputs[i].node;
+            if(input == NULL) continue;
+            if(input->n_pending++ == 0) c11_vector__push(Tensor, &stack, t.node->inputs[i]);
+        }
     }
-    for(int i = 0; i < self.node->n_inputs; i++) {
-        grad = Tensor_mul(grad, self.node->grad_fn(self, i));
-        Tensor_backward(self.node->inputs[i], grad);
+
+    // visit nodes once all their consumers have contributed, so every grad_fn sees its full
+    // upstream gradient in `self.node->grad`
+    _accumulate_grad(self, grad);
+    const c11_vector* hooks = &cten_context_get()->grad_hooks;
+    c11_vector__push(Tensor, &stack, self);
+    while(stack.length > 0) {
+        Tensor t = c11_vector__back(Tensor, &stack);
+        c11_vector__pop(&stack);
+        // a leaf is only popped after the consumer that completed it has run all its grad_fns, so
+        // hooks may already overwrite the leaf's data
+        if(t.node->n_inputs == 0) {
+            bool hooked = hooks->length > 0 && _run_grad_hooks(hooks, t);
+            // a transient gradient left in this pool with no hook to consume it would be lost
+            cten_assert(hooked || !t.node->transient_grad,
+                        "Tensor_backward(): gradient hooks of this leaf live in another context");
+        }
+        // activations spilled in offload mode start coming back before the grad_fns read them
+        if(t.node->n_inputs > 0) _cten_pool_prefetch(t.data);
+        for(int i = 0; i < t.node->n_inputs; i++) {
+            _cten_pool_prefetch(t.node->inputs[i].data);
+        }
+        for(int i = 0; i < t.node->n_inputs; i++) {
+            Tensor input = t.node->inputs[i];
+            if(input.node == NULL) continue;
+            CTEN_PROFILE_BEGIN_GRAD(t.node->name);
+            Tensor input_grad = t.node->grad_fn(t, i);
+            // a grad_fn returns (Tensor){0} when it has accumulated its gradient itself
+            int numel = input_grad.data != NULL ? input_grad.data->numel : 0;
+            (void)numel;  // read by the profiler only
+            CTEN_PROFILE_END_GRAD(t.node->name, input_grad.shape, numel, 2 * sizeof(float) * numel);
+            if(input_grad.data != NULL) {
+                assert(input_grad.data->numel == input.data->numel);
+                _accumulate_grad(input, input_grad);
+            }
+            if(--input.node->n_pending == 0) c11_vector__push(Tensor, &stack, input);
+        }
     }
+    c11_vector__dtor(&stack);
 }
 
 int Tensor_backward_apply(Tensor self, void (*f)(Tensor, void*), void* ctx) {
@@ -147,6 +424,9 @@ void _cten_zero_grad(Tensor* params, int n_params) {
     for(int i = 0; i < n_params; i++) {
         Tensor t = params[i];
         if(t.node == NULL) continue;
-        t.node->grad = Tensor_zeros(t.shape, false);
+        // cleared rather than zero-filled: the next backward overwrites the grad buffer on its
+        // first contribution, and sparse gradients stay O(rows touched)
+        t.node->grad = (Tensor){0};
+        t.node->grad_rows = NULL;
     }
 }
\ No newline at end of file
@@ -0,0 +1,209 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* File layout (native endianness):
+ *
+ *   CheckpointHeader
+ *   CheckpointEntry[n_tensors]
+ *   for each tensor: padding, uint32 version (0), int numel, float data[numel]
+ *
+ * Every `data` starts on a CTEN_CHECKPOINT_ALIGN boundary and is preceded by its element count,
+ * so the mapped bytes at `offset - sizeof(FloatBuffer)` form a valid FloatBuffer and tensors can
+ * point straight into the mapping. Version 1 files have no version word, so the bytes in front of
+ * a tensor's count may belong to the previous tensor; their tensors are copied out instead.
+ */
+
+#define CTEN_CHECKPOINT_MAGIC "CTENCKPT"
+#define CTEN_CHECKPOINT_VERSION 2
+#define CTEN_CHECKPOINT_ALIGN 64
+
+typedef struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_tensors;
+    uint64_t file_size;
+} CheckpointHeader;
+
+typedef struct CheckpointEntry {
+    char name[CTEN_CHECKPOINT_NAME_MAX];
+    int32_t shape[4];
+    uint32_t dtype;
+    uint32_t numel;
+    uint64_t offset;
+} CheckpointEntry;
+
+typedef struct cten_checkpoint {
+    void* base;
+    size_t size;
+    int n_tensors;
+    uint32_t version;
+    const CheckpointEntry* entries;
+} cten_checkpoint;
+
+static uint64_t _align_up(uint64_t x, uint64_t align) { return (x + align - 1) / align * align; }
+
+bool cten_save(const char* path, int n_tensors, const char* const* names, const Tensor* tensors) {
+    size_t header_size = sizeof(CheckpointHeader) + sizeof(CheckpointEntry) * n_tensors;
+    char* header = calloc(1, header_size);
+    cten_assert(header != NULL, "cten_save(): out of memory");
+    CheckpointHeader* h = (CheckpointHeader*)header;
+    CheckpointEntry* entries = (CheckpointEntry*)(header + sizeof(CheckpointHeader));
+
+    // lay out every tensor before touching the file so the write is a single forward pass
+    uint64_t cursor = header_size;
+    for(int i = 0; i < n_tensors; i++) {
+        CheckpointEntry* e = &entries[i];
+        size_t name_len = strlen(names[i]);
+        cten_assert(name_len < CTEN_CHECKPOINT_NAME_MAX, "cten_save(): name too long: %s", names[i]);
+        for(int j = 0; j < i; j++) {
+            cten_assert(strcmp(names[j], names[i]) != 0, "cten_save(): duplicate name: %s", names[i]);
+        }
+        memcpy(e->name, names[i], name_len);
+        for(int j = 0; j < 4; j++) {
+            e->shape[j] = tensors[i].shape[j];
+        }
+        e->dtype = CTEN_DTYPE_F32;
+        e->numel = tensors[i].data->numel;
+        e->offset = _align_up(cursor + sizeof(FloatBuffer), CTEN_CHECKPOINT_ALIGN);
+        cursor = e->offset + sizeof(float) * e->numel;
+    }
+    memcpy(h->magic, CTEN_CHECKPOINT_MAGIC, sizeof(h->magic));
+    h->version = CTEN_CHECKPOINT_VERSION;
+    h->n_tensors = n_tensors;
+    h->file_size = cursor;
+
+    // write to a temporary file and rename it, so readers never map a half-written checkpoint
+    char tmp_path[4096];
+    int n = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* fp = n > 0 && n < (int)sizeof(tmp_path) ? fopen(tmp_path, "wb") : NULL;
+    if(fp == NULL) {
+        free(header);
+        return false;
+    }
+    static char zeros[CTEN_CHECKPOINT_ALIGN];
+    bool ok = fwrite(header, header_size, 1, fp) == 1;
+    cursor = header_size;
+    for(int i = 0; i < n_tensors && ok; i++) {
+        const CheckpointEntry* e = &entries[i];
+        size_t pad = e->offset - sizeof(FloatBuffer) - cursor;
+        FloatBuffer buf = {.version = 0, .numel = e->numel};
+        int numel = e->numel;
+        ok = fwrite(zeros, 1, pad, fp) == pad;
+        ok = ok && fwrite(&buf, sizeof(FloatBuffer), 1, fp) == 1;
+        ok = ok && fwrite(tensors[i].data->flex, sizeof(float), numel, fp) == (size_t)numel;
+        cursor = e->offset + sizeof(float) * e->numel;
+    }
+    free(header);
+    ok = (fclose(fp) == 0) && ok;
+    if(ok) ok = rename(tmp_path, path) == 0;
+    if(!ok) remove(tmp_path);
+    return ok;
+}
+
+cten_checkpoint* cten_load(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return NULL;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CheckpointHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+    // private mapping: pages are shared with the page cache until a tensor is written to
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) return NULL;
+
+    const CheckpointHeader* h = base;
+    // every tensor's FloatBuffer header lies between the entry table and its data
+    uint64_t data_start =
+        sizeof(CheckpointHeader) + sizeof(CheckpointEntry) * (uint64_t)h->n_tensors;
+    bool ok = memcmp(h->magic, CTEN_CHECKPOINT_MAGIC, sizeof(h->magic)) == 0 &&
+              (h->version == 1 || h->version == CTEN_CHECKPOINT_VERSION) && h->file_size == size &&
+              data_start <= size;
+    const CheckpointEntry* entries = (const CheckpointEntry*)(h + 1);
+    for(uint32_t i = 0; ok && i < h->n_tensors; i++) {
+        const CheckpointEntry* e = &entries[i];
+        TensorShape shape = {e->shape[0], e->shape[1], e->shape[2], e->shape[3]};
+        ok = e->dtype == CTEN_DTYPE_F32 && e->offset % CTEN_CHECKPOINT_ALIGN == 0 &&
+             e->offset >= data_start + sizeof(FloatBuffer) && e->offset <= size &&
+             sizeof(float) * (uint64_t)e->numel <= size - e->offset &&
+             TensorShape_numel(shape) == (int)e->numel &&
+             memchr(e->name, 0, CTEN_CHECKPOINT_NAME_MAX) != NULL &&
+             ((FloatBuffer*)((char*)base + e->offset - sizeof(FloatBuffer)))->numel == (int)e->numel;
+    }
+    if(!ok) {
+        munmap(base, size);
+        return NULL;
+    }
+
+    cten_checkpoint* self = malloc(sizeof(cten_checkpoint));
+    cten_assert(self != NULL, "cten_load(): out of memory");
+    self->base = base;
+    self->size = size;
+    self->n_tensors = h->n_tensors;
+    self->version = h->version;
+    self->entries = entries;
+    return self;
+}
+
+int cten_checkpoint_size(cten_checkpoint* self) { return self->n_tensors; }
+
+const char* cten_checkpoint_name(cten_checkpoint* self, int i) {
+    cten_assert(i >= 0 && i < self->n_tensors, "checkpoint index %d out of range", i);
+    return self->entries[i].name;
+}
+
+bool cten_checkpoint_has(cten_checkpoint* self, const char* name) {
+    for(int i = 0; i < self->n_tensors; i++) {
+        if(strcmp(self->entries[i].name, name) == 0) return true;
+    }
+    return false;
+}
+
+Tensor cten_checkpoint_get(cten_checkpoint* self, const char* name, bool requires_grad) {
+    for(int i = 0; i < self->n_tensors; i++) {
+        const CheckpointEntry* e = &self->entries[i];
+        if(strcmp(e->name, name) != 0) continue;
+        Tensor res;
+        for(int j = 0; j < 4; j++) {
+            res.shape[j] = e->shape[j];
+        }
+        FloatBuffer* data = (FloatBuffer*)((char*)self->base + e->offset - sizeof(FloatBuffer));
+        if(self->version == 1) {
+            res = Tensor_new(res.shape, requires_grad);
+            memcpy(res.data->flex, data->flex, sizeof(float) * data->numel);
+            return res;
+        }
+        res.data = data;
+        if(requires_grad) {
+            res.node = _cten_malloc(sizeof(GradNode));
+            memset(res.node, 0, sizeof(GradNode));
+        } else {
+            res.node = NULL;
+        }
+        return res;
+    }
+    cten_assert(false, "cten_checkpoint_get(): no tensor named '%s'", name);
+    return (Tensor){0};
+}
+
+void cten_checkpoint_close(cten_checkpoint* self) {
+    if(self == NULL) return;
+    for(int i = 0; i < self->n_tensors; i++) {
+        _cten_prepack_forget(
+            (FloatBuffer*)((char*)self->base + self->entries[i].offset - sizeof(FloatBuffer)));
+    }
+    munmap(self->base, self->size);
+    free(self);
+}
@@ -1,10 +1,63 @@
 #include "cten.h"
 #include "cten_internal.h"
 
-static int _eval_depth = 0;
+#include <pthread.h>
+#include <stdlib.h>
 
-void cten_begin_eval() { _eval_depth++; }
+/* Every thread lazily gets a default context, released when the thread exits (or by
+ * cten_finalize() on the thread that called it). Explicit contexts override it until reset. */
 
-bool cten_is_eval() { return _eval_depth > 0; }
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_default_key;
+static _Thread_local cten_context* g_default;
+static _Thread_local cten_context* g_current;
 
-void cten_end_eval() { _eval_depth--; }
\ No newline at end of file
+static void _thread_exit(void* ctx) { cten_context_delete(ctx); }
+
+static void _make_key() { pthread_key_create(&g_default_key, _thread_exit); }
+
+cten_context* cten_context_new() {
+    cten_context* ctx = calloc(1, sizeof(cten_context));
+    cten_assert(ctx != NULL, "cten_context_new(): out of memory");
+    ctx->allocator = _cten_pool_new();
+    ctx->profiler = _cten_profiler_new();
+    c11_vector__ctor(&ctx->grad_hooks, sizeof(GradHook));
+    return ctx;
+}
+
+void cten_context_delete(cten_context* ctx) {
+    if(ctx == NULL) return;
+    if(ctx == g_current) g_current = NULL;
+    if(ctx == g_default) {
+        g_default = NULL;
+        pthread_setspecific(g_default_key, NULL);
+    }
+    _cten_pool_delete(ctx->allocator);
+    _cten_profiler_delete(ctx->profiler);
+    c11_vector__dtor(&ctx->grad_hooks);
+    _cten_tracer_delete(ctx->tracer);
+    free(ctx);
+}
+
+cten_context* cten_context_set(cten_context* ctx) {
+    cten_context* prev = cten_context_get();
+    g_current = ctx;
+    return prev;
+}
+
+cten_context* cten_context_get() { return g_current != NULL ? g_current : _cten_default_context(); }
+
+cten_context* _cten_default_context() {
+    if(g_default == NULL) {
+        pthread_once(&g_key_once, _make_key);
+        g_default = cten_context_new();
+        pthread_setspecific(g_default_key, g_default);
+    }
+    return g_default;
+}
+
+void cten_begin_eval() { cten_context_get()->eval_depth++; }
+
+bool cten_is_eval() { return cten_context_get()->eval_depth > 0; }
+
+void cten_end_eval() { cten_context_get()->eval_depth--; }
@@ -0,0 +1,399 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Conv2dParams {
+    int stride, padding, dilation, groups;
+    int kh, kw;
+    int oh, ow;
+} Conv2dParams;
+
+typedef struct Pool2dParams {
+    int kernel_size, stride, padding;
+    int* argmax;  // maxpool only: flat input index of every output element
+} Pool2dParams;
+
+static int _conv_out_size(int in, int k, int stride, int padding, int dilation) {
+    return (in + 2 * padding - dilation * (k - 1) - 1) / stride + 1;
+}
+
+static void* _workspace(size_t numel) {
+    float* p = malloc(sizeof(float) * numel);
+    cten_assert(p != NULL, "conv: out of memory");
+    return p;
+}
+
+/* x[C][H][W] -> col[C * KH * KW][OH * OW] */
+static void _im2col(const float* x, int C, int H, int W, const Conv2dParams* p, float* col) {
+    int ohow = p->oh * p->ow;
+    for(int c = 0; c < C; c++) {
+        for(int kh = 0; kh < p->kh; kh++) {
+            for(int kw = 0; kw < p->kw; kw++) {
+                float* row = col + ((c * p->kh + kh) * p->kw + kw) * ohow;
+                for(int oh = 0; oh < p->oh; oh++) {
+                    int ih = oh * p->stride - p->padding + kh * p->dilation;
+                    float* dst = row + oh * p->ow;
+                    if(ih < 0 || ih >= H) {
+                        memset(dst, 0, sizeof(float) * p->ow);
+                        continue;
+                    }
+                    const float* src = x + (c * H + ih) * W;
+                    for(int ow = 0; ow < p->ow; ow++) {
+                        int iw = ow * p->stride - p->padding + kw * p->dilation;
+                        dst[ow] = (iw >= 0 && iw < W) ? src[iw] : 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* dx[C][H][W] += col2im(dcol[C * KH * KW][OH * OW]) */
+static void _col2im(const float* col, int C, int H, int W, const Conv2dParams* p, float* dx) {
+    int ohow = p->oh * p->ow;
+    for(int c = 0; c < C; c++) {
+        for(int kh = 0; kh < p->kh; kh++) {
+            for(int kw = 0; kw < p->kw; kw++) {
+                const float* row = col + ((c * p->kh + kh) * p->kw + kw) * ohow;
+                for(int oh = 0; oh < p->oh; oh++) {
+                    int ih = oh * p->stride - p->padding + kh * p->dilation;
+                    if(ih < 0 || ih >= H) continue;
+                    float* dst = dx + (c * H + ih) * W;
+                    for(int ow = 0; ow < p->ow; ow++) {
+                        int iw = ow * p->stride - p->padding + kw * p->dilation;
+                        if(iw >= 0 && iw < W) dst[iw] += row[oh * p->ow + ow];
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Direct convolution for small kernels (groups == 1, dilation == 1). Weights are repacked to
+ * OIhw16o and the input is zero-padded once, so the per-ISA conv_row16 kernel computes a whole
+ * output row of CTEN_CONV_OC_BLOCK channels (NCHW16c) without bounds checks or an im2col buffer
+ * that is C * KH * KW times larger than the input. */
+static void _conv2d_direct(Tensor input,
+                           Tensor weight,
+                           Tensor bias,
+                           const Conv2dParams* p,
+                           Tensor res) {
+    const int OCB = CTEN_CONV_OC_BLOCK;
+    int N = input.shape[0], C = input.shape[1], H = input.shape[2], W = input.shape[3];
+    int OC = weight.shape[0];
+    int n_blocks = (OC + OCB - 1) / OCB;
+    int ksize = p->kh * p->kw;
+    int HP = H + 2 * p->padding, WP = W + 2 * p->padding;
+
+    float* packed = _workspace((size_t)n_blocks * C * ksize * OCB);
+    for(int ob = 0; ob < n_blocks; ob++) {
+        for(int k = 0; k < C * ksize; k++) {
+            float* dst = packed + (ob * C * ksize + k) * OCB;
+            for(int o = 0; o < OCB; o++) {
+                int oc = ob * OCB + o;
+                dst[o] = oc < OC ? weight.data->flex[oc * C * ksize + k] : 0;
+            }
+        }
+    }
+
+    float* padded = _workspace((size_t)C * HP * WP);
+    memset(padded, 0, sizeof(float) * C * HP * WP);
+    float* tile = _workspace((size_t)p->ow * OCB);
+    for(int n = 0; n < N; n++) {
+        for(int c = 0; c < C; c++) {
+            for(int h = 0; h < H; h++) {
+                memcpy(padded + (c * HP + h + p->padding) * WP + p->padding,
+                       input.data->flex + ((n * C + c) * H + h) * W,
+                       sizeof(float) * W);
+            }
+        }
+        for(int ob = 0; ob < n_blocks; ob++) {
+            int oc0 = ob * OCB;
+            int n_oc = OC - oc0 < OCB ? OC - oc0 : OCB;
+            for(int oh = 0; oh < p->oh; oh++) {
+                _cten_kernels.conv_row16(p->ow,
+                                         C,
+                                         p->kh,
+                                         p->kw,
+                                         p->stride,
+                                         padded + oh * p->stride * WP,
+                                         HP * WP,
+                                         WP,
+                                         packed + ob * C * ksize * OCB,
+                                         tile);
+                for(int o = 0; o < n_oc; o++) {
+                    float* y = res.data->flex + ((n * OC + oc0 + o) * p->oh + oh) * p->ow;
+                    float b = bias.data != NULL ? bias.data->flex[oc0 + o] : 0;
+                    for(int ow = 0; ow < p->ow; ow++) {
+                        y[ow] = tile[ow * OCB + o] + b;
+                    }
+                }
+            }
+        }
+    }
+    free(tile);
+    free(padded);
+    free(packed);
+}
+
+static void _conv2d_im2col(Tensor input,
+                           Tensor weight,
+                           Tensor bias,
+                           const Conv2dParams* p,
+                           Tensor res) {
+    int N = input.shape[0], C = input.shape[1], H = input.shape[2], W = input.shape[3];
+    int OC = weight.shape[0];
+    int Cg = C / p->groups, OCg = OC / p->groups;
+    int ck = Cg * p->kh * p->kw;
+    int ohow = p->oh * p->ow;
+
+    float* col = _workspace((size_t)ck * ohow);
+    for(int n = 0; n < N; n++) {
+        for(int g = 0; g < p->groups; g++) {
+            _im2col(input.data->flex + (n * C + g * Cg) * H * W, Cg, H, W, p, col);
+            float* y = res.data->flex + (n * OC + g * OCg) * ohow;
+            const float* w = weight.data->flex + g * OCg * ck;
+            _cten_gemm(OCg, ohow, ck, w, ck, 1, col, ohow, 1, y, ohow, false);
+        }
+        if(bias.data == NULL) continue;
+        for(int oc = 0; oc < OC; oc++) {
+            float* y = res.data->flex + (n * OC + oc) * ohow;
+            float b = bias.data->flex[oc];
+            for(int j = 0; j < ohow; j++) {
+                y[j] += b;
+            }
+        }
+    }
+    free(col);
+}
+
+static Tensor GradFn_conv2d(Tensor self, int i) {
+    Tensor input = self.node->inputs[0];
+    Tensor weight = self.node->inputs[1];
+    Tensor g = self.node->grad;
+    const Conv2dParams* p = self.node->ctx;
+    int N = input.shape[0], C = input.shape[1], H = input.shape[2], W = input.shape[3];
+    int OC = weight.shape[0];
+    int Cg = C / p->groups, OCg = OC / p->groups;
+    int ck = Cg * p->kh * p->kw;
+    int ohow = p->oh * p->ow;
+
+    if(i == 2) {
+        // dbias[oc] = sum over batch and pixels of g
+        Tensor res = Tensor_zeros(self.node->inputs[2].shape, false);
+        for(int n = 0; n < N; n++) {
+            for(int oc = 0; oc < OC; oc++) {
+                res.data->flex[oc] += _cten_kernels.sum(ohow, g.data->flex + (n * OC + oc) * ohow);
+            }
+        }
+        return res;
+    }
+
+    Tensor res = Tensor_zeros(i == 0 ? input.shape : weight.shape, false);
+    float* col = _workspace((size_t)ck * ohow);
+    for(int n = 0; n < N; n++) {
+        for(int grp = 0; grp < p->groups; grp++) {
+            const float* g_ = g.data->flex + (n * OC + grp * OCg) * ohow;
+            if(i == 0) {
+                // dcol[ck x ohow] = W^T[ck x OCg] @ g[OCg x ohow], then scatter back to the image
+                const float* w = weight.data->flex + grp * OCg * ck;
+                _cten_gemm(ck, ohow, OCg, w, 1, ck, g_, ohow, 1, col, ohow, false);
+                _col2im(col, Cg, H, W, p, res.data->flex + (n * C + grp * Cg) * H * W);
+            } else {
+                // dW[OCg x ck] += g[OCg x ohow] @ col^T[ohow x ck]
+                _im2col(input.data->flex + (n * C + grp * Cg) * H * W, Cg, H, W, p, col);
+                float* dw = res.data->flex + grp * OCg * ck;
+                _cten_gemm(OCg, ck, ohow, g_, ohow, 1, col, 1, ohow, dw, ck, true);
+            }
+        }
+    }
+    free(col);
+    return res;
+}
+
+Tensor nn_conv2d(Tensor input,
+                 Tensor weight,
+                 Tensor bias,
+                 int stride,
+                 int padding,
+                 int dilation,
+                 int groups) {
+    CTEN_PROFILE_BEGIN();
+    cten_assert_dim("nn_conv2d() input dim", TensorShape_dim(input.shape), 4);
+    cten_assert_dim("nn_conv2d() weight dim", TensorShape_dim(weight.shape), 4);
+    cten_assert(stride > 0 && padding >= 0 && dilation > 0 && groups > 0,
+                "nn_conv2d(): invalid stride/padding/dilation/groups");
+    int N = input.shape[0], C = input.shape[1], H = input.shape[2], W = input.shape[3];
+    int OC = weight.shape[0];
+    cten_assert(C % groups == 0 && OC % groups == 0,
+                "nn_conv2d(): channels not divisible by groups");
+    cten_assert_dim("nn_conv2d() weight in_channels", weight.shape[1], C / groups);
+    if(bias.data != NULL) cten_assert_dim("nn_conv2d() bias numel", bias.data->numel, OC);
+
+    Conv2dParams p = {stride, padding, dilation, groups, weight.shape[2], weight.shape[3]};
+    p.oh = _conv_out_size(H, p.kh, stride, padding, dilation);
+    p.ow = _conv_out_size(W, p.kw, stride, padding, dilation);
+    cten_assert(p.oh > 0 && p.ow > 0, "nn_conv2d(): kernel larger than padded input");
+
+    bool requires_grad =
+        !cten_is_eval() && (input.node != NULL || weight.node != NULL || bias.node != NULL);
+    Tensor res = Tensor_new((TensorShape){N, OC, p.oh, p.ow}, requires_grad);
+
+    // the direct path needs wide vectors to beat im2col + GEMM; 1x1 and very deep convolutions
+    // are plain GEMMs already
+    int ck = C * p.kh * p.kw;
+    bool direct = groups == 1 && dilation == 1 && p.kh * p.kw > 1 && ck <= 1024 &&
+                  strcmp(_cten_kernels.isa, "generic") != 0;
+    if(direct) {
+        _conv2d_direct(input, weight, bias, &p, res);
+    } else {
+        _conv2d_im2col(input, weight, bias, &p, res);
+    }
+
+    if(requires_grad) {
+        Conv2dParams* ctx = _cten_malloc(sizeof(Conv2dParams));
+        *ctx = p;
+        res.node->grad_fn = GradFn_conv2d;
+        res.node->name = "nn_conv2d";
+        res.node->ctx = ctx;
+        res.node->inputs[0] = input;
+        res.node->inputs[1] = weight;
+        res.node->n_inputs = 2;
+        if(bias.data != NULL) {
+            res.node->inputs[2] = bias;
+            res.node->n_inputs = 3;
+        }
+    }
+    CTEN_PROFILE_END(res.shape,
+                     2.0 * res.data->numel * (C / groups) * p.kh * p.kw,
+                     sizeof(float) * (input.data->numel + weight.data->numel + res.data->numel));
+    return res;
+}
+
+/* nn.maxpool2d / nn.avgpool2d */
+static Tensor GradFn_maxpool2d(Tensor self, int i) {
+    Tensor input = self.node->inputs[i];
+    const Pool2dParams* p = self.node->ctx;
+    Tensor g = self.node->grad;
+    Tensor res = Tensor_zeros(input.shape, false);
+    for(int j = 0; j < self.data->numel; j++) {
+        res.data->flex[p->argmax[j]] += g.data->flex[j];
+    }
+    return res;
+}
+
+static Tensor GradFn_avgpool2d(Tensor self, int i) {
+    Tensor input = self.node->inputs[i];
+    const Pool2dParams* p = self.node->ctx;
+    Tensor g = self.node->grad;
+    Tensor res = Tensor_zeros(input.shape, false);
+    int NC = input.shape[0] * input.shape[1], H = input.shape[2], W = input.shape[3];
+    int OH = self.shape[2], OW = self.shape[3];
+    for(int nc = 0; nc < NC; nc++) {
+        float* dx = res.data->flex + nc * H * W;
+        for(int oh = 0; oh < OH; oh++) {
+            int h0 = oh * p->stride - p->padding;
+            int h_begin = h0 < 0 ? 0 : h0;
+            int h_end = h0 + p->kernel_size > H ? H : h0 + p->kernel_size;
+            for(int ow = 0; ow < OW; ow++) {
+                int w0 = ow * p->stride - p->padding;
+                int w_begin = w0 < 0 ? 0 : w0;
+                int w_end = w0 + p->kernel_size > W ? W : w0 + p->kernel_size;
+                float d = g.data->flex[(nc * OH + oh) * OW + ow] /
+                          ((h_end - h_begin) * (w_end - w_begin));
+                for(int h = h_begin; h < h_end; h++) {
+                    for(int w = w_begin; w < w_end; w++) {
+                        dx[h * W + w] += d;
+                    }
+                }
+            }
+        }
+    }
+    return res;
+}
+
+static Tensor _pool2d(Tensor input, int kernel_size, int stride, int padding, bool is_max) {
+    cten_assert_dim("pool2d() input dim", TensorShape_dim(input.shape), 4);
+    cten_assert(kernel_size > 0 && stride > 0 && padding >= 0 && padding * 2 <= kernel_size,
+                "pool2d(): invalid kernel_size/stride/padding");
+    int N = input.shape[0], C = input.shape[1], H = input.shape[2], W = input.shape[3];
+    int OH = _conv_out_size(H, kernel_size, stride, padding, 1);
+    int OW = _conv_out_size(W, kernel_size, stride, padding, 1);
+    cten_assert(OH > 0 && OW > 0, "pool2d(): kernel larger than padded input");
+
+    bool requires_grad = !cten_is_eval() && input.node != NULL;
+    Tensor res = Tensor_new((TensorShape){N, C, OH, OW}, requires_grad);
+    Pool2dParams* ctx = NULL;
+    if(requires_grad) {
+        ctx = _cten_malloc(sizeof(Pool2dParams));
+        ctx->kernel_size = kernel_size;
+        ctx->stride = stride;
+        ctx->padding = padding;
+        ctx->argmax = is_max ? _cten_malloc(sizeof(int) * res.data->numel) : NULL;
+    }
+
+    for(int nc = 0; nc < N * C; nc++) {
+        const float* x = input.data->flex + nc * H * W;
+        for(int oh = 0; oh < OH; oh++) {
+            int h0 = oh * stride - padding;
+            int h_begin = h0 < 0 ? 0 : h0;
+            int h_end = h0 + kernel_size > H ? H : h0 + kernel_size;
+            for(int ow = 0; ow < OW; ow++) {
+                int w0 = ow * stride - padding;
+                int w_begin = w0 < 0 ? 0 : w0;
+                int w_end = w0 + kernel_size > W ? W : w0 + kernel_size;
+                int out = (nc * OH + oh) * OW + ow;
+                if(is_max) {
+                    int best = h_begin * W + w_begin;
+                    for(int h = h_begin; h < h_end; h++) {
+                        for(int w = w_begin; w < w_end; w++) {
+                            if(x[h * W + w] > x[best]) best = h * W + w;
+                        }
+                    }
+                    res.data->flex[out] = x[best];
+                    if(ctx != NULL) ctx->argmax[out] = nc * H * W + best;
+                } else {
+                    // padding is excluded from the average
+                    float sum = 0;
+                    for(int h = h_begin; h < h_end; h++) {
+                        for(int w = w_begin; w < w_end; w++) {
+                            sum += x[h * W + w];
+                        }
+                    }
+                    res.data->flex[out] = sum / ((h_end - h_begin) * (w_end - w_begin));
+                }
+            }
+        }
+    }
+
+    if(requires_grad) {
+        res.node->grad_fn = is_max ? GradFn_maxpool2d : GradFn_avgpool2d;
+        res.node->name = is_max ? "nn_maxpool2d" : "nn_avgpool2d";
+        res.node->ctx = ctx;
+        res.node->inputs[0] = input;
+        res.node->n_inputs = 1;
+    }
+    return res;
+}
+
+Tensor nn_maxpool2d(Tensor input, int kernel_size, int stride, int padding) {
+    CTEN_PROFILE_BEGIN();
+    Tensor res = _pool2d(input, kernel_size, stride, padding, true);
+    CTEN_PROFILE_END(res.shape,
+                     (double)res.data->numel * kernel_size * kernel_size,
+                     sizeof(float) * (input.data->numel + res.data->numel));
+    return res;
+}
+
+Tensor nn_avgpool2d(Tensor input, int kernel_size, int stride, int padding) {
+    CTEN_PROFILE_BEGIN();
+    Tensor res = _pool2d(input, kernel_size, stride, padding, false);
+    CTEN_PROFILE_END(res.shape,
+                     (double)res.data->numel * kernel_size * kernel_size,
+                     sizeof(float) * (input.data->numel + res.data->numel));
+    return res;
+}
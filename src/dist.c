@@ -0,0 +1,317 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* All ranks map one segment holding a staging copy of every rank's gradients plus the averaged
+ * result. A parameter is reduce-scattered as soon as each rank has published it: rank r sums slice
+ * r of that parameter over all staging copies into the result, so the work and memory traffic are
+ * split evenly as in a ring all-reduce, without the ring's 2(N-1) hops. Publishing happens from a
+ * grad hook while Tensor_backward is still running, and a per-process thread does the summing, so
+ * the last layers are being reduced while the first ones are still in backward.
+ *
+ * Per-parameter counters only ever grow: step s is ready once ready[p] reaches s * world_size and
+ * reduced once done[p] does. A rank only overwrites its staging copy of p after done[p] says every
+ * rank has read it, so no other barrier is needed. */
+
+#define DIST_MAGIC 0x63746431  // "ctd1"
+#define DIST_ALIGN 64
+
+typedef struct DistHeader {
+    _Atomic int initialized;  // DIST_MAGIC once rank 0 has written the fields below
+    _Atomic int attached;
+    pid_t owner;  // rank 0, so other ranks can tell a segment left by a crashed job
+    int world_size;
+    int n_params;
+    int64_t total;
+} DistHeader;
+
+typedef struct DistParam {
+    cten_dist* dist;
+    int index;
+} DistParam;
+
+struct cten_dist {
+    int rank;
+    int world_size;
+    int n_params;
+    Tensor* params;
+    DistParam* hooks;
+    int64_t* offsets;  // n_params + 1
+    bool* published;
+    int step;
+    bool overlap;
+
+    void* base;
+    size_t size;
+    DistHeader* header;
+    _Atomic int* ready;
+    _Atomic int* done;
+    float* staging;  // world_size x total
+    float* result;
+
+    // parameters published by this rank, waiting for the reduce thread
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    int* queue;
+    int queue_head;
+    int queue_tail;
+    bool stop;
+    pthread_t reducer;
+};
+
+static size_t _align_up(size_t x) { return (x + DIST_ALIGN - 1) / DIST_ALIGN * DIST_ALIGN; }
+
+// the i-th retry while waiting on another process: spins briefly, then backs off to sleeping
+static void _back_off(int i) {
+    if(i < 64) return;
+    if(i < 1024) {
+        sched_yield();
+    } else {
+        struct timespec ts = {0, 20000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+// waits for another process to move a shared counter
+static void _wait_for(_Atomic int* counter, int target) {
+    for(int i = 0; atomic_load_explicit(counter, memory_order_acquire) < target; i++) {
+        _back_off(i);
+    }
+}
+
+static bool _alive(pid_t pid) { return kill(pid, 0) == 0 || errno == EPERM; }
+
+/* maps the segment rank 0 published under `name`. Until rank 0 has replaced it, the name may still
+ * refer to a segment left by a crashed job, whose counters are stale: such a segment is either not
+ * published yet or owned by a process that is gone, so it is dropped and the name opened again */
+static void* _attach(const char* name, size_t* size) {
+    for(int i = 0;; i++) {
+        _back_off(i);
+        int fd = shm_open(name, O_RDWR, 0);
+        if(fd < 0) continue;
+        struct stat st;
+        bool sized = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(DistHeader);
+        void* base = sized ? mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                           : MAP_FAILED;
+        close(fd);
+        if(base == MAP_FAILED) continue;
+        DistHeader* h = base;
+        if(atomic_load_explicit(&h->initialized, memory_order_acquire) == DIST_MAGIC &&
+           _alive(h->owner)) {
+            *size = st.st_size;
+            return base;
+        }
+        munmap(base, st.st_size);
+    }
+}
+
+static void _reduce_slice(cten_dist* self, int p, int step) {
+    int64_t numel = self->offsets[p + 1] - self->offsets[p];
+    int64_t lo = self->offsets[p] + numel * self->rank / self->world_size;
+    int64_t hi = self->offsets[p] + numel * (self->rank + 1) / self->world_size;
+    _wait_for(&self->ready[p], step * self->world_size);
+    int n = (int)(hi - lo);
+    float* dst = self->result + lo;
+    if(n > 0) {
+        // summed in rank order, so every replica ends up with bit-identical gradients
+        memcpy(dst, self->staging + lo, sizeof(float) * n);
+        for(int k = 1; k < self->world_size; k++) {
+            _cten_kernels.add(n, dst, self->staging + k * self->offsets[self->n_params] + lo, dst);
+        }
+        float scale = 1.0f / self->world_size;
+        for(int i = 0; i < n; i++) {
+            dst[i] *= scale;
+        }
+    }
+    atomic_fetch_add_explicit(&self->done[p], 1, memory_order_release);
+}
+
+static void* _reducer_main(void* arg) {
+    cten_dist* self = arg;
+    pthread_mutex_lock(&self->lock);
+    while(true) {
+        while(!self->stop && self->queue_head == self->queue_tail) {
+            pthread_cond_wait(&self->cv, &self->lock);
+        }
+        if(self->stop) break;
+        int p = self->queue[self->queue_head++ % self->n_params];
+        int step = self->step;
+        pthread_mutex_unlock(&self->lock);
+        _reduce_slice(self, p, step);
+        pthread_mutex_lock(&self->lock);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return NULL;
+}
+
+// copies this rank's gradient of parameter p into its staging slot and hands p to the reducer
+static void _publish(cten_dist* self, int p) {
+    if(self->published[p]) return;
+    self->published[p] = true;
+    Tensor t = self->params[p];
+    float* dst = self->staging + self->rank * self->offsets[self->n_params] + self->offsets[p];
+    int64_t numel = self->offsets[p + 1] - self->offsets[p];
+    Tensor grad = t.node != NULL ? t.node->grad : (Tensor){0};
+    if(grad.data == NULL) {
+        memset(dst, 0, sizeof(float) * numel);
+    } else if(t.node->grad_rows != NULL) {
+        int dim = t.shape[1];
+        memset(dst, 0, sizeof(float) * numel);
+        for(int r = 0; r < grad.shape[0]; r++) {
+            float* row = dst + t.node->grad_rows[r] * dim;
+            _cten_kernels.add(dim, row, grad.data->flex + r * dim, row);
+        }
+    } else {
+        memcpy(dst, grad.data->flex, sizeof(float) * numel);
+    }
+    atomic_fetch_add_explicit(&self->ready[p], 1, memory_order_release);
+
+    pthread_mutex_lock(&self->lock);
+    self->queue[self->queue_tail++ % self->n_params] = p;
+    pthread_cond_signal(&self->cv);
+    pthread_mutex_unlock(&self->lock);
+}
+
+static void _on_grad_ready(Tensor self, void* ctx) {
+    DistParam* param = ctx;
+    if(param->dist->overlap) _publish(param->dist, param->index);
+}
+
+cten_dist* cten_dist_new(const char* name, int rank, int world_size, int n_params, Tensor* params) {
+    cten_assert(world_size > 0 && rank >= 0 && rank < world_size,
+                "cten_dist_new(): rank %d out of range for world size %d",
+                rank,
+                world_size);
+    cten_dist* self = calloc(1, sizeof(cten_dist));
+    cten_assert(self != NULL, "cten_dist_new(): out of memory");
+    self->rank = rank;
+    self->world_size = world_size;
+    self->n_params = n_params;
+    self->params = params;
+    self->step = 1;
+    self->overlap = true;
+    self->hooks = malloc(sizeof(DistParam) * n_params);
+    self->offsets = malloc(sizeof(int64_t) * (n_params + 1));
+    self->published = calloc(n_params, sizeof(bool));
+    self->queue = malloc(sizeof(int) * n_params);
+    cten_assert(self->hooks != NULL && self->offsets != NULL && self->published != NULL &&
+                    self->queue != NULL,
+                "cten_dist_new(): out of memory");
+    self->offsets[0] = 0;
+    for(int i = 0; i < n_params; i++) {
+        cten_assert(params[i].node != NULL, "cten_dist_new(): param %d does not require grad", i);
+        self->offsets[i + 1] = self->offsets[i] + params[i].data->numel;
+    }
+    int64_t total = self->offsets[n_params];
+
+    size_t counters = _align_up(sizeof(DistHeader) + 2 * sizeof(_Atomic int) * n_params);
+    self->size = counters + sizeof(float) * (world_size + 1) * total;
+    size_t mapped = self->size;
+    if(rank == 0) {
+        // never reuse a segment left by a crashed job: its counters would carry over
+        shm_unlink(name);
+        int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        cten_assert(fd >= 0, "cten_dist_new(): cannot create shared memory '%s'", name);
+        cten_assert(ftruncate(fd, self->size) == 0, "cten_dist_new(): cannot size '%s'", name);
+        self->base = mmap(NULL, self->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        cten_assert(self->base != MAP_FAILED, "cten_dist_new(): cannot map '%s'", name);
+    } else {
+        self->base = _attach(name, &mapped);
+    }
+    self->header = self->base;
+    self->ready = (_Atomic int*)(self->header + 1);
+    self->done = self->ready + n_params;
+    self->staging = (float*)((char*)self->base + counters);
+    self->result = self->staging + world_size * total;
+
+    DistHeader* h = self->header;
+    if(rank == 0) {
+        memset(self->base, 0, counters);
+        h->owner = getpid();
+        h->world_size = world_size;
+        h->n_params = n_params;
+        h->total = total;
+        atomic_store_explicit(&h->initialized, DIST_MAGIC, memory_order_release);
+    }
+    cten_assert(mapped == self->size && h->world_size == world_size && h->n_params == n_params &&
+                    h->total == total,
+                "cten_dist_new(): rank %d disagrees with rank 0 on the world size or parameters",
+                rank);
+    atomic_fetch_add(&h->attached, 1);
+    _wait_for(&h->attached, world_size);
+    // everyone has it mapped, so the name can go; a segment left by a job that crashed before this
+    // point is replaced by the next rank 0
+    if(rank == 0) shm_unlink(name);
+
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->cv, NULL);
+    int err = pthread_create(&self->reducer, NULL, _reducer_main, self);
+    cten_assert(err == 0, "cten_dist_new(): cannot start reduce thread");
+    for(int i = 0; i < n_params; i++) {
+        self->hooks[i] = (DistParam){self, i};
+        Tensor_register_grad_hook(params[i], _on_grad_ready, &self->hooks[i]);
+    }
+    return self;
+}
+
+void cten_dist_allreduce(cten_dist* self) {
+    // parameters outside this backward's graph, or with no backward at all, contribute zeros
+    for(int p = 0; p < self->n_params; p++) {
+        _publish(self, p);
+    }
+    int target = self->step * self->world_size;
+    for(int p = 0; p < self->n_params; p++) {
+        _wait_for(&self->done[p], target);
+        Tensor t = self->params[p];
+        FloatBuffer* buf = _cten_grad_buffer(t);
+        memcpy(buf->flex, self->result + self->offsets[p], sizeof(float) * buf->numel);
+        t.node->grad = (Tensor){.data = buf};
+        memcpy(t.node->grad.shape, t.shape, sizeof(TensorShape));
+        t.node->grad_rows = NULL;
+        self->published[p] = false;
+    }
+    pthread_mutex_lock(&self->lock);
+    self->step++;
+    pthread_mutex_unlock(&self->lock);
+}
+
+void cten_dist_set_overlap(cten_dist* self, bool overlap) { self->overlap = overlap; }
+
+int cten_dist_rank(cten_dist* self) { return self->rank; }
+
+int cten_dist_world_size(cten_dist* self) { return self->world_size; }
+
+void cten_dist_delete(cten_dist* self) {
+    if(self == NULL) return;
+    for(int i = 0; i < self->n_params; i++) {
+        Tensor_remove_grad_hook(self->params[i], _on_grad_ready, &self->hooks[i]);
+    }
+    pthread_mutex_lock(&self->lock);
+    self->stop = true;
+    pthread_cond_signal(&self->cv);
+    pthread_mutex_unlock(&self->lock);
+    pthread_join(self->reducer, NULL);
+    pthread_cond_destroy(&self->cv);
+    pthread_mutex_destroy(&self->lock);
+    munmap(self->base, self->size);
+    free(self->queue);
+    free(self->published);
+    free(self->offsets);
+    free(self->hooks);
+    free(self);
+}
@@ -0,0 +1,554 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Indexing and joining along one dim. A tensor is viewed as (outer, d, inner) around that dim, so
+ * these ops move rows of inner or d * inner floats with memcpy; only gather and scatter_add index
+ * single elements. Work above INDEX_TASK_NUMEL floats is split across the worker pool. Scatters
+ * split over outer and column blocks of inner instead of over indices, so each element is owned
+ * by one task and duplicate indices add up in index order, whatever the thread count. */
+
+#define INDEX_TASK_NUMEL (1 << 15)
+
+static int _outer(TensorShape shape, int dim) {
+    int outer = 1;
+    for(int i = 0; i < dim; i++) {
+        outer *= shape[i];
+    }
+    return outer;
+}
+
+static int _inner(TensorShape shape, int dim) {
+    int inner = 1;
+    for(int i = dim + 1; i < TensorShape_dim(shape); i++) {
+        inner *= shape[i];
+    }
+    return inner;
+}
+
+static void _check_indices(const char* op, const int* indices, int n, int d) {
+    for(int i = 0; i < n; i++) {
+        cten_assert(indices[i] >= 0 && indices[i] < d,
+                    "%s: index %d out of range [0, %d)",
+                    op,
+                    indices[i],
+                    d);
+    }
+}
+
+static int _n_tasks(int64_t numel) {
+    return (int)((numel + INDEX_TASK_NUMEL - 1) / INDEX_TASK_NUMEL);
+}
+
+/* dst row r = src row r, or dst row r += src row r, for n_rows rows of len floats */
+typedef struct RowCopy {
+    float* dst;
+    const float* src;
+    int64_t dst_stride, src_stride;
+    int n_rows, len;
+    bool accumulate;
+} RowCopy;
+
+static void _copy_rows_task(void* ctx, int task) {
+    const RowCopy* c = ctx;
+    int64_t numel = (int64_t)c->n_rows * c->len;
+    int64_t lo = (int64_t)task * INDEX_TASK_NUMEL;
+    int64_t hi = lo + INDEX_TASK_NUMEL < numel ? lo + INDEX_TASK_NUMEL : numel;
+    while(lo < hi) {
+        int64_t r = lo / c->len, col = lo % c->len;
+        int n = (int)(c->len - col < hi - lo ? c->len - col : hi - lo);
+        float* dst = c->dst + r * c->dst_stride + col;
+        const float* src = c->src + r * c->src_stride + col;
+        if(c->accumulate) {
+            _cten_kernels.add(n, dst, src, dst);
+        } else {
+            memcpy(dst, src, sizeof(float) * n);
+        }
+        lo += n;
+    }
+}
+
+static void _copy_rows(float* dst,
+                       int64_t dst_stride,
+                       const float* src,
+                       int64_t src_stride,
+                       int n_rows,
+                       int len,
+                       bool accumulate) {
+    if(len == 0) return;
+    RowCopy c = {dst, src, dst_stride, src_stride, n_rows, len, accumulate};
+    _cten_parallel_for(_n_tasks((int64_t)n_rows * len), _copy_rows_task, &c);
+}
+
+/* x: (outer, d, inner); y: (outer, n, inner). per_slab: y[o][j] is the whole slab x[o][indices[j]],
+ * else indices has y's shape and picks one element each */
+typedef struct IndexCtx {
+    float* x;
+    float* y;
+    const int* indices;
+    int outer, d, n, inner;
+    bool per_slab;
+    int per_task;  // gather: rows (o, j); scatter: units (o, column block)
+    int col_block;
+} IndexCtx;
+
+static IndexCtx _index_ctx(float* x,
+                           float* y,
+                           const int* indices,
+                           TensorShape x_shape,
+                           int dim,
+                           int n,
+                           bool per_slab) {
+    return (IndexCtx){x,
+                      y,
+                      indices,
+                      _outer(x_shape, dim),
+                      x_shape[dim],
+                      n,
+                      _inner(x_shape, dim),
+                      per_slab,
+                      0,
+                      0};
+}
+
+static void _gather_task(void* ctx, int task) {
+    const IndexCtx* c = ctx;
+    int n_rows = c->outer * c->n;
+    int r0 = task * c->per_task;
+    int r1 = r0 + c->per_task < n_rows ? r0 + c->per_task : n_rows;
+    for(int row = r0; row < r1; row++) {
+        int o = row / c->n, j = row % c->n;
+        const float* x = c->x + (size_t)o * c->d * c->inner;
+        float* y = c->y + (size_t)row * c->inner;
+        if(c->per_slab) {
+            memcpy(y, x + (size_t)c->indices[j] * c->inner, sizeof(float) * c->inner);
+        } else {
+            const int* idx = c->indices + (size_t)row * c->inner;
+            for(int k = 0; k < c->inner; k++) {
+                y[k] = x[(size_t)idx[k] * c->inner + k];
+            }
+        }
+    }
+}
+
+// y = x[indices]
+static void _index_gather(IndexCtx* c) {
+    int per_task = INDEX_TASK_NUMEL / c->inner;
+    c->per_task = per_task > 0 ? per_task : 1;
+    int n_rows = c->outer * c->n;
+    _cten_parallel_for((n_rows + c->per_task - 1) / c->per_task, _gather_task, c);
+}
+
+static void _scatter_task(void* ctx, int task) {
+    const IndexCtx* c = ctx;
+    int n_blocks = (c->inner + c->col_block - 1) / c->col_block;
+    int n_units = c->outer * n_blocks;
+    int u0 = task * c->per_task;
+    int u1 = u0 + c->per_task < n_units ? u0 + c->per_task : n_units;
+    for(int u = u0; u < u1; u++) {
+        int o = u / n_blocks;
+        int k0 = u % n_blocks * c->col_block;
+        int k1 = k0 + c->col_block < c->inner ? k0 + c->col_block : c->inner;
+        float* x = c->x + (size_t)o * c->d * c->inner;
+        for(int j = 0; j < c->n; j++) {
+            size_t row = (size_t)o * c->n + j;
+            const float* y = c->y + row * c->inner;
+            if(c->per_slab) {
+                float* dst = x + (size_t)c->indices[j] * c->inner;
+                _cten_kernels.add(k1 - k0, dst + k0, y + k0, dst + k0);
+            } else {
+                const int* idx = c->indices + row * c->inner;
+                for(int k = k0; k < k1; k++) {
+                    x[(size_t)idx[k] * c->inner + k] += y[k];
+                }
+            }
+        }
+    }
+}
+
+// x[indices] += y
+static void _index_scatter(IndexCtx* c) {
+    int col_block = INDEX_TASK_NUMEL / c->n;
+    // at least a cache line of columns, so tasks seldom write to the same one
+    c->col_block = col_block < 16 ? 16 : col_block < c->inner ? col_block : c->inner;
+    int n_units = c->outer * ((c->inner + c->col_block - 1) / c->col_block);
+    int per_task = INDEX_TASK_NUMEL / ((int64_t)c->n * c->col_block);
+    c->per_task = per_task > 0 ? per_task : 1;
+    _cten_parallel_for((n_units + c->per_task - 1) / c->per_task, _scatter_task, c);
+}
+
+/* Tensor_index_select */
+typedef struct IndexSelectCtx {
+    int dim;
+    int n_indices;
+    int indices[];
+} IndexSelectCtx;
+
+static Tensor GradFn_index_select(Tensor self, int i) {
+    // f(x) = x[.., idx, ..]; dx[.., idx[j], ..] += g[.., j, ..]
+    const IndexSelectCtx* ctx = self.node->ctx;
+    Tensor input = self.node->inputs[i];
+    IndexCtx c = _index_ctx(_cten_grad_dense(input),
+                            self.node->grad.data->flex,
+                            ctx->indices,
+                            input.shape,
+                            ctx->dim,
+                            ctx->n_indices,
+                            true);
+    _index_scatter(&c);
+    return (Tensor){0};
+}
+
+Tensor Tensor_index_select(Tensor self, int dim, const int* indices, int n_indices) {
+    CTEN_PROFILE_BEGIN();
+    dim = TensorShape_asdim(self.shape, dim);
+    cten_assert(n_indices > 0, "Tensor_index_select(): no indices");
+    _check_indices("Tensor_index_select()", indices, n_indices, self.shape[dim]);
+    bool requires_grad = !cten_is_eval() && self.node != NULL;
+    TensorShape shape;
+    memcpy(shape, self.shape, sizeof(TensorShape));
+    shape[dim] = n_indices;
+    Tensor res = Tensor_new(shape, requires_grad);
+    IndexCtx c =
+        _index_ctx(self.data->flex, res.data->flex, indices, self.shape, dim, n_indices, true);
+    _index_gather(&c);
+
+    if(requires_grad) {
+        IndexSelectCtx* ctx = _cten_malloc(sizeof(IndexSelectCtx) + sizeof(int) * n_indices);
+        ctx->dim = dim;
+        ctx->n_indices = n_indices;
+        memcpy(ctx->indices, indices, sizeof(int) * n_indices);
+        res.node->grad_fn = GradFn_index_select;
+        res.node->name = "Tensor_index_select";
+        res.node->ctx = ctx;
+        res.node->inputs[0] = self;
+        res.node->n_inputs = 1;
+    }
+    CTEN_PROFILE_END(res.shape, 0, 2 * sizeof(float) * res.data->numel);
+    return res;
+}
+
+/* Tensor_gather, Tensor_scatter_add */
+typedef struct GatherCtx {
+    int dim;
+    int indices[];  // the shape of the gathered (or scattered) side
+} GatherCtx;
+
+// indices must match shape in every dim but `dim`, where shape's extent is free
+static void _check_index_shape(const char* op,
+                               TensorShape shape,
+                               TensorShape index_shape,
+                               int dim) {
+    int rank = TensorShape_dim(shape);
+    cten_assert(TensorShape_dim(index_shape) == rank, "%s: index rank differs from input", op);
+    for(int i = 0; i < rank; i++) {
+        if(i == dim) continue;
+        cten_assert(index_shape[i] == shape[i],
+                    "%s: index extent %d differs from input %d in dim %d",
+                    op,
+                    index_shape[i],
+                    shape[i],
+                    i);
+    }
+}
+
+static GatherCtx* _gather_ctx(int dim, const int* indices, int numel) {
+    GatherCtx* ctx = _cten_malloc(sizeof(GatherCtx) + sizeof(int) * numel);
+    ctx->dim = dim;
+    memcpy(ctx->indices, indices, sizeof(int) * numel);
+    return ctx;
+}
+
+static Tensor GradFn_gather(Tensor self, int i) {
+    // f(x) = x[o][idx[o][j][k]][k]; dx[o][idx[o][j][k]][k] += g[o][j][k]
+    const GatherCtx* ctx = self.node->ctx;
+    Tensor input = self.node->inputs[i];
+    IndexCtx c = _index_ctx(_cten_grad_dense(input),
+                            self.node->grad.data->flex,
+                            ctx->indices,
+                            input.shape,
+                            ctx->dim,
+                            self.shape[ctx->dim],
+                            false);
+    _index_scatter(&c);
+    return (Tensor){0};
+}
+
+Tensor Tensor_gather(Tensor self, int dim, const int* indices, TensorShape shape) {
+    CTEN_PROFILE_BEGIN();
+    dim = TensorShape_asdim(self.shape, dim);
+    _check_index_shape("Tensor_gather()", self.shape, shape, dim);
+    bool requires_grad = !cten_is_eval() && self.node != NULL;
+    Tensor res = Tensor_new(shape, requires_grad);
+    _check_indices("Tensor_gather()", indices, res.data->numel, self.shape[dim]);
+    IndexCtx c =
+        _index_ctx(self.data->flex, res.data->flex, indices, self.shape, dim, shape[dim], false);
+    _index_gather(&c);
+
+    if(requires_grad) {
+        res.node->grad_fn = GradFn_gather;
+        res.node->name = "Tensor_gather";
+        res.node->ctx = _gather_ctx(dim, indices, res.data->numel);
+        res.node->inputs[0] = self;
+        res.node->n_inputs = 1;
+    }
+    CTEN_PROFILE_END(res.shape, 0, 2 * sizeof(float) * res.data->numel);
+    return res;
+}
+
+static Tensor GradFn_scatter_add(Tensor self, int i) {
+    // f(x, s) = x with x[o][idx[o][j][k]][k] += s[o][j][k]; dx = g; ds = g[o][idx[o][j][k]][k]
+    if(i == 0) return self.node->grad;
+    const GatherCtx* ctx = self.node->ctx;
+    Tensor src = self.node->inputs[1];
+    Tensor res = Tensor_new(src.shape, false);
+    IndexCtx c = _index_ctx(self.node->grad.data->flex,
+                            res.data->flex,
+                            ctx->indices,
+                            self.shape,
+                            ctx->dim,
+                            src.shape[ctx->dim],
+                            false);
+    _index_gather(&c);
+    return res;
+}
+
+Tensor Tensor_scatter_add(Tensor self, int dim, const int* indices, Tensor src) {
+    CTEN_PROFILE_BEGIN();
+    dim = TensorShape_asdim(self.shape, dim);
+    _check_index_shape("Tensor_scatter_add()", self.shape, src.shape, dim);
+    _check_indices("Tensor_scatter_add()", indices, src.data->numel, self.shape[dim]);
+    bool requires_grad = !cten_is_eval() && (self.node != NULL || src.node != NULL);
+    Tensor res = Tensor_new(self.shape, requires_grad);
+    _copy_rows(res.data->flex, 0, self.data->flex, 0, 1, self.data->numel, false);
+    IndexCtx c =
+        _index_ctx(res.data->flex, src.data->flex, indices, self.shape, dim, src.shape[dim], false);
+    _index_scatter(&c);
+
+    if(requires_grad) {
+        res.node->grad_fn = GradFn_scatter_add;
+        res.node->name = "Tensor_scatter_add";
+        res.node->ctx = _gather_ctx(dim, indices, src.data->numel);
+        res.node->inputs[0] = self;
+        res.node->inputs[1] = src;
+        res.node->n_inputs = 2;
+    }
+    CTEN_PROFILE_END(res.shape,
+                     src.data->numel,
+                     sizeof(float) * (2 * res.data->numel + 2 * src.data->numel));
+    return res;
+}
+
+/* Tensor_concat, Tensor_stack */
+typedef struct JoinCtx {
+    int outer;
+    int64_t row;          // floats per outer index of the result
+    int64_t offset[4];    // where each input's rows start within a result row
+} JoinCtx;
+
+static Tensor GradFn_join(Tensor self, int i) {
+    // f(x_0, .., x_n) = [x_0 | .. | x_n] along dim; dx_i = the rows of g at x_i's offset
+    const JoinCtx* ctx = self.node->ctx;
+    Tensor input = self.node->inputs[i];
+    Tensor res = Tensor_new(input.shape, false);
+    int len = input.data->numel / ctx->outer;
+    _copy_rows(res.data->flex,
+               len,
+               self.node->grad.data->flex + ctx->offset[i],
+               ctx->row,
+               ctx->outer,
+               len,
+               false);
+    return res;
+}
+
+// every input has `outer` rows, laid side by side in each row of the result, whose shape is given
+static Tensor _join(const Tensor* tensors, int n, int outer, TensorShape shape, const char* name) {
+    bool requires_grad = false;
+    for(int i = 0; i < n; i++) {
+        if(tensors[i].node != NULL) requires_grad = !cten_is_eval();
+    }
+    Tensor res = Tensor_new(shape, requires_grad);
+    int64_t row = res.data->numel / outer;
+    JoinCtx* ctx = NULL;
+    if(requires_grad) {
+        ctx = _cten_malloc(sizeof(JoinCtx));
+        ctx->outer = outer;
+        ctx->row = row;
+        res.node->grad_fn = GradFn_join;
+        res.node->name = name;
+        res.node->ctx = ctx;
+        res.node->n_inputs = 0;
+    }
+    int64_t offset = 0;
+    for(int i = 0; i < n; i++) {
+        int len = tensors[i].data->numel / outer;
+        _copy_rows(res.data->flex + offset, row, tensors[i].data->flex, len, outer, len, false);
+        // inputs without a gradient need no place in the graph
+        if(requires_grad && tensors[i].node != NULL) {
+            int k = res.node->n_inputs++;
+            ctx->offset[k] = offset;
+            res.node->inputs[k] = tensors[i];
+        }
+        offset += len;
+    }
+    return res;
+}
+
+// a node takes 4 inputs: more that require a gradient are joined in groups first
+static int _join_groups(const Tensor* tensors, int n, int* group_end) {
+    int n_grad = 0;
+    for(int i = 0; i < n; i++) {
+        if(tensors[i].node != NULL) n_grad++;
+    }
+    if(cten_is_eval() || n_grad <= 4) return 0;
+    int per_group = (n_grad + 3) / 4;
+    int n_groups = 0, seen = 0;
+    for(int i = 0; i < n; i++) {
+        if(tensors[i].node == NULL) continue;
+        if(seen > 0 && seen % per_group == 0) group_end[n_groups++] = i;
+        seen++;
+    }
+    group_end[n_groups++] = n;
+    return n_groups;
+}
+
+Tensor Tensor_concat(const Tensor* tensors, int n, int dim) {
+    cten_assert(n > 0, "Tensor_concat(): no tensors");
+    TensorShape shape;
+    memcpy(shape, tensors[0].shape, sizeof(TensorShape));
+    dim = TensorShape_asdim(shape, dim);
+    int rank = TensorShape_dim(shape);
+    for(int i = 1; i < n; i++) {
+        // without TensorShape_dim(), which wants a mutable shape
+        const int* s = tensors[i].shape;
+        bool same_rank = s[rank - 1] != 0 && (rank == 4 || s[rank] == 0);
+        cten_assert(same_rank,
+                    "Tensor_concat(): tensor %d differs in rank from tensor 0",
+                    i);
+        for(int d = 0; d < rank; d++) {
+            if(d == dim) continue;
+            cten_assert(tensors[i].shape[d] == shape[d],
+                        "Tensor_concat(): tensor %d has extent %d in dim %d, expected %d",
+                        i,
+                        tensors[i].shape[d],
+                        d,
+                        shape[d]);
+        }
+        shape[dim] += tensors[i].shape[dim];
+    }
+
+    int group_end[4];
+    int n_groups = _join_groups(tensors, n, group_end);
+    if(n_groups > 0) {
+        Tensor parts[4];
+        for(int g = 0, start = 0; g < n_groups; start = group_end[g++]) {
+            parts[g] = Tensor_concat(tensors + start, group_end[g] - start, dim);
+        }
+        return Tensor_concat(parts, n_groups, dim);
+    }
+
+    CTEN_PROFILE_BEGIN();
+    Tensor res = _join(tensors, n, _outer(shape, dim), shape, "Tensor_concat");
+    CTEN_PROFILE_END(res.shape, 0, 2 * sizeof(float) * res.data->numel);
+    return res;
+}
+
+Tensor Tensor_stack(const Tensor* tensors, int n, int dim) {
+    cten_assert(n > 0, "Tensor_stack(): no tensors");
+    TensorShape input_shape;
+    memcpy(input_shape, tensors[0].shape, sizeof(TensorShape));
+    int rank = TensorShape_dim(input_shape);
+    cten_assert(rank < 4, "Tensor_stack(): inputs of rank %d have no room for a new dim", rank);
+    if(dim < 0) dim += rank + 1;
+    cten_assert(dim >= 0 && dim <= rank, "dim %d out of range", dim);
+    for(int i = 1; i < n; i++) {
+        cten_assert(memcmp(tensors[i].shape, tensors[0].shape, sizeof(TensorShape)) == 0,
+                    "Tensor_stack(): tensor %d differs in shape from tensor 0",
+                    i);
+    }
+
+    int group_end[4];
+    int n_groups = _join_groups(tensors, n, group_end);
+    if(n_groups > 0) {
+        Tensor parts[4];
+        for(int g = 0, start = 0; g < n_groups; start = group_end[g++]) {
+            parts[g] = Tensor_stack(tensors + start, group_end[g] - start, dim);
+        }
+        return Tensor_concat(parts, n_groups, dim);
+    }
+
+    CTEN_PROFILE_BEGIN();
+    TensorShape shape = {0};
+    for(int d = 0, s = 0; d <= rank; d++) {
+        shape[d] = d == dim ? n : input_shape[s++];
+    }
+    Tensor res = _join(tensors, n, _outer(shape, dim), shape, "Tensor_stack");
+    CTEN_PROFILE_END(res.shape, 0, 2 * sizeof(float) * res.data->numel);
+    return res;
+}
+
+/* Tensor_split */
+typedef struct SplitCtx {
+    int outer;
+    int64_t row;     // floats per outer index of the input
+    int64_t offset;  // where this part's rows start within an input row
+} SplitCtx;
+
+static Tensor GradFn_split(Tensor self, int i) {
+    // f(x) = x[.., a:b, ..]; dx[.., a:b, ..] += g, in place, so n parts cost one input-sized buffer
+    const SplitCtx* ctx = self.node->ctx;
+    Tensor input = self.node->inputs[i];
+    int len = self.data->numel / ctx->outer;
+    _copy_rows(_cten_grad_dense(input) + ctx->offset,
+               ctx->row,
+               self.node->grad.data->flex,
+               len,
+               ctx->outer,
+               len,
+               true);
+    return (Tensor){0};
+}
+
+void Tensor_split(Tensor self, int dim, int n, const int* sizes, Tensor* out) {
+    CTEN_PROFILE_BEGIN();
+    dim = TensorShape_asdim(self.shape, dim);
+    cten_assert(n > 0, "Tensor_split(): no parts");
+    int extent = self.shape[dim];
+    if(sizes == NULL) {
+        cten_assert(extent % n == 0, "Tensor_split(): %d does not split into %d parts", extent, n);
+    } else {
+        int total = 0;
+        for(int i = 0; i < n; i++) {
+            cten_assert(sizes[i] > 0, "Tensor_split(): part %d is empty", i);
+            total += sizes[i];
+        }
+        cten_assert(total == extent, "Tensor_split(): parts add up to %d, not %d", total, extent);
+    }
+    bool requires_grad = !cten_is_eval() && self.node != NULL;
+    int outer = _outer(self.shape, dim), inner = _inner(self.shape, dim);
+    int64_t row = (int64_t)extent * inner;
+    int64_t offset = 0;
+    for(int i = 0; i < n; i++) {
+        TensorShape shape;
+        memcpy(shape, self.shape, sizeof(TensorShape));
+        shape[dim] = sizes == NULL ? extent / n : sizes[i];
+        int len = shape[dim] * inner;
+        out[i] = Tensor_new(shape, requires_grad);
+        _copy_rows(out[i].data->flex, len, self.data->flex + offset, row, outer, len, false);
+        if(requires_grad) {
+            SplitCtx* ctx = _cten_malloc(sizeof(SplitCtx));
+            *ctx = (SplitCtx){outer, row, offset};
+            out[i].node->grad_fn = GradFn_split;
+            out[i].node->name = "Tensor_split";
+            out[i].node->ctx = ctx;
+            out[i].node->inputs[0] = self;
+            out[i].node->n_inputs = 1;
+        }
+        offset += len;
+    }
+    CTEN_PROFILE_END(self.shape, 0, 2 * sizeof(float) * self.data->numel);
+}
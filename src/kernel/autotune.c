@@ -0,0 +1,467 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* The first GEMM of each shape in autotune mode is timed against scratch output in three stages:
+ * micro-kernel variant, then block sizes one at a time (KC, MC, NC), then how many pool threads
+ * share the row blocks. Each stage starts from the fastest so far, the default first, and moves
+ * only for a clear win. Choices are exact-shape matches, read
+ * on every GEMM under a reader lock, and persisted as one text line per shape, prefixed with a
+ * signature of the CPU model so a cache in a shared home directory serves several machine types.
+ *
+ *   <cpu> <op> f32 <m> <n> <k> <layout> <isa> <mc> <kc> <nc> <threads>
+ *
+ * Lines for other CPUs, or naming a variant that is not available here, are written back as they
+ * were read. */
+
+#define AUTOTUNE_MIN_FLOPS (1 << 22)  // below this, call overhead and timer noise dominate
+#define AUTOTUNE_MAX_SHAPES 4096
+#define AUTOTUNE_REPEATS 5
+#define AUTOTUNE_MIN_SECONDS 2e-3  // per candidate, repeating past AUTOTUNE_REPEATS if needed
+#define AUTOTUNE_MARGIN 0.97       // a candidate must beat the best so far by 3% to replace it
+#define AUTOTUNE_LINE 256
+
+enum { OP_GEMM, OP_GEMM_PREPACKED };
+static const char* g_op_names[] = {"gemm", "gemm_prepacked"};
+static const char* g_layouts[] = {"nn", "tn", "nt", "tt"};
+
+typedef struct TunedShape {
+    int op;
+    int m, n, k;
+    int layout;  // bit 0: a is transposed, bit 1: b is
+    GemmConfig cfg;
+} TunedShape;
+
+static pthread_rwlock_t g_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t g_tune_lock = PTHREAD_MUTEX_INITIALIZER;  // one shape is timed at a time
+static c11_vector /*TunedShape*/ g_shapes;
+static c11_vector /*char* */ g_foreign;
+static _Atomic int g_n_shapes;  // read without the lock, so GEMMs skip the lookup while empty
+static atomic_bool g_enabled;
+static bool g_dirty;
+static char g_cpu[17];
+static char* g_path;
+
+static int _round_up(int x, int to) { return (x + to - 1) / to * to; }
+
+static int _min(int a, int b) { return a < b ? a : b; }
+
+// called with the write lock held
+static void _init_locked() {
+    if(g_shapes.elem_size != 0) return;
+    c11_vector__ctor(&g_shapes, sizeof(TunedShape));
+    c11_vector__ctor(&g_foreign, sizeof(char*));
+}
+
+static void _cpu_signature() {
+    char model[AUTOTUNE_LINE] = "unknown";
+    FILE* fp = fopen("/proc/cpuinfo", "r");
+    if(fp != NULL) {
+        char line[AUTOTUNE_LINE];
+        while(fgets(line, sizeof(line), fp) != NULL) {
+            char* colon = strchr(line, ':');
+            if(strncmp(line, "model name", 10) != 0 || colon == NULL) continue;
+            snprintf(model, sizeof(model), "%s", colon + 2);
+            break;
+        }
+        fclose(fp);
+    }
+    // FNV-1a over the model and the best kernel variant it was allowed to use
+    uint64_t h = 0xcbf29ce484222325ull;
+    for(const char* p = model; *p != '\0' && *p != '\n'; p++) {
+        h = (h ^ (unsigned char)*p) * 0x100000001b3ull;
+    }
+    for(const char* p = _cten_kernels.isa; *p != '\0'; p++) {
+        h = (h ^ (unsigned char)*p) * 0x100000001b3ull;
+    }
+    snprintf(g_cpu, sizeof(g_cpu), "%016llx", (unsigned long long)h);
+}
+
+static TunedShape* _find_locked(const TunedShape* key) {
+    c11__foreach(TunedShape, &g_shapes, it) {
+        if(it->op == key->op && it->m == key->m && it->n == key->n && it->k == key->k &&
+           it->layout == key->layout) {
+            return it;
+        }
+    }
+    return NULL;
+}
+
+static void _insert_locked(const TunedShape* shape) {
+    TunedShape* it = _find_locked(shape);
+    if(it != NULL) {
+        *it = *shape;
+        return;
+    }
+    c11_vector__push(TunedShape, &g_shapes, *shape);
+    atomic_fetch_add(&g_n_shapes, 1);
+}
+
+/* Tuning */
+typedef struct Tuning {
+    const TunedShape* shape;
+    const float* a;
+    int a_rs, a_cs;
+    const float* b;
+    int b_rs, b_cs;
+    const float* prepacked;
+    float* scratch;
+    GemmConfig best;
+    double best_time;
+    GemmConfig tried[32];
+    int n_tried;
+} Tuning;
+
+static double _now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// block sizes past the matrix behave like the matrix itself, so they are clamped to compare equal
+static GemmConfig _normalize(const Tuning* t, GemmConfig cfg) {
+    const TunedShape* s = t->shape;
+    cfg.mc = _min(cfg.mc, _round_up(s->m, CTEN_GEMM_MR));
+    if(s->op == OP_GEMM) {
+        cfg.kc = _min(cfg.kc, s->k);
+        cfg.nc = _min(cfg.nc, _round_up(s->n, CTEN_GEMM_NR));
+    }
+    cfg.n_threads = _min(cfg.n_threads, (s->m + cfg.mc - 1) / cfg.mc);
+    return cfg;
+}
+
+static void _try(Tuning* t, GemmConfig cfg) {
+    cfg = _normalize(t, cfg);
+    for(int i = 0; i < t->n_tried; i++) {
+        GemmConfig* it = &t->tried[i];
+        if(it->ukernel == cfg.ukernel && it->mc == cfg.mc && it->kc == cfg.kc &&
+           it->nc == cfg.nc && it->n_threads == cfg.n_threads) {
+            return;
+        }
+    }
+    if(t->n_tried < 32) t->tried[t->n_tried++] = cfg;
+
+    const TunedShape* s = t->shape;
+    double best = INFINITY, total = 0;
+    for(int r = 0; r < AUTOTUNE_REPEATS || total < AUTOTUNE_MIN_SECONDS; r++) {
+        double start = _now();
+        _cten_gemm_run(&cfg,
+                       s->m,
+                       s->n,
+                       s->k,
+                       t->a,
+                       t->a_rs,
+                       t->a_cs,
+                       t->b,
+                       t->b_rs,
+                       t->b_cs,
+                       t->prepacked,
+                       t->scratch,
+                       s->n,
+                       false);
+        double elapsed = _now() - start;
+        if(elapsed < best) best = elapsed;
+        total += elapsed;
+    }
+    if(best < t->best_time * AUTOTUNE_MARGIN) {
+        t->best = cfg;
+        t->best_time = best;
+    }
+}
+
+static GemmConfig _tune(Tuning* t) {
+    const TunedShape* s = t->shape;
+    t->scratch = malloc(sizeof(float) * s->m * s->n);
+    cten_assert(t->scratch != NULL, "_cten_gemm(): out of memory");
+    t->best_time = INFINITY;
+    // the default goes first, so noise alone never moves a shape off it
+    GemmConfig base = _cten_gemm_default_config();
+    _try(t, base);
+
+    // variants may round multiply-adds differently (FMA), so deterministic mode keeps the default
+    int n_variants;
+    const KernelTable* variants = _cten_kernel_variants(&n_variants);
+    if(cten_is_deterministic()) n_variants = 0;
+    for(int i = 0; i < n_variants; i++) {
+        base.isa = variants[i].isa;
+        base.ukernel = variants[i].gemm_ukernel;
+        _try(t, base);
+    }
+    // prepacked weights fix KC and NC to the layout they were packed with; KC also sets the
+    // summation order, which deterministic mode keeps at the default
+    if(s->op == OP_GEMM && !cten_is_deterministic()) {
+        const int kcs[] = {128, 256, 512};
+        base = t->best;
+        for(int i = 0; i < 3; i++) {
+            base.kc = kcs[i];
+            _try(t, base);
+        }
+    }
+    const int mcs[] = {32, 64, 128, 256};
+    base = t->best;
+    for(int i = 0; i < 4; i++) {
+        base.mc = mcs[i];
+        _try(t, base);
+    }
+    if(s->op == OP_GEMM) {
+        const int ncs[] = {1024, 4096};
+        base = t->best;
+        for(int i = 0; i < 2; i++) {
+            base.nc = ncs[i];
+            _try(t, base);
+        }
+    }
+    int max_threads = cten_get_num_threads();
+    base = t->best;
+    for(int n = 2; n < 2 * max_threads; n *= 2) {
+        base.n_threads = _min(n, max_threads);
+        _try(t, base);
+    }
+    free(t->scratch);
+    return t->best;
+}
+
+// KC cuts every dot product into partial sums added to C one after another, and micro-kernel
+// variants built with different -m flags may or may not fuse a*b + c into one FMA rounding; the
+// other fields leave the arithmetic alone
+static GemmConfig _pin_order(GemmConfig cfg) {
+    if(cten_is_deterministic()) {
+        GemmConfig def = _cten_gemm_default_config();
+        cfg.kc = def.kc;
+        cfg.isa = def.isa;
+        cfg.ukernel = def.ukernel;
+    }
+    return cfg;
+}
+
+GemmConfig _cten_gemm_config(int m,
+                             int n,
+                             int k,
+                             const float* a,
+                             int a_rs,
+                             int a_cs,
+                             const float* b,
+                             int b_rs,
+                             int b_cs,
+                             const float* prepacked) {
+    GemmConfig cfg = _cten_gemm_default_config();
+    if(2.0 * m * n * k < AUTOTUNE_MIN_FLOPS) return cfg;
+    TunedShape key = {
+        .op = prepacked != NULL ? OP_GEMM_PREPACKED : OP_GEMM,
+        .m = m,
+        .n = n,
+        .k = k,
+        .layout = (a_cs != 1) | ((prepacked == NULL && b_cs != 1) << 1),
+    };
+    if(atomic_load_explicit(&g_n_shapes, memory_order_relaxed) > 0) {
+        pthread_rwlock_rdlock(&g_lock);
+        TunedShape* it = _find_locked(&key);
+        if(it != NULL) cfg = it->cfg;
+        pthread_rwlock_unlock(&g_lock);
+        if(it != NULL) return _pin_order(cfg);
+    }
+    // a GEMM inside a parallel task could not use the pool, so its timings would not carry over
+    if(!atomic_load(&g_enabled) || _cten_in_parallel()) return cfg;
+
+    pthread_mutex_lock(&g_tune_lock);
+    pthread_rwlock_rdlock(&g_lock);
+    TunedShape* it = g_shapes.elem_size != 0 ? _find_locked(&key) : NULL;
+    bool full = g_shapes.length >= AUTOTUNE_MAX_SHAPES;
+    if(it != NULL) cfg = it->cfg;
+    pthread_rwlock_unlock(&g_lock);
+    if(it == NULL && !full) {
+        Tuning t = {&key, a, a_rs, a_cs, b, b_rs, b_cs, prepacked};
+        key.cfg = cfg = _tune(&t);
+        pthread_rwlock_wrlock(&g_lock);
+        _init_locked();
+        _insert_locked(&key);
+        g_dirty = true;
+        pthread_rwlock_unlock(&g_lock);
+    }
+    pthread_mutex_unlock(&g_tune_lock);
+    return _pin_order(cfg);
+}
+
+void cten_set_autotune(bool enable) { atomic_store(&g_enabled, enable); }
+
+bool cten_is_autotune() { return atomic_load(&g_enabled); }
+
+/* Cache file */
+static bool _parse(const char* line, char* cpu, TunedShape* out) {
+    char op[32], dtype[8], layout[4], isa[16];
+    GemmConfig* cfg = &out->cfg;
+    int n = sscanf(line,
+                   "%16s %31s %7s %d %d %d %3s %15s %d %d %d %d",
+                   cpu,
+                   op,
+                   dtype,
+                   &out->m,
+                   &out->n,
+                   &out->k,
+                   layout,
+                   isa,
+                   &cfg->mc,
+                   &cfg->kc,
+                   &cfg->nc,
+                   &cfg->n_threads);
+    if(n != 12 || strcmp(dtype, "f32") != 0) return false;
+    out->op = out->layout = -1;
+    for(int i = 0; i < 2; i++) {
+        if(strcmp(op, g_op_names[i]) == 0) out->op = i;
+    }
+    for(int i = 0; i < 4; i++) {
+        if(strcmp(layout, g_layouts[i]) == 0) out->layout = i;
+    }
+    if(out->op < 0 || out->layout < 0) return false;
+    if(cfg->mc <= 0 || cfg->mc % CTEN_GEMM_MR != 0 || cfg->kc <= 0 || cfg->nc <= 0 ||
+       cfg->nc % CTEN_GEMM_NR != 0 || cfg->n_threads <= 0) {
+        return false;
+    }
+    GemmConfig def = _cten_gemm_default_config();
+    if(out->op == OP_GEMM_PREPACKED && (cfg->kc != def.kc || cfg->nc != def.nc)) return false;
+
+    cfg->isa = NULL;
+    int n_variants;
+    const KernelTable* variants = _cten_kernel_variants(&n_variants);
+    for(int i = 0; i < n_variants; i++) {
+        if(strcmp(isa, variants[i].isa) != 0) continue;
+        cfg->isa = variants[i].isa;
+        cfg->ukernel = variants[i].gemm_ukernel;
+    }
+    return true;
+}
+
+bool cten_autotune_load(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if(fp == NULL) return false;
+    pthread_rwlock_wrlock(&g_lock);
+    _init_locked();
+    char line[AUTOTUNE_LINE];
+    while(fgets(line, sizeof(line), fp) != NULL) {
+        if(line[0] == '#' || line[0] == '\n') continue;
+        char cpu[17];
+        TunedShape shape;
+        if(!_parse(line, cpu, &shape)) continue;
+        if(strcmp(cpu, g_cpu) == 0 && shape.cfg.isa != NULL) {
+            _insert_locked(&shape);
+            continue;
+        }
+        char* copy = malloc(strlen(line) + 1);
+        cten_assert(copy != NULL, "cten_autotune_load(): out of memory");
+        strcpy(copy, line);
+        c11_vector__push(char*, &g_foreign, copy);
+    }
+    pthread_rwlock_unlock(&g_lock);
+    fclose(fp);
+    return true;
+}
+
+bool cten_autotune_save(const char* path) {
+    char tmp[4096];
+    if(snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid()) >= (int)sizeof(tmp)) {
+        return false;
+    }
+    FILE* fp = fopen(tmp, "w");
+    if(fp == NULL) return false;
+    pthread_rwlock_wrlock(&g_lock);
+    _init_locked();
+    fprintf(fp, "# cten autotune cache: cpu op dtype m n k layout isa mc kc nc threads\n");
+    c11__foreach(char*, &g_foreign, it) {
+        fputs(*it, fp);
+    }
+    c11__foreach(TunedShape, &g_shapes, it) {
+        fprintf(fp,
+                "%s %s f32 %d %d %d %s %s %d %d %d %d\n",
+                g_cpu,
+                g_op_names[it->op],
+                it->m,
+                it->n,
+                it->k,
+                g_layouts[it->layout],
+                it->cfg.isa,
+                it->cfg.mc,
+                it->cfg.kc,
+                it->cfg.nc,
+                it->cfg.n_threads);
+    }
+    bool ok = fclose(fp) == 0 && rename(tmp, path) == 0;
+    if(ok && g_path != NULL && strcmp(path, g_path) == 0) g_dirty = false;
+    pthread_rwlock_unlock(&g_lock);
+    if(!ok) remove(tmp);
+    return ok;
+}
+
+void cten_autotune_clear() {
+    pthread_rwlock_wrlock(&g_lock);
+    if(g_shapes.elem_size != 0) {
+        c11__foreach(char*, &g_foreign, it) {
+            free(*it);
+        }
+        c11_vector__dtor(&g_foreign);
+        c11_vector__dtor(&g_shapes);
+    }
+    g_shapes = g_foreign = (c11_vector){0};
+    atomic_store(&g_n_shapes, 0);
+    g_dirty = false;
+    pthread_rwlock_unlock(&g_lock);
+}
+
+static char* _default_path() {
+    const char* env = getenv("CTEN_AUTOTUNE_CACHE");
+    const char* dir = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    char path[4096];
+    if(env != NULL && env[0] != '\0') {
+        snprintf(path, sizeof(path), "%s", env);
+    } else if(dir != NULL && dir[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/cten-autotune", dir);
+    } else if(home != NULL && home[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/.cache/cten-autotune", home);
+    } else {
+        return NULL;
+    }
+    char* res = malloc(strlen(path) + 1);
+    if(res != NULL) strcpy(res, path);
+    return res;
+}
+
+void _cten_autotune_init() {
+    cten_autotune_clear();
+    _cpu_signature();
+    free(g_path);
+    g_path = _default_path();
+    if(g_path != NULL) cten_autotune_load(g_path);
+    const char* env = getenv("CTEN_AUTOTUNE");
+    if(env != NULL && atoi(env) > 0) cten_set_autotune(true);
+}
+
+void _cten_autotune_finalize() {
+    pthread_rwlock_rdlock(&g_lock);
+    bool dirty = g_dirty;
+    pthread_rwlock_unlock(&g_lock);
+    if(dirty && g_path != NULL) {
+        // the default location's parent may not exist yet
+        char dir[4096];
+        snprintf(dir, sizeof(dir), "%s", g_path);
+        char* slash = strrchr(dir, '/');
+        if(slash != NULL && slash != dir) {
+            *slash = '\0';
+            mkdir(dir, 0700);
+        }
+        cten_autotune_save(g_path);
+    }
+    cten_autotune_clear();
+    free(g_path);
+    g_path = NULL;
+}
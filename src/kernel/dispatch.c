@@ -0,0 +1,57 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+KernelTable _cten_kernels;
+// every variant this CPU can run, generic first; the autotuner times GEMM micro-kernels across them
+static KernelTable g_variants[3];
+static int g_n_variants;
+
+void _cten_kernels_init_generic(KernelTable* k);
+#ifdef CTEN_HAVE_AVX2
+void _cten_kernels_init_avx2(KernelTable* k);
+#endif
+#ifdef CTEN_HAVE_AVX512
+void _cten_kernels_init_avx512(KernelTable* k);
+#endif
+
+static bool _isa_allowed(const char* isa) {
+    // CTEN_ISA=generic|avx2|avx512 caps the selected variant, e.g. to compare kernels
+    const char* cap = getenv("CTEN_ISA");
+    if(cap == NULL) return true;
+    const char* order[] = {"generic", "avx2", "avx512"};
+    int cap_level = -1, isa_level = -1;
+    for(int i = 0; i < 3; i++) {
+        if(strcmp(cap, order[i]) == 0) cap_level = i;
+        if(strcmp(isa, order[i]) == 0) isa_level = i;
+    }
+    return cap_level < 0 || isa_level <= cap_level;
+}
+
+void _cten_kernels_select() {
+    g_n_variants = 0;
+    _cten_kernels_init_generic(&g_variants[g_n_variants++]);
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+#ifdef CTEN_HAVE_AVX2
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && _isa_allowed("avx2")) {
+        _cten_kernels_init_avx2(&g_variants[g_n_variants++]);
+    }
+#endif
+#ifdef CTEN_HAVE_AVX512
+    if(__builtin_cpu_supports("avx512f") && _isa_allowed("avx512")) {
+        _cten_kernels_init_avx512(&g_variants[g_n_variants++]);
+    }
+#endif
+#endif
+    _cten_kernels = g_variants[g_n_variants - 1];
+}
+
+const KernelTable* _cten_kernel_variants(int* n) {
+    *n = g_n_variants;
+    return g_variants;
+}
+
+const char* cten_kernel_isa() { return _cten_kernels.isa; }
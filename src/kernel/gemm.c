@@ -0,0 +1,265 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Blocked GEMM in the usual three-level layout: B is packed into KC x NR column panels, A into
+ * MC x KC blocks of MR-row panels, and the ISA-specific micro-kernel multiplies one panel pair
+ * into an MR x NR tile of C. A B that stays constant across calls can be packed once up front.
+ * MC/KC/NC below are the defaults; the autotuner may pick others per shape, and may split the MC
+ * row blocks of each packed B block across the worker pool. */
+
+#define GEMM_MC 128
+#define GEMM_KC 256
+#define GEMM_NC 4096
+
+// per thread, so pool workers running row blocks of one GEMM each pack their own A
+typedef struct PackBuffers {
+    float* a;
+    size_t a_capacity;
+    float* b;
+    size_t b_capacity;
+} PackBuffers;
+
+static _Thread_local PackBuffers* g_pack;
+// frees the buffers of threads that exit without calling _cten_gemm_release()
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_pack_key;
+
+static void _free_buffers(void* ptr) {
+    PackBuffers* self = ptr;
+    free(self->a);
+    free(self->b);
+    free(self);
+}
+
+static void _make_key() { pthread_key_create(&g_pack_key, _free_buffers); }
+
+static float* _reserve(float** buffer, size_t* capacity, size_t numel) {
+    if(numel > *capacity) {
+        free(*buffer);
+        size_t bytes = (numel * sizeof(float) + 63) / 64 * 64;
+        *buffer = aligned_alloc(64, bytes);
+        cten_assert(*buffer != NULL, "_cten_gemm(): out of memory");
+        *capacity = bytes / sizeof(float);
+    }
+    return *buffer;
+}
+
+static PackBuffers* _pack_buffers() {
+    if(g_pack == NULL) {
+        g_pack = calloc(1, sizeof(PackBuffers));
+        cten_assert(g_pack != NULL, "_cten_gemm(): out of memory");
+        pthread_once(&g_key_once, _make_key);
+        pthread_setspecific(g_pack_key, g_pack);
+    }
+    return g_pack;
+}
+
+void _cten_gemm_release() {
+    if(g_pack == NULL) return;
+    _free_buffers(g_pack);
+    g_pack = NULL;
+    pthread_setspecific(g_pack_key, NULL);
+}
+
+// a[mb x kb] -> ceil(mb / MR) panels of kb x MR, zero padded
+static void _pack_a(int mb, int kb, const float* a, int rs, int cs, float* dst) {
+    for(int i0 = 0; i0 < mb; i0 += CTEN_GEMM_MR) {
+        int rows = mb - i0 < CTEN_GEMM_MR ? mb - i0 : CTEN_GEMM_MR;
+        for(int p = 0; p < kb; p++) {
+            for(int i = 0; i < rows; i++) {
+                dst[i] = a[(i0 + i) * rs + p * cs];
+            }
+            for(int i = rows; i < CTEN_GEMM_MR; i++) {
+                dst[i] = 0;
+            }
+            dst += CTEN_GEMM_MR;
+        }
+    }
+}
+
+// b[kb x nb] -> ceil(nb / NR) panels of kb x NR, zero padded
+static void _pack_b(int kb, int nb, const float* b, int rs, int cs, float* dst) {
+    for(int j0 = 0; j0 < nb; j0 += CTEN_GEMM_NR) {
+        int cols = nb - j0 < CTEN_GEMM_NR ? nb - j0 : CTEN_GEMM_NR;
+        for(int p = 0; p < kb; p++) {
+            const float* src = b + p * rs + j0 * cs;
+            if(cs == 1 && cols == CTEN_GEMM_NR) {
+                memcpy(dst, src, sizeof(float) * CTEN_GEMM_NR);
+            } else {
+                for(int j = 0; j < cols; j++) {
+                    dst[j] = src[j * cs];
+                }
+                for(int j = cols; j < CTEN_GEMM_NR; j++) {
+                    dst[j] = 0;
+                }
+            }
+            dst += CTEN_GEMM_NR;
+        }
+    }
+}
+
+size_t _cten_gemm_packed_size(int k, int n) {
+    return (size_t)k * ((n + CTEN_GEMM_NR - 1) / CTEN_GEMM_NR * CTEN_GEMM_NR);
+}
+
+/* Every NC x KC block of b packed as _cten_gemm() would pack it, in the order the loops visit them.
+ * Full column blocks come first and hold k * NC floats each, so block (jc, pc) starts at
+ * jc * k + pc * round_up(nb, NR). */
+void _cten_gemm_pack_b(int k, int n, const float* b, int b_rs, int b_cs, float* dst) {
+    for(int jc = 0; jc < n; jc += GEMM_NC) {
+        int nb = n - jc < GEMM_NC ? n - jc : GEMM_NC;
+        int nb_ = (nb + CTEN_GEMM_NR - 1) / CTEN_GEMM_NR * CTEN_GEMM_NR;
+        for(int pc = 0; pc < k; pc += GEMM_KC) {
+            int kb = k - pc < GEMM_KC ? k - pc : GEMM_KC;
+            float* block = dst + (size_t)jc * k + (size_t)pc * nb_;
+            _pack_b(kb, nb, b + pc * b_rs + jc * b_cs, b_rs, b_cs, block);
+        }
+    }
+}
+
+GemmConfig _cten_gemm_default_config() {
+    return (GemmConfig){_cten_kernels.isa, _cten_kernels.gemm_ukernel, GEMM_MC, GEMM_KC, GEMM_NC, 1};
+}
+
+// one packed KC x NC block of b against all of a's rows; task t runs row blocks t, t + n_tasks, ..
+typedef struct GemmBlock {
+    const GemmConfig* cfg;
+    int m, kb, nb;
+    const float* a;  // at column pc
+    int a_rs, a_cs;
+    const float* packed_b;
+    float* c;  // at column jc
+    int ldc;
+    int n_tasks;
+} GemmBlock;
+
+static void _gemm_rows(void* ctx, int task) {
+    const GemmBlock* g = ctx;
+    int mc = g->cfg->mc, kb = g->kb, nb = g->nb, ldc = g->ldc;
+    PackBuffers* buffers = _pack_buffers();
+    size_t a_numel = (size_t)kb * ((g->m < mc ? g->m : mc) + CTEN_GEMM_MR);
+    float* packed_a = _reserve(&buffers->a, &buffers->a_capacity, a_numel);
+    float tile[CTEN_GEMM_MR * CTEN_GEMM_NR];
+
+    for(int ic = task * mc; ic < g->m; ic += g->n_tasks * mc) {
+        int mb = g->m - ic < mc ? g->m - ic : mc;
+        _pack_a(mb, kb, g->a + ic * g->a_rs, g->a_rs, g->a_cs, packed_a);
+        for(int jr = 0; jr < nb; jr += CTEN_GEMM_NR) {
+            int cols = nb - jr < CTEN_GEMM_NR ? nb - jr : CTEN_GEMM_NR;
+            const float* b_panel = g->packed_b + jr * kb;
+            for(int ir = 0; ir < mb; ir += CTEN_GEMM_MR) {
+                int rows = mb - ir < CTEN_GEMM_MR ? mb - ir : CTEN_GEMM_MR;
+                const float* a_panel = packed_a + ir * kb;
+                float* c_tile = g->c + (ic + ir) * ldc + jr;
+                if(rows == CTEN_GEMM_MR && cols == CTEN_GEMM_NR) {
+                    g->cfg->ukernel(kb, a_panel, b_panel, c_tile, ldc);
+                    continue;
+                }
+                // edge tile: compute into a scratch tile and add the valid part
+                memset(tile, 0, sizeof(tile));
+                g->cfg->ukernel(kb, a_panel, b_panel, tile, CTEN_GEMM_NR);
+                for(int i = 0; i < rows; i++) {
+                    for(int j = 0; j < cols; j++) {
+                        c_tile[i * ldc + j] += tile[i * CTEN_GEMM_NR + j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// b is either strided, or already packed by _cten_gemm_pack_b() when prepacked != NULL
+void _cten_gemm_run(const GemmConfig* cfg,
+                    int m,
+                    int n,
+                    int k,
+                    const float* a,
+                    int a_rs,
+                    int a_cs,
+                    const float* b,
+                    int b_rs,
+                    int b_cs,
+                    const float* prepacked,
+                    float* c,
+                    int ldc,
+                    bool accumulate) {
+    if(!accumulate) {
+        for(int i = 0; i < m; i++) {
+            memset(c + i * ldc, 0, sizeof(float) * n);
+        }
+    }
+    if(m == 0 || n == 0 || k == 0) return;
+
+    int mc = cfg->mc, kc = cfg->kc, nc = cfg->nc;
+    int n_blocks = (m + mc - 1) / mc;
+    GemmBlock block = {.cfg = cfg,
+                       .m = m,
+                       .a_rs = a_rs,
+                       .a_cs = a_cs,
+                       .ldc = ldc,
+                       .n_tasks = cfg->n_threads < n_blocks ? cfg->n_threads : n_blocks};
+    float* buffer = NULL;
+    if(prepacked == NULL) {
+        int kc_ = k < kc ? k : kc;
+        int nc_ = (n < nc ? n : nc) + CTEN_GEMM_NR;
+        PackBuffers* buffers = _pack_buffers();
+        buffer = _reserve(&buffers->b, &buffers->b_capacity, (size_t)kc_ * nc_);
+    }
+
+    for(int jc = 0; jc < n; jc += nc) {
+        int nb = n - jc < nc ? n - jc : nc;
+        int nb_ = (nb + CTEN_GEMM_NR - 1) / CTEN_GEMM_NR * CTEN_GEMM_NR;
+        for(int pc = 0; pc < k; pc += kc) {
+            int kb = k - pc < kc ? k - pc : kc;
+            if(prepacked != NULL) {
+                block.packed_b = prepacked + (size_t)jc * k + (size_t)pc * nb_;
+            } else {
+                _pack_b(kb, nb, b + pc * b_rs + jc * b_cs, b_rs, b_cs, buffer);
+                block.packed_b = buffer;
+            }
+            block.kb = kb;
+            block.nb = nb;
+            block.a = a + pc * a_cs;
+            block.c = c + jc;
+            if(block.n_tasks > 1) {
+                _cten_parallel_for(block.n_tasks, _gemm_rows, &block);
+            } else {
+                _gemm_rows(&block, 0);
+            }
+        }
+    }
+}
+
+void _cten_gemm(int m,
+                int n,
+                int k,
+                const float* a,
+                int a_rs,
+                int a_cs,
+                const float* b,
+                int b_rs,
+                int b_cs,
+                float* c,
+                int ldc,
+                bool accumulate) {
+    GemmConfig cfg = _cten_gemm_config(m, n, k, a, a_rs, a_cs, b, b_rs, b_cs, NULL);
+    _cten_gemm_run(&cfg, m, n, k, a, a_rs, a_cs, b, b_rs, b_cs, NULL, c, ldc, accumulate);
+}
+
+void _cten_gemm_prepacked(int m,
+                          int n,
+                          int k,
+                          const float* a,
+                          int a_rs,
+                          int a_cs,
+                          const float* packed_b,
+                          float* c,
+                          int ldc,
+                          bool accumulate) {
+    GemmConfig cfg = _cten_gemm_config(m, n, k, a, a_rs, a_cs, NULL, 0, 0, packed_b);
+    _cten_gemm_run(&cfg, m, n, k, a, a_rs, a_cs, NULL, 0, 0, packed_b, c, ldc, accumulate);
+}
@@ -0,0 +1,281 @@
+#include "cten_internal.h"
+
+/* Portable kernels written so the compiler can vectorize them for whatever ISA this object is
+ * built for. CMake compiles this file once per ISA with CTEN_KERNEL_ISA set (e.g. avx2) and the
+ * matching -m flags; every other build compiles it once as `generic`. */
+
+#ifndef CTEN_KERNEL_ISA
+#define CTEN_KERNEL_ISA generic
+#endif
+
+#define _CTEN_CONCAT(a, b) a##_##b
+#define _CTEN_EXPAND(a, b) _CTEN_CONCAT(a, b)
+#define _CTEN_STR(x) #x
+#define _CTEN_XSTR(x) _CTEN_STR(x)
+#define CTEN_KERNEL(name) _CTEN_EXPAND(name, CTEN_KERNEL_ISA)
+
+// reductions keep this many independent partial sums so they vectorize without -ffast-math;
+// the summation order is the same for every ISA
+#define LANES 16
+
+_Static_assert(CTEN_GEMM_MR == 4, "gemm_ukernel() keeps one accumulator row per MR");
+
+// one named accumulator per row keeps the whole MR x NR tile in vector registers
+static void gemm_ukernel(int k,
+                         const float* restrict a,
+                         const float* restrict b,
+                         float* restrict c,
+                         int ldc) {
+    float acc0[CTEN_GEMM_NR] = {0};
+    float acc1[CTEN_GEMM_NR] = {0};
+    float acc2[CTEN_GEMM_NR] = {0};
+    float acc3[CTEN_GEMM_NR] = {0};
+    for(int p = 0; p < k; p++) {
+        const float* b_p = b + p * CTEN_GEMM_NR;
+        float a0 = a[p * CTEN_GEMM_MR + 0];
+        float a1 = a[p * CTEN_GEMM_MR + 1];
+        float a2 = a[p * CTEN_GEMM_MR + 2];
+        float a3 = a[p * CTEN_GEMM_MR + 3];
+        for(int j = 0; j < CTEN_GEMM_NR; j++) {
+            acc0[j] += a0 * b_p[j];
+            acc1[j] += a1 * b_p[j];
+            acc2[j] += a2 * b_p[j];
+            acc3[j] += a3 * b_p[j];
+        }
+    }
+    for(int j = 0; j < CTEN_GEMM_NR; j++) {
+        c[0 * ldc + j] += acc0[j];
+        c[1 * ldc + j] += acc1[j];
+        c[2 * ldc + j] += acc2[j];
+        c[3 * ldc + j] += acc3[j];
+    }
+}
+
+static void vadd(int n, const float* a, const float* b, float* out) {
+    for(int i = 0; i < n; i++) {
+        out[i] = a[i] + b[i];
+    }
+}
+
+static void vsub(int n, const float* a, const float* b, float* out) {
+    for(int i = 0; i < n; i++) {
+        out[i] = a[i] - b[i];
+    }
+}
+
+static void vmul(int n, const float* a, const float* b, float* out) {
+    for(int i = 0; i < n; i++) {
+        out[i] = a[i] * b[i];
+    }
+}
+
+static void vdiv(int n, const float* a, const float* b, float* out) {
+    for(int i = 0; i < n; i++) {
+        out[i] = a[i] / b[i];
+    }
+}
+
+static void vrelu(int n, const float* x, float* out) {
+    for(int i = 0; i < n; i++) {
+        out[i] = x[i] > 0 ? x[i] : 0;
+    }
+}
+
+static void vaxpy(int n, float alpha, const float* x, float* y) {
+    for(int i = 0; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+static float vsum(int n, const float* x) {
+    float acc[LANES] = {0};
+    int i = 0;
+    for(; i + LANES <= n; i += LANES) {
+        for(int j = 0; j < LANES; j++) {
+            acc[j] += x[i + j];
+        }
+    }
+    for(; i < n; i++) {
+        acc[i % LANES] += x[i];
+    }
+    float sum = 0;
+    for(int j = 0; j < LANES; j++) {
+        sum += acc[j];
+    }
+    return sum;
+}
+
+static float vmax(int n, const float* x) {
+    float acc[LANES];
+    for(int j = 0; j < LANES; j++) {
+        acc[j] = x[0];
+    }
+    int i = 0;
+    for(; i + LANES <= n; i += LANES) {
+        for(int j = 0; j < LANES; j++) {
+            acc[j] = x[i + j] > acc[j] ? x[i + j] : acc[j];
+        }
+    }
+    for(; i < n; i++) {
+        acc[i % LANES] = x[i] > acc[i % LANES] ? x[i] : acc[i % LANES];
+    }
+    float max = acc[0];
+    for(int j = 1; j < LANES; j++) {
+        max = acc[j] > max ? acc[j] : max;
+    }
+    return max;
+}
+
+static float vdot(int n, const float* x, const float* y) {
+    float acc[LANES] = {0};
+    int i = 0;
+    for(; i + LANES <= n; i += LANES) {
+        for(int j = 0; j < LANES; j++) {
+            acc[j] += x[i + j] * y[i + j];
+        }
+    }
+    for(; i < n; i++) {
+        acc[i % LANES] += x[i] * y[i];
+    }
+    float sum = 0;
+    for(int j = 0; j < LANES; j++) {
+        sum += acc[j];
+    }
+    return sum;
+}
+
+#define OCB CTEN_CONV_OC_BLOCK
+
+// four output pixels at a time, each holding OCB output channels in registers
+static void conv_row16(int ow,
+                       int c,
+                       int kh,
+                       int kw,
+                       int stride,
+                       const float* restrict x,
+                       int x_cs,
+                       int x_rs,
+                       const float* restrict w,
+                       float* restrict out) {
+    int j = 0;
+    for(; j + 4 <= ow; j += 4) {
+        float acc0[OCB] = {0};
+        float acc1[OCB] = {0};
+        float acc2[OCB] = {0};
+        float acc3[OCB] = {0};
+        const float* w_p = w;
+        for(int ci = 0; ci < c; ci++) {
+            for(int h = 0; h < kh; h++) {
+                const float* x_p = x + ci * x_cs + h * x_rs + j * stride;
+                for(int q = 0; q < kw; q++, w_p += OCB) {
+                    float x0 = x_p[q];
+                    float x1 = x_p[q + stride];
+                    float x2 = x_p[q + 2 * stride];
+                    float x3 = x_p[q + 3 * stride];
+                    for(int o = 0; o < OCB; o++) {
+                        acc0[o] += x0 * w_p[o];
+                        acc1[o] += x1 * w_p[o];
+                        acc2[o] += x2 * w_p[o];
+                        acc3[o] += x3 * w_p[o];
+                    }
+                }
+            }
+        }
+        for(int o = 0; o < OCB; o++) {
+            out[(j + 0) * OCB + o] = acc0[o];
+            out[(j + 1) * OCB + o] = acc1[o];
+            out[(j + 2) * OCB + o] = acc2[o];
+            out[(j + 3) * OCB + o] = acc3[o];
+        }
+    }
+    for(; j < ow; j++) {
+        float acc[OCB] = {0};
+        const float* w_p = w;
+        for(int ci = 0; ci < c; ci++) {
+            for(int h = 0; h < kh; h++) {
+                const float* x_p = x + ci * x_cs + h * x_rs + j * stride;
+                for(int q = 0; q < kw; q++, w_p += OCB) {
+                    for(int o = 0; o < OCB; o++) {
+                        acc[o] += x_p[q] * w_p[o];
+                    }
+                }
+            }
+        }
+        for(int o = 0; o < OCB; o++) {
+            out[j * OCB + o] = acc[o];
+        }
+    }
+}
+
+/* Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3") */
+#define PHILOX_M0 0xD2511F53ull
+#define PHILOX_M1 0xCD9E8D57ull
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+// blocks hashed together; the 32-bit counter words live in 64-bit lanes so each round is a
+// widening multiply, shifts and xors across blocks with no lane shuffles
+#define PHILOX_BATCH 16
+
+static void philox_batch(uint64_t c[4][PHILOX_BATCH], uint32_t k0, uint32_t k1) {
+    for(int round = 0; round < 10; round++) {
+        for(int j = 0; j < PHILOX_BATCH; j++) {
+            uint64_t p0 = PHILOX_M0 * (uint32_t)c[0][j];
+            uint64_t p1 = PHILOX_M1 * (uint32_t)c[2][j];
+            c[0][j] = (p1 >> 32) ^ c[1][j] ^ k0;
+            c[1][j] = p1 & 0xFFFFFFFFu;
+            c[2][j] = (p0 >> 32) ^ c[3][j] ^ k1;
+            c[3][j] = p0 & 0xFFFFFFFFu;
+        }
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+}
+
+static float philox_to_unit(uint64_t x) {
+    // 24 random bits -> [0, 1); through int32 since u64 -> float does not vectorize
+    return (int32_t)((uint32_t)x >> 8) * (1.0f / 16777216.0f);
+}
+
+static void philox_uniform(uint64_t seed, uint32_t stream, uint64_t offset, int n, float* out) {
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+    uint64_t c[4][PHILOX_BATCH];
+    int n_blocks = (n + 3) / 4;
+    for(int b0 = 0; b0 < n_blocks; b0 += PHILOX_BATCH) {
+        for(int j = 0; j < PHILOX_BATCH; j++) {
+            uint64_t block = offset + b0 + j;
+            c[0][j] = block & 0xFFFFFFFFu;
+            c[1][j] = block >> 32;
+            c[2][j] = stream;
+            c[3][j] = 0;
+        }
+        philox_batch(c, k0, k1);
+        int base = b0 * 4;
+        if(base + 4 * PHILOX_BATCH <= n) {
+            for(int j = 0; j < PHILOX_BATCH; j++) {
+                for(int lane = 0; lane < 4; lane++) {
+                    out[base + j * 4 + lane] = philox_to_unit(c[lane][j]);
+                }
+            }
+            continue;
+        }
+        for(int i = base; i < n; i++) {
+            out[i] = philox_to_unit(c[(i - base) % 4][(i - base) / 4]);
+        }
+    }
+}
+
+void CTEN_KERNEL(_cten_kernels_init)(KernelTable* k) {
+    k->isa = _CTEN_XSTR(CTEN_KERNEL_ISA);
+    k->gemm_ukernel = gemm_ukernel;
+    k->add = vadd;
+    k->sub = vsub;
+    k->mul = vmul;
+    k->div = vdiv;
+    k->relu = vrelu;
+    k->axpy = vaxpy;
+    k->sum = vsum;
+    k->max = vmax;
+    k->dot = vdot;
+    k->conv_row16 = conv_row16;
+    k->philox_uniform = philox_uniform;
+}
@@ -4,92 +4,178 @@
 #include <assert.h>
 #include <math.h>
 #include <stddef.h>
+#include <string.h>
+
+// eval mode: no graph, and the weight's packing is done once instead of on every call
+static Tensor _matmul_prepacked(Tensor input, Tensor weight) {
+    int dim = TensorShape_dim(input.shape);
+    int k = weight.shape[0], n = weight.shape[1];
+    cten_assert_dim("nn_linear() inner dim", input.shape[dim - 1], k);
+    TensorShape shape;
+    memcpy(shape, input.shape, sizeof(TensorShape));
+    shape[dim - 1] = n;
+    Tensor res = Tensor_new(shape, false);
+    PackedWeight* packed = _cten_prepack_acquire(weight);
+    // leading dims of the input fold into the rows
+    int m = input.data->numel / k;
+    _cten_gemm_prepacked(m, n, k, input.data->flex, k, 1, packed->data, res.data->flex, n, false);
+    _cten_prepack_release(packed);
+    _cten_trace_op(TRACE_MATMUL, res, input, weight, 0);
+    return res;
+}
 
 Tensor nn_linear(Tensor input, Tensor weight, Tensor bias) {
-    Tensor tmp = Tensor_matmul(input, weight);
+    CTEN_PROFILE_BEGIN();
+    Tensor tmp;
+    if(cten_is_eval() && TensorShape_dim(input.shape) >= 2 && TensorShape_dim(weight.shape) == 2) {
+        tmp = _matmul_prepacked(input, weight);
+    } else {
+        tmp = Tensor_matmul(input, weight);
+    }
     tmp = Tensor_add(tmp, bias);
+    CTEN_PROFILE_END(
+        tmp.shape,
+        2.0 * input.data->numel * weight.shape[1] + tmp.data->numel,
+        sizeof(float) * (input.data->numel + weight.data->numel + 2 * tmp.data->numel));
     return tmp;
 }
 
 /* nn.relu */
 static Tensor GradFn_relu(Tensor self, int i) {
     Tensor input = self.node->inputs[i];
+    Tensor g = self.node->grad;
     Tensor res = Tensor_new(input.shape, false);
     for(int i = 0; i < input.data->numel; i++) {
-        res.data->flex[i] = input.data->flex[i] > 0 ? 1 : 0;
+        res.data->flex[i] = input.data->flex[i] > 0 ? g.data->flex[i] : 0;
     }
     return res;
 }
 
 Tensor nn_relu(Tensor self) {
+    CTEN_PROFILE_BEGIN();
     bool requires_grad = !cten_is_eval() && self.node != NULL;
     Tensor res = Tensor_new(self.shape, requires_grad);
-    for(int i = 0; i < self.data->numel; i++) {
-        res.data->flex[i] = fmaxf(0, self.data->flex[i]);
-    }
+    _cten_kernels.relu(self.data->numel, self.data->flex, res.data->flex);
 
     if(requires_grad) {
         res.node->grad_fn = GradFn_relu;
+        res.node->name = "nn_relu";
         res.node->inputs[0] = self;
         res.node->n_inputs = 1;
     }
+    _cten_trace_op(TRACE_RELU, res, self, (Tensor){0}, 0);
+    CTEN_PROFILE_END(res.shape, res.data->numel, 2 * sizeof(float) * res.data->numel);
     return res;
 }
 
 /* nn.softmax */
 static Tensor GradFn_softmax(Tensor self, int i) {
+    // dx = y * (g - sum(g * y)) along the last dim, without forming the Jacobian
     Tensor input = self.node->inputs[i];
+    Tensor g = self.node->grad;
     Tensor res = Tensor_new(input.shape, false);
-    for(int j = 0; j < input.data->numel; j++) {
-        float softmax_j = self.data->flex[j];
-        for(int k = 0; k < input.data->numel; k++) {
-            float softmax_k = self.data->flex[k];
-            float delta_jk = (j == k) ? 1.0f : 0.0f;
-            res.data->flex[j * input.data->numel + k] = softmax_j * (delta_jk - softmax_k);
+    int last_dim_size = self.shape[TensorShape_dim(self.shape) - 1];
+    int outer_size = self.data->numel / last_dim_size;
+    for(int outer = 0; outer < outer_size; outer++) {
+        const float* y = self.data->flex + outer * last_dim_size;
+        const float* g_ = g.data->flex + outer * last_dim_size;
+        float* r = res.data->flex + outer * last_dim_size;
+        float dot = 0;
+        for(int d = 0; d < last_dim_size; d++) {
+            dot += g_[d] * y[d];
+        }
+        for(int d = 0; d < last_dim_size; d++) {
+            r[d] = y[d] * (g_[d] - dot);
         }
     }
     return res;
 }
 
-Tensor nn_softmax(Tensor self) {
-    bool requires_grad = !cten_is_eval() && self.node != NULL;
-    Tensor res = Tensor_new(self.shape, requires_grad);
-    int self_dim = TensorShape_dim(self.shape);
-    assert(self_dim > 0);
-    int last_dim_size = self.shape[self_dim - 1];
-    int outer_size = self.data->numel / last_dim_size;
+// each row is normalized whole by one task, so the split never changes its sum
+#define SOFTMAX_TASK_NUMEL (1 << 14)
 
-    for(int outer = 0; outer < outer_size; outer++) {
+typedef struct SoftmaxCtx {
+    const float* x;
+    float* y;
+    int n_rows, dim;
+    int rows_per_task;
+} SoftmaxCtx;
+
+static void _softmax_rows(void* ctx, int task) {
+    const SoftmaxCtx* c = ctx;
+    int r0 = task * c->rows_per_task;
+    int r1 = r0 + c->rows_per_task < c->n_rows ? r0 + c->rows_per_task : c->n_rows;
+    for(int outer = r0; outer < r1; outer++) {
+        const float* x = c->x + (size_t)outer * c->dim;
+        float* y = c->y + (size_t)outer * c->dim;
         float max_val = -INFINITY;
         float sum = 0;
 
-        for(int d = 0; d < last_dim_size; d++) {
-            int index = outer * last_dim_size + d;
-            max_val = fmaxf(max_val, self.data->flex[index]);
+        for(int d = 0; d < c->dim; d++) {
+            max_val = fmaxf(max_val, x[d]);
         }
 
-        for(int d = 0; d < last_dim_size; d++) {
-            int index = outer * last_dim_size + d;
-            res.data->flex[index] = expf(self.data->flex[index] - max_val);
-            sum += res.data->flex[index];
+        for(int d = 0; d < c->dim; d++) {
+            y[d] = expf(x[d] - max_val);
+            sum += y[d];
         }
 
-        for(int d = 0; d < last_dim_size; d++) {
-            int index = outer * last_dim_size + d;
-            res.data->flex[index] /= sum;
+        for(int d = 0; d < c->dim; d++) {
+            y[d] /= sum;
         }
     }
+}
+
+Tensor nn_softmax(Tensor self) {
+    CTEN_PROFILE_BEGIN();
+    bool requires_grad = !cten_is_eval() && self.node != NULL;
+    Tensor res = Tensor_new(self.shape, requires_grad);
+    int self_dim = TensorShape_dim(self.shape);
+    assert(self_dim > 0);
+    int last_dim_size = self.shape[self_dim - 1];
+    int outer_size = self.data->numel / last_dim_size;
+
+    int rows_per_task = SOFTMAX_TASK_NUMEL / last_dim_size;
+    SoftmaxCtx c = {self.data->flex,
+                    res.data->flex,
+                    outer_size,
+                    last_dim_size,
+                    rows_per_task > 0 ? rows_per_task : 1};
+    _cten_parallel_for((outer_size + c.rows_per_task - 1) / c.rows_per_task, _softmax_rows, &c);
 
     if(requires_grad) {
         res.node->grad_fn = GradFn_softmax;
+        res.node->name = "nn_softmax";
         res.node->inputs[0] = self;
         res.node->n_inputs = 1;
     }
+    _cten_trace_op(TRACE_SOFTMAX, res, self, (Tensor){0}, 0);
+    CTEN_PROFILE_END(res.shape, 4 * res.data->numel, 3 * sizeof(float) * res.data->numel);
     return res;
 }
 
 /* nn.cross_entropy */
+static Tensor GradFn_crossentropy(Tensor self, int i) {
+    // loss_i = -sum_j(t_ij * log(p_ij)); dt_ij = -g_i * log(p_ij); dp_ij = -g_i * t_ij / p_ij
+    Tensor y_true = self.node->inputs[0];
+    Tensor y_pred = self.node->inputs[1];
+    Tensor g = self.node->grad;
+    int n_samples = y_true.shape[0];
+    int n_classes = y_true.shape[1];
+    Tensor res = Tensor_new(y_true.shape, false);
+    for(int s = 0; s < n_samples; s++) {
+        for(int c = 0; c < n_classes; c++) {
+            int index = s * n_classes + c;
+            float d = i == 0 ? logf(y_pred.data->flex[index])
+                             : y_true.data->flex[index] / y_pred.data->flex[index];
+            res.data->flex[index] = -g.data->flex[s] * d;
+        }
+    }
+    return res;
+}
+
 Tensor nn_crossentropy(Tensor y_true, Tensor y_pred) {
+    CTEN_PROFILE_BEGIN();
     // y_true: [None, n_classes]
     // y_pred: [None, n_classes]
     assert(TensorShape_dim(y_true.shape) == 2);
@@ -110,5 +196,55 @@ Tensor nn_crossentropy(Tensor y_true, Tensor y_pred) {
         }
         res.data->flex[i] = -loss;
     }
+    if(requires_grad) {
+        res.node->grad_fn = GradFn_crossentropy;
+        res.node->name = "nn_crossentropy";
+        res.node->inputs[0] = y_true;
+        res.node->inputs[1] = y_pred;
+        res.node->n_inputs = 2;
+    }
+    CTEN_PROFILE_END(y_pred.shape, 2 * y_pred.data->numel, 2 * sizeof(float) * y_pred.data->numel);
     return Tensor_mean(res);
+}
+
+/* nn.embedding */
+typedef struct EmbeddingCtx {
+    int n_indices;
+    int indices[];
+} EmbeddingCtx;
+
+static Tensor GradFn_embedding(Tensor self, int i) {
+    // rows of g go straight into the weight's sparse gradient; no (vocab, dim) tensor is formed
+    const EmbeddingCtx* ctx = self.node->ctx;
+    _cten_accumulate_sparse_grad(self.node->inputs[i], self.node->grad, ctx->indices);
+    return (Tensor){0};
+}
+
+Tensor nn_embedding(Tensor weight, const int* indices, int n_indices) {
+    CTEN_PROFILE_BEGIN();
+    cten_assert_dim("nn_embedding() weight dim", TensorShape_dim(weight.shape), 2);
+    cten_assert(n_indices > 0, "nn_embedding(): no indices");
+    int vocab = weight.shape[0], dim = weight.shape[1];
+    bool requires_grad = !cten_is_eval() && weight.node != NULL;
+    Tensor res = Tensor_new((TensorShape){n_indices, dim}, requires_grad);
+    for(int i = 0; i < n_indices; i++) {
+        cten_assert(indices[i] >= 0 && indices[i] < vocab,
+                    "nn_embedding(): index %d out of range [0, %d)",
+                    indices[i],
+                    vocab);
+        memcpy(res.data->flex + i * dim, weight.data->flex + indices[i] * dim, sizeof(float) * dim);
+    }
+
+    if(requires_grad) {
+        EmbeddingCtx* ctx = _cten_malloc(sizeof(EmbeddingCtx) + sizeof(int) * n_indices);
+        ctx->n_indices = n_indices;
+        memcpy(ctx->indices, indices, sizeof(int) * n_indices);
+        res.node->grad_fn = GradFn_embedding;
+        res.node->name = "nn_embedding";
+        res.node->ctx = ctx;
+        res.node->inputs[0] = weight;
+        res.node->n_inputs = 1;
+    }
+    CTEN_PROFILE_END(res.shape, 0, 2 * sizeof(float) * res.data->numel);
+    return res;
 }
\ No newline at end of file
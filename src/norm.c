@@ -0,0 +1,274 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <math.h>
+#include <stddef.h>
+
+// independent Welford accumulators per pass, merged at the end so the update vectorizes
+#define WELFORD_LANES 16
+
+typedef struct Welford {
+    float count, mean, m2;
+} Welford;
+
+typedef struct NormCtx {
+    Tensor weight;  // (Tensor){0} when the layer has no affine weight
+    float* mean;
+    float* rstd;
+} NormCtx;
+
+static void _welford_merge(Welford* self, Welford other) {
+    if(other.count == 0) return;
+    float count = self->count + other.count;
+    float delta = other.mean - self->mean;
+    self->mean += delta * other.count / count;
+    self->m2 += other.m2 + delta * delta * self->count * other.count / count;
+    self->count = count;
+}
+
+static void _welford_push(Welford* self, int n, const float* x) {
+    float mean[WELFORD_LANES] = {0};
+    float m2[WELFORD_LANES] = {0};
+    int i = 0, k = 0;
+    for(; i + WELFORD_LANES <= n; i += WELFORD_LANES) {
+        float inv = 1.0f / ++k;
+        for(int j = 0; j < WELFORD_LANES; j++) {
+            float delta = x[i + j] - mean[j];
+            mean[j] += delta * inv;
+            m2[j] += delta * (x[i + j] - mean[j]);
+        }
+    }
+    for(int j = 0; j < WELFORD_LANES && k > 0; j++) {
+        _welford_merge(self, (Welford){k, mean[j], m2[j]});
+    }
+    for(; i < n; i++) {
+        _welford_merge(self, (Welford){1, x[i], 0});
+    }
+}
+
+static NormCtx* _norm_ctx(Tensor weight, int n_groups) {
+    NormCtx* ctx = _cten_malloc(sizeof(NormCtx));
+    ctx->weight = weight;
+    ctx->mean = _cten_malloc(sizeof(float) * n_groups);
+    ctx->rstd = _cten_malloc(sizeof(float) * n_groups);
+    return ctx;
+}
+
+static void _norm_set_inputs(Tensor res, Tensor input, Tensor weight, Tensor bias) {
+    res.node->inputs[0] = input;
+    res.node->n_inputs = 1;
+    if(weight.data != NULL) res.node->inputs[res.node->n_inputs++] = weight;
+    if(bias.data != NULL) res.node->inputs[res.node->n_inputs++] = bias;
+}
+
+/* nn.layernorm */
+static Tensor GradFn_layernorm(Tensor self, int i) {
+    Tensor input = self.node->inputs[0];
+    Tensor g = self.node->grad;
+    const NormCtx* ctx = self.node->ctx;
+    const float* w = ctx->weight.data != NULL ? ctx->weight.data->flex : NULL;
+    int D = input.shape[TensorShape_dim(input.shape) - 1];
+    int rows = input.data->numel / D;
+
+    if(i == 0) {
+        // dx = rstd * (dxhat - mean(dxhat) - xhat * mean(dxhat * xhat)), dxhat = g * w
+        Tensor res = Tensor_new(input.shape, false);
+        for(int r = 0; r < rows; r++) {
+            const float* x = input.data->flex + r * D;
+            const float* g_ = g.data->flex + r * D;
+            float* dx = res.data->flex + r * D;
+            float mean = ctx->mean[r], rstd = ctx->rstd[r];
+            float sum_dxhat = 0, sum_dxhat_xhat = 0;
+            for(int d = 0; d < D; d++) {
+                float dxhat = w != NULL ? g_[d] * w[d] : g_[d];
+                sum_dxhat += dxhat;
+                sum_dxhat_xhat += dxhat * (x[d] - mean) * rstd;
+            }
+            sum_dxhat /= D;
+            sum_dxhat_xhat /= D;
+            for(int d = 0; d < D; d++) {
+                float dxhat = w != NULL ? g_[d] * w[d] : g_[d];
+                float xhat = (x[d] - mean) * rstd;
+                dx[d] = rstd * (dxhat - sum_dxhat - xhat * sum_dxhat_xhat);
+            }
+        }
+        return res;
+    }
+
+    // dweight = sum over rows of g * xhat, dbias = sum over rows of g
+    Tensor param = self.node->inputs[i];
+    bool is_weight = param.data == ctx->weight.data;
+    Tensor res = Tensor_zeros(param.shape, false);
+    for(int r = 0; r < rows; r++) {
+        const float* x = input.data->flex + r * D;
+        const float* g_ = g.data->flex + r * D;
+        if(!is_weight) {
+            _cten_kernels.add(D, res.data->flex, g_, res.data->flex);
+            continue;
+        }
+        for(int d = 0; d < D; d++) {
+            res.data->flex[d] += g_[d] * (x[d] - ctx->mean[r]) * ctx->rstd[r];
+        }
+    }
+    return res;
+}
+
+Tensor nn_layernorm(Tensor input, Tensor weight, Tensor bias, float eps) {
+    CTEN_PROFILE_BEGIN();
+    int dim = TensorShape_dim(input.shape);
+    cten_assert(dim > 0, "nn_layernorm(): input must have at least one dim");
+    int D = input.shape[dim - 1];
+    int rows = input.data->numel / D;
+    if(weight.data != NULL) cten_assert_dim("nn_layernorm() weight numel", weight.data->numel, D);
+    if(bias.data != NULL) cten_assert_dim("nn_layernorm() bias numel", bias.data->numel, D);
+
+    bool requires_grad =
+        !cten_is_eval() && (input.node != NULL || weight.node != NULL || bias.node != NULL);
+    Tensor res = Tensor_new(input.shape, requires_grad);
+    NormCtx* ctx = requires_grad ? _norm_ctx(weight, rows) : NULL;
+
+    for(int r = 0; r < rows; r++) {
+        const float* x = input.data->flex + r * D;
+        float* y = res.data->flex + r * D;
+        Welford stats = {0};
+        _welford_push(&stats, D, x);
+        float rstd = 1.0f / sqrtf(stats.m2 / D + eps);
+        for(int d = 0; d < D; d++) {
+            float v = (x[d] - stats.mean) * rstd;
+            if(weight.data != NULL) v *= weight.data->flex[d];
+            if(bias.data != NULL) v += bias.data->flex[d];
+            y[d] = v;
+        }
+        if(ctx != NULL) {
+            ctx->mean[r] = stats.mean;
+            ctx->rstd[r] = rstd;
+        }
+    }
+
+    if(requires_grad) {
+        res.node->grad_fn = GradFn_layernorm;
+        res.node->name = "nn_layernorm";
+        res.node->ctx = ctx;
+        _norm_set_inputs(res, input, weight, bias);
+    }
+    CTEN_PROFILE_END(res.shape, 8.0 * res.data->numel, 2 * sizeof(float) * res.data->numel);
+    return res;
+}
+
+/* nn.batchnorm */
+static Tensor GradFn_batchnorm(Tensor self, int i) {
+    Tensor input = self.node->inputs[0];
+    Tensor g = self.node->grad;
+    const NormCtx* ctx = self.node->ctx;
+    int N = input.shape[0], C = input.shape[1];
+    int inner = input.data->numel / (N * C);
+    int M = N * inner;
+
+    Tensor param = self.node->inputs[i];
+    bool is_weight = i != 0 && param.data == ctx->weight.data;
+    Tensor res = i == 0 ? Tensor_new(input.shape, false) : Tensor_new(param.shape, false);
+    for(int c = 0; c < C; c++) {
+        float mean = ctx->mean[c], rstd = ctx->rstd[c];
+        float sum_g = 0, sum_g_xhat = 0;
+        for(int n = 0; n < N; n++) {
+            const float* x = input.data->flex + (n * C + c) * inner;
+            const float* g_ = g.data->flex + (n * C + c) * inner;
+            for(int j = 0; j < inner; j++) {
+                sum_g += g_[j];
+                sum_g_xhat += g_[j] * (x[j] - mean) * rstd;
+            }
+        }
+        if(i != 0) {
+            res.data->flex[c] = is_weight ? sum_g_xhat : sum_g;
+            continue;
+        }
+        // dx = w * rstd * (g - mean(g) - xhat * mean(g * xhat))
+        float w = ctx->weight.data != NULL ? ctx->weight.data->flex[c] : 1.0f;
+        sum_g /= M;
+        sum_g_xhat /= M;
+        for(int n = 0; n < N; n++) {
+            const float* x = input.data->flex + (n * C + c) * inner;
+            const float* g_ = g.data->flex + (n * C + c) * inner;
+            float* dx = res.data->flex + (n * C + c) * inner;
+            for(int j = 0; j < inner; j++) {
+                float xhat = (x[j] - mean) * rstd;
+                dx[j] = w * rstd * (g_[j] - sum_g - xhat * sum_g_xhat);
+            }
+        }
+    }
+    return res;
+}
+
+Tensor nn_batchnorm(Tensor input,
+                    Tensor weight,
+                    Tensor bias,
+                    Tensor running_mean,
+                    Tensor running_var,
+                    float momentum,
+                    float eps) {
+    CTEN_PROFILE_BEGIN();
+    int dim = TensorShape_dim(input.shape);
+    cten_assert(dim >= 2, "nn_batchnorm(): input must be (N, C, ...)");
+    int N = input.shape[0], C = input.shape[1];
+    int inner = input.data->numel / (N * C);
+    int M = N * inner;
+    if(weight.data != NULL) cten_assert_dim("nn_batchnorm() weight numel", weight.data->numel, C);
+    if(bias.data != NULL) cten_assert_dim("nn_batchnorm() bias numel", bias.data->numel, C);
+    cten_assert((running_mean.data == NULL) == (running_var.data == NULL),
+                "nn_batchnorm(): running_mean and running_var must be given together");
+    if(running_mean.data != NULL) {
+        cten_assert_dim("nn_batchnorm() running_mean numel", running_mean.data->numel, C);
+        cten_assert_dim("nn_batchnorm() running_var numel", running_var.data->numel, C);
+    }
+
+    // eval mode normalizes with the running statistics when they are tracked
+    bool use_running = cten_is_eval() && running_mean.data != NULL;
+    bool requires_grad =
+        !cten_is_eval() && (input.node != NULL || weight.node != NULL || bias.node != NULL);
+    Tensor res = Tensor_new(input.shape, requires_grad);
+    NormCtx* ctx = requires_grad ? _norm_ctx(weight, C) : NULL;
+
+    for(int c = 0; c < C; c++) {
+        float mean, var;
+        if(use_running) {
+            mean = running_mean.data->flex[c];
+            var = running_var.data->flex[c];
+        } else {
+            Welford stats = {0};
+            for(int n = 0; n < N; n++) {
+                _welford_push(&stats, inner, input.data->flex + (n * C + c) * inner);
+            }
+            mean = stats.mean;
+            var = stats.m2 / M;
+            if(!cten_is_eval() && running_mean.data != NULL) {
+                // running_var tracks the unbiased estimate
+                float unbiased = M > 1 ? stats.m2 / (M - 1) : var;
+                running_mean.data->flex[c] += momentum * (mean - running_mean.data->flex[c]);
+                running_var.data->flex[c] += momentum * (unbiased - running_var.data->flex[c]);
+            }
+        }
+        float rstd = 1.0f / sqrtf(var + eps);
+        float scale = weight.data != NULL ? weight.data->flex[c] * rstd : rstd;
+        float shift = (bias.data != NULL ? bias.data->flex[c] : 0) - mean * scale;
+        for(int n = 0; n < N; n++) {
+            const float* x = input.data->flex + (n * C + c) * inner;
+            float* y = res.data->flex + (n * C + c) * inner;
+            for(int j = 0; j < inner; j++) {
+                y[j] = x[j] * scale + shift;
+            }
+        }
+        if(ctx != NULL) {
+            ctx->mean[c] = mean;
+            ctx->rstd[c] = rstd;
+        }
+    }
+
+    if(requires_grad) {
+        res.node->grad_fn = GradFn_batchnorm;
+        res.node->name = "nn_batchnorm";
+        res.node->ctx = ctx;
+        _norm_set_inputs(res, input, weight, bias);
+    }
+    CTEN_PROFILE_END(res.shape, 6.0 * res.data->numel, 2 * sizeof(float) * res.data->numel);
+    return res;
+}
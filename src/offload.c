@@ -0,0 +1,337 @@
+#define _GNU_SOURCE
+
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Blocks allocated in offload mode are shared mappings of an unlinked spill file, so the kernel can
+ * move their pages between RAM and disk while every pointer into them stays valid; dropping a page
+ * loses nothing and a late access just faults it back in. Once a block falls OFFLOAD_RESIDENT
+ * blocks behind the newest one, a background thread writes it back and drops it from the mapping
+ * and the page cache, while the forward goes on. Backward walks the graph roughly in reverse
+ * allocation order, so touching block i reads blocks i-1 .. i-OFFLOAD_PREFETCH back ahead of use.
+ * Freed blocks have their file range punched out, so stale activations are never written back,
+ * and keep their mapping for the next block of the same length; past OFFLOAD_MAX_CACHED they are
+ * unmapped and their range is handed to the next new block, so the file stops growing once a step
+ * has run. */
+
+#define OFFLOAD_RESIDENT 2
+#define OFFLOAD_PREFETCH 4
+#define OFFLOAD_MAX_CACHED 64
+
+enum { SPILL_RESIDENT, SPILL_QUEUED, SPILL_EVICTING, SPILL_EVICTED };
+
+typedef struct SpillBlock {
+    char* base;
+    size_t length;
+    off_t offset;
+    int state;
+} SpillBlock;
+
+typedef struct SpillRange {
+    off_t offset;
+    size_t length;
+} SpillRange;
+
+struct Offload {
+    int fd;
+    size_t min_bytes;
+    off_t file_size;
+    c11_vector /*SpillBlock* */ blocks;  // live, in allocation order
+    c11_vector /*SpillBlock* */ cached;  // freed, mapping kept for reuse
+    c11_vector /*SpillBlock* */ retired; // freed and unmapped; queue entries may still point here
+    c11_vector /*SpillRange*/ holes;     // punched file ranges no mapping uses, by offset
+    int cursor;                          // index of the block touched last
+
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    c11_vector /*SpillBlock* */ queue;
+    int queue_head;
+    bool started;
+    bool stop;
+    pthread_t evictor;
+    OffloadStats stats;
+};
+
+static int _open_spill_file(const char* dir) {
+    int fd;
+#ifdef O_TMPFILE
+    fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if(fd >= 0) return fd;
+#endif
+    char path[4096];
+    if(snprintf(path, sizeof(path), "%s/cten-spill-XXXXXX", dir) >= (int)sizeof(path)) return -1;
+    fd = mkstemp(path);
+    // nothing is left behind however the process ends
+    if(fd >= 0) unlink(path);
+    return fd;
+}
+
+Offload* _cten_offload_new(const char* dir, size_t min_bytes) {
+    int fd = _open_spill_file(dir);
+    if(fd < 0) return NULL;
+    Offload* self = calloc(1, sizeof(Offload));
+    cten_assert(self != NULL, "cten_offload_config(): out of memory");
+    self->fd = fd;
+    self->min_bytes = min_bytes;
+    c11_vector__ctor(&self->blocks, sizeof(SpillBlock*));
+    c11_vector__ctor(&self->cached, sizeof(SpillBlock*));
+    c11_vector__ctor(&self->retired, sizeof(SpillBlock*));
+    c11_vector__ctor(&self->holes, sizeof(SpillRange));
+    c11_vector__ctor(&self->queue, sizeof(SpillBlock*));
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->cv, NULL);
+    return self;
+}
+
+void _cten_offload_delete(Offload* self) {
+    if(self == NULL) return;
+    if(self->started) {
+        pthread_mutex_lock(&self->lock);
+        self->stop = true;
+        pthread_cond_broadcast(&self->cv);
+        pthread_mutex_unlock(&self->lock);
+        pthread_join(self->evictor, NULL);
+    }
+    // the pool has released every block by now; what is left is the reuse cache
+    assert(self->blocks.length == 0);
+    c11__foreach(SpillBlock*, &self->cached, it) {
+        munmap((*it)->base, (*it)->length);
+        free(*it);
+    }
+    c11__foreach(SpillBlock*, &self->retired, it) {
+        free(*it);
+    }
+    c11_vector__dtor(&self->blocks);
+    c11_vector__dtor(&self->cached);
+    c11_vector__dtor(&self->retired);
+    c11_vector__dtor(&self->holes);
+    c11_vector__dtor(&self->queue);
+    pthread_cond_destroy(&self->cv);
+    pthread_mutex_destroy(&self->lock);
+    close(self->fd);
+    free(self);
+}
+
+size_t _cten_offload_min_bytes(const Offload* self) { return self->min_bytes; }
+
+// called with the lock held: once the queue is empty nothing refers to retired blocks any more
+static void _free_retired_locked(Offload* self) {
+    if(self->queue_head != self->queue.length) return;
+    c11__foreach(SpillBlock*, &self->retired, it) {
+        free(*it);
+    }
+    c11_vector__clear(&self->retired);
+}
+
+static void* _evictor_main(void* arg) {
+    Offload* self = arg;
+    pthread_mutex_lock(&self->lock);
+    while(true) {
+        _free_retired_locked(self);
+        while(!self->stop && self->queue_head == self->queue.length) {
+            pthread_cond_wait(&self->cv, &self->lock);
+        }
+        if(self->stop) break;
+        SpillBlock* b = c11__getitem(SpillBlock*, &self->queue, self->queue_head++);
+        if(self->queue_head == self->queue.length) {
+            c11_vector__clear(&self->queue);
+            self->queue_head = 0;
+        }
+        // touched by backward or freed since it was queued
+        if(b->state != SPILL_QUEUED) continue;
+        b->state = SPILL_EVICTING;
+        pthread_mutex_unlock(&self->lock);
+
+        sync_file_range(self->fd,
+                        b->offset,
+                        b->length,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                            SYNC_FILE_RANGE_WAIT_AFTER);
+        // on a shared mapping this only unmaps; the clean page cache copy goes next
+        madvise(b->base, b->length, MADV_DONTNEED);
+        posix_fadvise(self->fd, b->offset, b->length, POSIX_FADV_DONTNEED);
+
+        pthread_mutex_lock(&self->lock);
+        b->state = SPILL_EVICTED;
+        self->stats.evicted_bytes += b->length;
+        pthread_cond_broadcast(&self->cv);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return NULL;
+}
+
+// called with the lock held
+static void _queue_locked(Offload* self, SpillBlock* b) {
+    if(b->state != SPILL_RESIDENT) return;
+    if(!self->started) {
+        self->started = pthread_create(&self->evictor, NULL, _evictor_main, self) == 0;
+        if(!self->started) return;  // no thread, no eviction: blocks just stay in RAM
+    }
+    b->state = SPILL_QUEUED;
+    c11_vector__push(SpillBlock*, &self->queue, b);
+    pthread_cond_signal(&self->cv);
+}
+
+// called with the lock held; merges r with the holes it touches
+static void _add_hole_locked(Offload* self, SpillRange r) {
+    int i = 0;
+    while(i < self->holes.length && c11__getitem(SpillRange, &self->holes, i).offset < r.offset) {
+        i++;
+    }
+    if(i < self->holes.length) {
+        SpillRange next = c11__getitem(SpillRange, &self->holes, i);
+        if(r.offset + (off_t)r.length == next.offset) {
+            r.length += next.length;
+            c11_vector__erase(SpillRange, &self->holes, i);
+        }
+    }
+    if(i > 0) {
+        SpillRange* prev = c11__at(SpillRange, &self->holes, i - 1);
+        if(prev->offset + (off_t)prev->length == r.offset) {
+            prev->length += r.length;
+            return;
+        }
+    }
+    c11_vector__insert(SpillRange, &self->holes, i, r);
+}
+
+// called with the lock held; the first hole of at least length bytes, or the end of the file
+static off_t _take_range_locked(Offload* self, size_t length) {
+    for(int i = 0; i < self->holes.length; i++) {
+        SpillRange* h = c11__at(SpillRange, &self->holes, i);
+        if(h->length < length) continue;
+        off_t offset = h->offset;
+        h->offset += length;
+        h->length -= length;
+        if(h->length == 0) c11_vector__erase(SpillRange, &self->holes, i);
+        return offset;
+    }
+    return self->file_size;
+}
+
+static SpillBlock* _new_block(Offload* self, size_t length) {
+    off_t offset = _take_range_locked(self, length);
+    bool grows = offset + (off_t)length > self->file_size;
+    // reserve the disk blocks up front: running out of space later would SIGBUS on access
+    int err = posix_fallocate(self->fd, offset, length);
+    if(err == EINVAL || err == EOPNOTSUPP) {
+        err = !grows || ftruncate(self->fd, offset + length) == 0 ? 0 : errno;
+    }
+    void* base = err == 0
+                     ? mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, offset)
+                     : MAP_FAILED;
+    if(base == MAP_FAILED) {
+        if(!grows) _add_hole_locked(self, (SpillRange){offset, length});
+        return NULL;
+    }
+    SpillBlock* b = malloc(sizeof(SpillBlock));
+    cten_assert(b != NULL, "cten: out of memory");
+    *b = (SpillBlock){base, length, offset, SPILL_RESIDENT};
+    if(grows) self->file_size = offset + length;
+    return b;
+}
+
+void* _cten_offload_map(Offload* self, size_t length) {
+    pthread_mutex_lock(&self->lock);
+    SpillBlock* b = NULL;
+    for(int i = self->cached.length - 1; i >= 0; i--) {
+        SpillBlock* it = c11__getitem(SpillBlock*, &self->cached, i);
+        if(it->length == length) {
+            b = it;
+            c11_vector__erase(SpillBlock*, &self->cached, i);
+            break;
+        }
+    }
+    if(b == NULL) b = _new_block(self, length);
+    if(b == NULL) {
+        pthread_mutex_unlock(&self->lock);
+        return NULL;
+    }
+    b->state = SPILL_RESIDENT;
+    c11_vector__push(SpillBlock*, &self->blocks, b);
+    self->stats.spilled_bytes += length;
+    int n = self->blocks.length;
+    if(n > OFFLOAD_RESIDENT) {
+        _queue_locked(self, c11__getitem(SpillBlock*, &self->blocks, n - 1 - OFFLOAD_RESIDENT));
+    }
+    pthread_mutex_unlock(&self->lock);
+    return b->base;
+}
+
+// the live block containing ptr, searched outwards from the last one found
+static int _find_locked(Offload* self, const void* ptr) {
+    int n = self->blocks.length;
+    int start = self->cursor < n ? self->cursor : n - 1;
+    for(int d = 0; d < n; d++) {
+        for(int sign = -1; sign <= 1; sign += 2) {
+            int i = start + sign * d;
+            if(i < 0 || i >= n || (d == 0 && sign > 0)) continue;
+            SpillBlock* b = c11__getitem(SpillBlock*, &self->blocks, i);
+            if((const char*)ptr >= b->base && (const char*)ptr < b->base + b->length) return i;
+        }
+    }
+    return -1;
+}
+
+void _cten_offload_unmap(Offload* self, void* base) {
+    pthread_mutex_lock(&self->lock);
+    int i = _find_locked(self, base);
+    assert(i >= 0);
+    SpillBlock* b = c11__getitem(SpillBlock*, &self->blocks, i);
+    while(b->state == SPILL_EVICTING) {
+        pthread_cond_wait(&self->cv, &self->lock);
+    }
+    b->state = SPILL_RESIDENT;
+    c11_vector__erase(SpillBlock*, &self->blocks, i);
+    if(self->cursor >= self->blocks.length) self->cursor = 0;
+    // drops the pages, dirty or not, and their disk blocks; the range reads as zeros until reused
+    fallocate(self->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, b->offset, b->length);
+    if(self->cached.length < OFFLOAD_MAX_CACHED) {
+        c11_vector__push(SpillBlock*, &self->cached, b);
+    } else {
+        munmap(b->base, b->length);
+        _add_hole_locked(self, (SpillRange){b->offset, b->length});
+        c11_vector__push(SpillBlock*, &self->retired, b);
+        _free_retired_locked(self);
+    }
+    pthread_mutex_unlock(&self->lock);
+}
+
+void _cten_offload_touch(Offload* self, const void* ptr) {
+    pthread_mutex_lock(&self->lock);
+    int i = _find_locked(self, ptr);
+    if(i < 0) {
+        pthread_mutex_unlock(&self->lock);
+        return;
+    }
+    self->cursor = i;
+    for(int j = i; j >= 0 && j >= i - OFFLOAD_PREFETCH; j--) {
+        SpillBlock* b = c11__getitem(SpillBlock*, &self->blocks, j);
+        if(b->state == SPILL_QUEUED) {
+            b->state = SPILL_RESIDENT;
+        } else if(b->state == SPILL_EVICTED) {
+            // starts readahead into the page cache and returns; the access faults it in cheaply
+            madvise(b->base, b->length, MADV_WILLNEED);
+            b->state = SPILL_RESIDENT;
+            self->stats.prefetched_bytes += b->length;
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+}
+
+OffloadStats _cten_offload_stats(Offload* self) {
+    pthread_mutex_lock(&self->lock);
+    OffloadStats stats = self->stats;
+    pthread_mutex_unlock(&self->lock);
+    return stats;
+}
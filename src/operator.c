@@ -7,133 +7,149 @@
 #include <string.h>
 
 static Tensor GradFn_add(Tensor self, int i) {
-    // f(x, y) = x + y; f'(x) = 1; f'(y) = 1
-    Tensor input = self.node->inputs[i];
-    return Tensor_ones(input.shape, false);
+    // f(x, y) = x + y; dx = g; dy = g
+    return self.node->grad;
 }
 
 static Tensor GradFn_mul(Tensor self, int i) {
-    // f(x, y) = x * y; f'(x) = y; f'(y) = x
-    return Tensor_detach(self.node->inputs[1 - i]);
+    // f(x, y) = x * y; dx = g * y; dy = g * x
+    Tensor other = self.node->inputs[1 - i];
+    Tensor g = self.node->grad;
+    Tensor res = Tensor_new(other.shape, false);
+    for(int j = 0; j < res.data->numel; j++) {
+        res.data->flex[j] = g.data->flex[j] * other.data->flex[j];
+    }
+    return res;
 }
 
 Tensor Tensor_add(Tensor self, Tensor other) {
+    CTEN_PROFILE_BEGIN();
+    Tensor a = self, b = other;
     if(!cten_elemwise_broadcast(&self, &other)) {
         cten_assert_shape("Tensor_add() cannot broadcast", self.shape, other.shape);
     }
     bool requires_grad = !cten_is_eval() && (self.node != NULL || other.node != NULL);
     Tensor res = Tensor_new(self.shape, requires_grad);
-    for(int i = 0; i < self.data->numel; i++) {
-        res.data->flex[i] = self.data->flex[i] + other.data->flex[i];
-    }
+    _cten_kernels.add(res.data->numel, self.data->flex, other.data->flex, res.data->flex);
     if(requires_grad) {
         res.node->grad_fn = GradFn_add;
+        res.node->name = "Tensor_add";
         res.node->inputs[0] = self;
         res.node->inputs[1] = other;
         res.node->n_inputs = 2;
     }
+    _cten_trace_op(TRACE_ADD, res, a, b, 0);
+    CTEN_PROFILE_END(res.shape, res.data->numel, 3 * sizeof(float) * res.data->numel);
     return res;
 }
 
 static Tensor GradFn_sub(Tensor self, int i) {
-    // f(x, y) = x - y; f'(x) = 1; f'(y) = -1
-    Tensor input = self.node->inputs[i];
-    Tensor result = Tensor_ones(input.shape, false);
-    if (i == 1) {
-        // Negate all elements for the second input
-        for(int j = 0; j < result.data->numel; j++) {
-            result.data->flex[j] = -result.data->flex[j];
-        }
+    // f(x, y) = x - y; dx = g; dy = -g
+    Tensor g = self.node->grad;
+    if(i == 0) return g;
+    Tensor res = Tensor_new(g.shape, false);
+    for(int j = 0; j < res.data->numel; j++) {
+        res.data->flex[j] = -g.data->flex[j];
     }
-    return result;
+    return res;
 }
 
 Tensor Tensor_sub(Tensor self, Tensor other) {
+    CTEN_PROFILE_BEGIN();
+    Tensor a = self, b = other;
     if(!cten_elemwise_broadcast(&self, &other)) {
         cten_assert_shape("Tensor_sub() cannot broadcast", self.shape, other.shape);
     }
     bool requires_grad = !cten_is_eval() && (self.node != NULL || other.node != NULL);
     Tensor res = Tensor_new(self.shape, requires_grad);
-    for(int i = 0; i < self.data->numel; i++) {
-        res.data->flex[i] = self.data->flex[i] - other.data->flex[i];
-    }
+    _cten_kernels.sub(res.data->numel, self.data->flex, other.data->flex, res.data->flex);
     if(requires_grad) {
         res.node->grad_fn = GradFn_sub;
+        res.node->name = "Tensor_sub";
         res.node->inputs[0] = self;
         res.node->inputs[1] = other;
         res.node->n_inputs = 2;
     }
+    _cten_trace_op(TRACE_SUB, res, a, b, 0);
+    CTEN_PROFILE_END(res.shape, res.data->numel, 3 * sizeof(float) * res.data->numel);
     return res;
 }
 
 Tensor Tensor_mul(Tensor self, Tensor other) {
+    CTEN_PROFILE_BEGIN();
+    Tensor a = self, b = other;
+    if(!cten_elemwise_broadcast(&self, &other)) {
+        cten_assert_shape("Tensor_mul() cannot broadcast", self.shape, other.shape);
+    }
     bool requires_grad = !cten_is_eval() && (self.node != NULL || other.node != NULL);
     Tensor res = Tensor_new(self.shape, requires_grad);
-    for(int i = 0; i < self.data->numel; i++) {
-        res.data->flex[i] = self.data->flex[i] * other.data->flex[i];
-    }
+    _cten_kernels.mul(res.data->numel, self.data->flex, other.data->flex, res.data->flex);
     if(requires_grad) {
         res.node->grad_fn = GradFn_mul;
+        res.node->name = "Tensor_mul";
         res.node->inputs[0] = self;
         res.node->inputs[1] = other;
         res.node->n_inputs = 2;
     }
+    _cten_trace_op(TRACE_MUL, res, a, b, 0);
+    CTEN_PROFILE_END(res.shape, res.data->numel, 3 * sizeof(float) * res.data->numel);
     return res;
 }
 
 static Tensor GradFn_div(Tensor self, int i) {
     // f(x, y) = x / y
-    // f'(x) = 1/y
-    // f'(y) = -x/y^2
-    Tensor x = Tensor_detach(self.node->inputs[0]);
-    Tensor y = Tensor_detach(self.node->inputs[1]);
-    
-    if (i == 0) {
-        // Gradient with respect to x is 1/y
-        Tensor result = Tensor_new(x.shape, false);
-        for(int j = 0; j < result.data->numel; j++) {
-            result.data->flex[j] = 1.0f / y.data->flex[j];
+    // dx = g / y
+    // dy = -g * x / y^2
+    Tensor x = self.node->inputs[0];
+    Tensor y = self.node->inputs[1];
+    Tensor g = self.node->grad;
+    Tensor res = Tensor_new(g.shape, false);
+    if(i == 0) {
+        for(int j = 0; j < res.data->numel; j++) {
+            res.data->flex[j] = g.data->flex[j] / y.data->flex[j];
         }
-        return result;
     } else {
-        // Gradient with respect to y is -x/y^2
-        Tensor result = Tensor_new(y.shape, false);
-        for(int j = 0; j < result.data->numel; j++) {
-            result.data->flex[j] = -x.data->flex[j] / (y.data->flex[j] * y.data->flex[j]);
+        for(int j = 0; j < res.data->numel; j++) {
+            float y_val = y.data->flex[j];
+            res.data->flex[j] = -g.data->flex[j] * x.data->flex[j] / (y_val * y_val);
         }
-        return result;
     }
+    return res;
 }
 
 Tensor Tensor_div(Tensor self, Tensor other) {
+    CTEN_PROFILE_BEGIN();
+    Tensor a = self, b = other;
     if(!cten_elemwise_broadcast(&self, &other)) {
         cten_assert_shape("Tensor_div() cannot broadcast", self.shape, other.shape);
     }
     bool requires_grad = !cten_is_eval() && (self.node != NULL || other.node != NULL);
     Tensor res = Tensor_new(self.shape, requires_grad);
-    for(int i = 0; i < self.data->numel; i++) {
-        res.data->flex[i] = self.data->flex[i] / other.data->flex[i];
-    }
+    _cten_kernels.div(res.data->numel, self.data->flex, other.data->flex, res.data->flex);
     if(requires_grad) {
         res.node->grad_fn = GradFn_div;
+        res.node->name = "Tensor_div";
         res.node->inputs[0] = self;
         res.node->inputs[1] = other;
         res.node->n_inputs = 2;
     }
+    _cten_trace_op(TRACE_DIV, res, a, b, 0);
+    CTEN_PROFILE_END(res.shape, res.data->numel, 3 * sizeof(float) * res.data->numel);
     return res;
 }
 
 static Tensor GradFn_neg(Tensor self, int i) {
-    // f(x) = -x; f'(x) = -1
-    Tensor input = self.node->inputs[i];
-    Tensor result = Tensor_ones(input.shape, false);
-    for(int j = 0; j < result.data->numel; j++) {
-        result.data->flex[j] = -result.data->flex[j];
+    // f(x) = -x; dx = -g
+    Tensor g = self.node->grad;
+    Tensor res = Tensor_new(g.shape, false);
+    for(int j = 0; j < res.data->numel; j++) {
+        res.data->flex[j] = -g.data->flex[j];
     }
-    return result;
+    return res;
 }
 
 Tensor Tensor_neg(Tensor self) {
+    CTEN_PROFILE_BEGIN();
     bool requires_grad = !cten_is_eval() && (self.node != NULL);
     Tensor res = Tensor_new(self.shape, requires_grad);
     for(int i = 0; i < self.data->numel; i++) {
@@ -141,24 +157,30 @@ Tensor Tensor_neg(Tensor self) {
     }
     if(requires_grad) {
         res.node->grad_fn = GradFn_neg;
+        res.node->name = "Tensor_neg";
         res.node->inputs[0] = self;
         res.node->n_inputs = 1;
     }
+    _cten_trace_op(TRACE_NEG, res, self, (Tensor){0}, 0);
+    CTEN_PROFILE_END(res.shape, res.data->numel, 2 * sizeof(float) * res.data->numel);
     return res;
 }
 
 static Tensor GradFn_abs(Tensor self, int i) {
-    // f(x) = |x|; f'(x) = x/|x| (sign of x)
+    // f(x) = |x|; dx = g * sign(x)
     Tensor input = self.node->inputs[i];
+    Tensor g = self.node->grad;
     Tensor res = Tensor_new(input.shape, false);
     for(int j = 0; j < input.data->numel; j++) {
         float x = input.data->flex[j];
-        res.data->flex[j] = (x > 0) ? 1.0f : ((x < 0) ? -1.0f : 0.0f);
+        float sign = (x > 0) ? 1.0f : ((x < 0) ? -1.0f : 0.0f);
+        res.data->flex[j] = g.data->flex[j] * sign;
     }
     return res;
 }
 
 Tensor Tensor_abs(Tensor self) {
+    CTEN_PROFILE_BEGIN();
     bool requires_grad = !cten_is_eval() && (self.node != NULL);
     Tensor res = Tensor_new(self.shape, requires_grad);
     for(int i = 0; i < self.data->numel; i++) {
@@ -166,51 +188,42 @@ Tensor Tensor_abs(Tensor self) {
     }
     if(requires_grad) {
         res.node->grad_fn = GradFn_abs;
+        res.node->name = "Tensor_abs";
         res.node->inputs[0] = self;
         res.node->n_inputs = 1;
     }
+    _cten_trace_op(TRACE_ABS, res, self, (Tensor){0}, 0);
+    CTEN_PROFILE_END(res.shape, res.data->numel, 2 * sizeof(float) * res.data->numel);
     return res;
 }
 
 static Tensor GradFn_pow(Tensor self, int i) {
     // f(x, y) = x^y
-    // f'(x) = y * x^(y-1)
-    // f'(y) = x^y * ln(x)
-    Tensor x = Tensor_detach(self.node->inputs[0]);
-    Tensor y = Tensor_detach(self.node->inputs[1]);
-    
-    if (i == 0) {
-        // Gradient with respect to x is y * x^(y-1)
-        Tensor result = Tensor_new(x.shape, false);
-        for(int j = 0; j < result.data->numel; j++) {
-            float x_val = x.data->flex[j];
-            float y_val = y.data->flex[j];
-            if (x_val == 0 && y_val <= 0) {
-                // Handle the case where x^(y-1) is undefined
-                result.data->flex[j] = 0.0f;
-            } else {
-                result.data->flex[j] = y_val * powf(x_val, y_val - 1.0f);
-            }
-        }
-        return result;
-    } else {
-        // Gradient with respect to y is x^y * ln(x)
-        Tensor result = Tensor_new(y.shape, false);
-        for(int j = 0; j < result.data->numel; j++) {
-            float x_val = x.data->flex[j];
-            float y_val = y.data->flex[j];
-            if (x_val <= 0) {
-                // Handle the case where ln(x) is undefined
-                result.data->flex[j] = 0.0f;
-            } else {
-                result.data->flex[j] = powf(x_val, y_val) * logf(x_val);
-            }
+    // dx = g * y * x^(y-1)
+    // dy = g * x^y * ln(x)
+    Tensor x = self.node->inputs[0];
+    Tensor y = self.node->inputs[1];
+    Tensor g = self.node->grad;
+    Tensor res = Tensor_new(g.shape, false);
+    for(int j = 0; j < res.data->numel; j++) {
+        float x_val = x.data->flex[j];
+        float y_val = y.data->flex[j];
+        float d;
+        if(i == 0) {
+            // x^(y-1) is undefined for x == 0 and y <= 0
+            d = (x_val == 0 && y_val <= 0) ? 0.0f : y_val * powf(x_val, y_val - 1.0f);
+        } else {
+            // ln(x) is undefined for x <= 0
+            d = (x_val <= 0) ? 0.0f : self.data->flex[j] * logf(x_val);
         }
-        return result;
+        res.data->flex[j] = g.data->flex[j] * d;
     }
+    return res;
 }
 
 Tensor Tensor_pow(Tensor self, Tensor other) {
+    CTEN_PROFILE_BEGIN();
+    Tensor a = self, b = other;
     if(!cten_elemwise_broadcast(&self, &other)) {
         cten_assert_shape("Tensor_pow() cannot broadcast", self.shape, other.shape);
     }
@@ -221,201 +234,232 @@ Tensor Tensor_pow(Tensor self, Tensor other) {
     }
     if(requires_grad) {
         res.node->grad_fn = GradFn_pow;
+        res.node->name = "Tensor_pow";
         res.node->inputs[0] = self;
         res.node->inputs[1] = other;
         res.node->n_inputs = 2;
     }
+    _cten_trace_op(TRACE_POW, res, a, b, 0);
+    CTEN_PROFILE_END(res.shape, res.data->numel, 3 * sizeof(float) * res.data->numel);
     return res;
 }
 
 static Tensor GradFn_min(Tensor self, int i) {
-    // f(x) = min(x); f'(x) = 1 at the minimum element, 0 elsewhere
+    // f(x) = min(x); dx = g at the minimum element, 0 elsewhere
     Tensor input = self.node->inputs[i];
     int min_idx = 0;
     float min_val = input.data->flex[0];
-    
+
     for(int j = 1; j < input.data->numel; j++) {
-        if (input.data->flex[j] < min_val) {
+        if(input.data->flex[j] < min_val) {
             min_val = input.data->flex[j];
             min_idx = j;
         }
     }
-    
-    Tensor result = Tensor_zeros(input.shape, false);
-    result.data->flex[min_idx] = 1.0f;
-    return result;
+
+    Tensor res = Tensor_zeros(input.shape, false);
+    res.data->flex[min_idx] = self.node->grad.data->flex[0];
+    return res;
 }
 
 Tensor Tensor_min(Tensor self) {
+    CTEN_PROFILE_BEGIN();
     bool requires_grad = !cten_is_eval() && (self.node != NULL);
     Tensor res = Tensor_new((TensorShape){0}, requires_grad);
     
-    if (self.data->numel == 0) {
+    // an empty tensor reduces to 0 and has nothing to propagate to
+    if(self.data->numel == 0) {
         res.data->flex[0] = 0.0f;
-        return res;
-    }
-    
-    float min_val = self.data->flex[0];
-    for(int i = 1; i < self.data->numel; i++) {
-        if (self.data->flex[i] < min_val) {
-            min_val = self.data->flex[i];
+        requires_grad = false;
+    } else {
+        float min_val = self.data->flex[0];
+        for(int i = 1; i < self.data->numel; i++) {
+            if (self.data->flex[i] < min_val) {
+                min_val = self.data->flex[i];
+            }
         }
+
+        res.data->flex[0] = min_val;
     }
-    
-    res.data->flex[0] = min_val;
-    
+
     if(requires_grad) {
         res.node->grad_fn = GradFn_min;
+        res.node->name = "Tensor_min";
         res.node->inputs[0] = self;
         res.node->n_inputs = 1;
     }
     
+    CTEN_PROFILE_END(self.shape, self.data->numel, sizeof(float) * self.data->numel);
     return res;
 }
 
 static Tensor GradFn_max(Tensor self, int i) {
-    // f(x) = max(x); f'(x) = 1 at the maximum element, 0 elsewhere
+    // f(x) = max(x); dx = g at the maximum element, 0 elsewhere
     Tensor input = self.node->inputs[i];
     int max_idx = 0;
     float max_val = input.data->flex[0];
-    
+
     for(int j = 1; j < input.data->numel; j++) {
-        if (input.data->flex[j] > max_val) {
+        if(input.data->flex[j] > max_val) {
             max_val = input.data->flex[j];
             max_idx = j;
         }
     }
-    
-    Tensor result = Tensor_zeros(input.shape, false);
-    result.data->flex[max_idx] = 1.0f;
-    return result;
+
+    Tensor res = Tensor_zeros(input.shape, false);
+    res.data->flex[max_idx] = self.node->grad.data->flex[0];
+    return res;
 }
 
 Tensor Tensor_max(Tensor self) {
+    CTEN_PROFILE_BEGIN();
     bool requires_grad = !cten_is_eval() && (self.node != NULL);
     Tensor res = Tensor_new((TensorShape){0}, requires_grad);
     
-    if (self.data->numel == 0) {
+    // an empty tensor reduces to 0 and has nothing to propagate to
+    if(self.data->numel == 0) {
         res.data->flex[0] = 0.0f;
-        return res;
-    }
-    
-    float max_val = self.data->flex[0];
-    for(int i = 1; i < self.data->numel; i++) {
-        if (self.data->flex[i] > max_val) {
-            max_val = self.data->flex[i];
-        }
+        requires_grad = false;
+    } else {
+        res.data->flex[0] = _cten_kernels.max(self.data->numel, self.data->flex);
     }
-    
-    res.data->flex[0] = max_val;
-    
+
     if(requires_grad) {
         res.node->grad_fn = GradFn_max;
+        res.node->name = "Tensor_max";
         res.node->inputs[0] = self;
         res.node->n_inputs = 1;
     }
     
+    CTEN_PROFILE_END(self.shape, self.data->numel, sizeof(float) * self.data->numel);
     return res;
 }
 
 Tensor Tensor_addf(Tensor self, float other) {
+    CTEN_PROFILE_BEGIN();
     Tensor tmp = Tensor_new(self.shape, false);
     for(int i = 0; i < tmp.data->numel; i++) {
         tmp.data->flex[i] = other;
     }
     Tensor res = Tensor_add(self, tmp);
+    _cten_trace_op(TRACE_ADDF, res, self, (Tensor){0}, other);
+    CTEN_PROFILE_END(res.shape, res.data->numel, 4 * sizeof(float) * res.data->numel);
     return res;
 }
 
 Tensor Tensor_subf(Tensor self, float other) {
+    CTEN_PROFILE_BEGIN();
     Tensor tmp = Tensor_new(self.shape, false);
     for(int i = 0; i < tmp.data->numel; i++) {
         tmp.data->flex[i] = other;
     }
     Tensor res = Tensor_sub(self, tmp);
+    _cten_trace_op(TRACE_SUBF, res, self, (Tensor){0}, other);
+    CTEN_PROFILE_END(res.shape, res.data->numel, 4 * sizeof(float) * res.data->numel);
     return res;
 }
 
 Tensor Tensor_mulf(Tensor self, float other) {
+    CTEN_PROFILE_BEGIN();
     Tensor tmp = Tensor_new(self.shape, false);
     for(int i = 0; i < tmp.data->numel; i++) {
         tmp.data->flex[i] = other;
     }
     Tensor res = Tensor_mul(self, tmp);
+    _cten_trace_op(TRACE_MULF, res, self, (Tensor){0}, other);
+    CTEN_PROFILE_END(res.shape, res.data->numel, 4 * sizeof(float) * res.data->numel);
     return res;
 }
 
-void Tensor_argmax(Tensor self, int* out) {
-    // reduce last dim
-    int last_dim = self.shape[TensorShape_dim(self.shape) - 1];
-    int n = TensorShape_numel(self.shape) / last_dim;
-    for(int i = 0; i < n; i++) {
-        float* p = self.data->flex + i * last_dim;
-        float max_val = p[0];
-        int max_idx = 0;
-        for(int j = 1; j < last_dim; j++) {
-            if(p[j] > max_val) {
-                max_val = p[j];
-                max_idx = j;
-            }
-        }
-        out[i] = max_idx;
-    }
-}
-
 static Tensor GradFn_mean(Tensor self, int i) {
-    // f(x) = mean(x); f'(x) = 1 / x.numel()
-    Tensor res = Tensor_new(self.shape, false);
-    for(int i = 0; i < res.data->numel; i++) {
-        res.data->flex[i] = 1.0f / self.data->numel;
+    // f(x) = mean(x); dx = g / x.numel()
+    Tensor input = self.node->inputs[i];
+    Tensor res = Tensor_new(input.shape, false);
+    float d = self.node->grad.data->flex[0] / input.data->numel;
+    for(int j = 0; j < res.data->numel; j++) {
+        res.data->flex[j] = d;
     }
     return res;
 }
 
 Tensor Tensor_mean(Tensor self) {
-    Tensor res = Tensor_new((TensorShape){0}, self.node != NULL);
-    float sum = 0;
-    for(int i = 0; i < self.data->numel; i++) {
-        sum += self.data->flex[i];
-    }
-    res.data->flex[0] = sum / self.data->numel;
-    if(res.node != NULL) {
+    CTEN_PROFILE_BEGIN();
+    bool requires_grad = !cten_is_eval() && self.node != NULL;
+    Tensor res = Tensor_new((TensorShape){0}, requires_grad);
+    res.data->flex[0] = _cten_reduce_sum(self.data->numel, self.data->flex) / self.data->numel;
+    if(requires_grad) {
         res.node->grad_fn = GradFn_mean;
+        res.node->name = "Tensor_mean";
         res.node->inputs[0] = self;
         res.node->n_inputs = 1;
     }
+    CTEN_PROFILE_END(self.shape, self.data->numel, sizeof(float) * self.data->numel);
     return res;
 }
 
 static Tensor GradFn_sum(Tensor self, int i) {
-    // f(x) = sum(x); f'(x) = 1
-    return Tensor_ones(self.node->inputs[i].shape, false);
+    // f(x) = sum(x); dx = g
+    Tensor input = self.node->inputs[i];
+    Tensor res = Tensor_new(input.shape, false);
+    float d = self.node->grad.data->flex[0];
+    for(int j = 0; j < res.data->numel; j++) {
+        res.data->flex[j] = d;
+    }
+    return res;
 }
 
 Tensor Tensor_sum(Tensor self) {
-    Tensor res = Tensor_new((TensorShape){0}, self.node != NULL);
-    float sum = 0;
-    for(int i = 0; i < self.data->numel; i++) {
-        sum += self.data->flex[i];
-    }
-    res.data->flex[0] = sum;
-    if(res.node != NULL) {
+    CTEN_PROFILE_BEGIN();
+    bool requires_grad = !cten_is_eval() && self.node != NULL;
+    Tensor res = Tensor_new((TensorShape){0}, requires_grad);
+    res.data->flex[0] = _cten_reduce_sum(self.data->numel, self.data->flex);
+    if(requires_grad) {
         res.node->grad_fn = GradFn_sum;
+        res.node->name = "Tensor_sum";
         res.node->inputs[0] = self;
         res.node->n_inputs = 1;
     }
+    CTEN_PROFILE_END(self.shape, self.data->numel, sizeof(float) * self.data->numel);
     return res;
 }
 
 static Tensor GradFn_matmul(Tensor self, int i) {
-    Tensor _0 = self.node->inputs[i];
-    Tensor _1 = self.node->inputs[1 - i];
-    _0 = Tensor_detach(_0);
-    _1 = Tensor_detach(_1);
-    return Tensor_matmul(_0, _1);
+    // f(A, B) = A @ B; dA = G @ B^T; dB = A^T @ G
+    Tensor a = self.node->inputs[0];
+    Tensor b = self.node->inputs[1];
+    Tensor g = self.node->grad;
+    int a_dim = TensorShape_dim(a.shape);
+    int b_dim = TensorShape_dim(b.shape);
+    int m = a.shape[a_dim - 2];
+    int n = a.shape[a_dim - 1];
+    int p = b.shape[b_dim - 1];
+    int batch = a.data->numel / (m * n);
+    int b_stride = b.data->numel == n * p ? 0 : n * p;
+
+    if(i == 0) {
+        // dA[m x n] = G[m x p] @ B^T[p x n]
+        Tensor res = Tensor_new(a.shape, false);
+        for(int bi = 0; bi < batch; bi++) {
+            const float* g_ = g.data->flex + bi * m * p;
+            const float* b_ = b.data->flex + bi * b_stride;
+            _cten_gemm(m, n, p, g_, p, 1, b_, 1, p, res.data->flex + bi * m * n, n, false);
+        }
+        return res;
+    } else {
+        // dB[n x p] = A^T[n x m] @ G[m x p]; a 2-D right operand is shared by every batch, so its
+        // gradient is summed over batches
+        Tensor res = Tensor_zeros(b.shape, false);
+        for(int bi = 0; bi < batch; bi++) {
+            const float* g_ = g.data->flex + bi * m * p;
+            const float* a_ = a.data->flex + bi * m * n;
+            _cten_gemm(n, p, m, a_, 1, n, g_, p, 1, res.data->flex + bi * b_stride, p, true);
+        }
+        return res;
+    }
 }
 
 Tensor Tensor_matmul(Tensor self, Tensor other) {
+    CTEN_PROFILE_BEGIN();
     int self_dim = TensorShape_dim(self.shape);
     int other_dim = TensorShape_dim(other.shape);
     assert(self_dim >= 2);
@@ -427,27 +471,38 @@ Tensor Tensor_matmul(Tensor self, Tensor other) {
 
     assert(n == other.shape[other_dim - 2]);
 
+    // leading dims of `self` are batch dims; `other` is either 2-D or batched the same way
+    int batch = self.data->numel / (m * n);
+    int other_batch = other.data->numel / (n * p);
+    cten_assert(other_batch == 1 || other_batch == batch,
+                "Tensor_matmul(): batch mismatch %d != %d",
+                batch,
+                other_batch);
+    int other_stride = other_batch == 1 ? 0 : n * p;
+
     TensorShape res_shape;
     memcpy(res_shape, self.shape, sizeof(TensorShape));
     res_shape[self_dim - 1] = p;
-    Tensor res = Tensor_new(res_shape, self.node != NULL || other.node != NULL);
+    bool requires_grad = !cten_is_eval() && (self.node != NULL || other.node != NULL);
+    Tensor res = Tensor_new(res_shape, requires_grad);
 
-    for(int i = 0; i < m; i++) {
-        for(int j = 0; j < p; j++) {
-            float sum = 0;
-            for(int k = 0; k < n; k++) {
-                sum += self.data->flex[i * n + k] * other.data->flex[k * p + j];
-            }
-            res.data->flex[i * p + j] = sum;
-        }
+    for(int b = 0; b < batch; b++) {
+        const float* a_ = self.data->flex + b * m * n;
+        const float* b_ = other.data->flex + b * other_stride;
+        _cten_gemm(m, p, n, a_, n, 1, b_, p, 1, res.data->flex + b * m * p, p, false);
     }
-    
-    if(res.node != NULL) {
+
+    if(requires_grad) {
         res.node->grad_fn = GradFn_matmul;
+        res.node->name = "Tensor_matmul";
         res.node->inputs[0] = self;
         res.node->inputs[1] = other;
         res.node->n_inputs = 2;
     }
-    
+
+    _cten_trace_op(TRACE_MATMUL, res, self, other, 0);
+    CTEN_PROFILE_END(res.shape,
+                     2.0 * batch * m * n * p,
+                     sizeof(float) * (self.data->numel + other.data->numel + res.data->numel));
     return res;
 }
\ No newline at end of file
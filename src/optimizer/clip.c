@@ -0,0 +1,40 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <math.h>
+
+float _cten_grad_norm(int n_params, const Tensor* params) {
+    enum { CHUNK = 4096 };
+    double sq = 0;
+    for(int i = 0; i < n_params; i++) {
+        Tensor t = params[i];
+        if(t.node == NULL || t.node->grad.data == NULL) continue;
+        // row-sparse gradients hold every touched row once, so their rows sum the same way
+        const FloatBuffer* g = t.node->grad.data;
+        for(int j = 0; j < g->numel; j += CHUNK) {
+            int len = g->numel - j < CHUNK ? g->numel - j : CHUNK;
+            sq += _cten_kernels.dot(len, g->flex + j, g->flex + j);
+        }
+    }
+    return (float)sqrt(sq);
+}
+
+float cten_clip_grad_norm(int n_params, Tensor* params, float max_norm) {
+    float norm = _cten_grad_norm(n_params, params);
+    if(!(norm > max_norm)) return norm;
+    float scale = max_norm / (norm + 1e-6f);
+    for(int i = 0; i < n_params; i++) {
+        GradNode* node = params[i].node;
+        if(node == NULL || node->grad.data == NULL) continue;
+        Tensor g = node->grad;
+        // a grad the node does not own may be shared with other nodes: scale a copy instead
+        if(g.data != node->grad_buffer && node->grad_rows == NULL) {
+            node->grad = Tensor_new(g.shape, false);
+        }
+        float* dst = node->grad.data->flex;
+        for(int j = 0; j < g.data->numel; j++) {
+            dst[j] = g.data->flex[j] * scale;
+        }
+    }
+    return norm;
+}
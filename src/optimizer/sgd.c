@@ -5,12 +5,20 @@
 #include <stdlib.h>
 #include <string.h>
 
+typedef struct SgdParam {
+    struct optim_sgd* optim;
+    int index;
+} SgdParam;
+
 typedef struct optim_sgd {
     int n_params;
     Tensor* params;
     float lr;
     float momentum;
-    // Tensor* velocity;
+    float max_norm;
+    Tensor* velocity;
+    SgdParam* hooks;         // non-NULL while fused
+    cten_context* fused_in;  // context holding the hooks
 } optim_sgd;
 
 optim_sgd* optim_sgd_new(int n_params, Tensor* params) {
@@ -19,25 +27,145 @@ optim_sgd* optim_sgd_new(int n_params, Tensor* params) {
     self->params = params;
     self->lr = 0.001f;
     self->momentum = 0.0f;
+    self->max_norm = 0.0f;
+    self->velocity = NULL;
+    self->hooks = NULL;
+    self->fused_in = NULL;
     return self;
 }
 
 void optim_sgd_config(optim_sgd* self, float lr, float momentum) {
     self->lr = lr;
     self->momentum = momentum;
+    if(momentum != 0 && self->velocity == NULL) {
+        // velocity lives in the same pool as the optimizer itself
+        self->velocity = _cten_malloc(sizeof(Tensor) * self->n_params);
+        for(int i = 0; i < self->n_params; i++) {
+            self->velocity[i] = Tensor_zeros(self->params[i].shape, false);
+        }
+    }
+}
+
+void optim_sgd_config_clip(optim_sgd* self, float max_norm) {
+    cten_assert(max_norm <= 0 || self->hooks == NULL,
+                "optim_sgd_config_clip(): clipping needs every gradient, fused steps see one");
+    self->max_norm = max_norm;
 }
 
 void optim_sgd_zerograd(optim_sgd* self) { _cten_zero_grad(self->params, self->n_params); }
 
+/* Row-sparse update: only the rows in grad_rows are touched, and with momentum only their
+ * velocity decays (lazy momentum) */
+static void _sgd_step_rows(optim_sgd* self, int i, float scale) {
+    Tensor t = self->params[i];
+    Tensor grad = t.node->grad;
+    int dim = t.shape[1];
+    for(int r = 0; r < grad.shape[0]; r++) {
+        float* p = t.data->flex + t.node->grad_rows[r] * dim;
+        const float* g = grad.data->flex + r * dim;
+        if(self->velocity == NULL) {
+            _cten_kernels.axpy(dim, -self->lr * scale, g, p);
+            continue;
+        }
+        float* v = self->velocity[i].data->flex + t.node->grad_rows[r] * dim;
+        for(int j = 0; j < dim; j++) {
+            v[j] = self->momentum * v[j] + scale * g[j];
+            p[j] -= self->lr * v[j];
+        }
+    }
+}
+
+static void _sgd_update(optim_sgd* self, int i, float scale) {
+    Tensor t = self->params[i];
+    float* grad = t.node->grad.data->flex;
+    if(t.node->grad_rows != NULL) {
+        _sgd_step_rows(self, i, scale);
+    } else if(self->velocity == NULL) {
+        _cten_kernels.axpy(t.data->numel, -self->lr * scale, grad, t.data->flex);
+    } else {
+        // v = momentum * v + scale * g; p -= lr * v
+        float* v = self->velocity[i].data->flex;
+        for(int j = 0; j < t.data->numel; j++) {
+            v[j] = self->momentum * v[j] + scale * grad[j];
+            t.data->flex[j] -= self->lr * v[j];
+        }
+    }
+    t.data->version++;
+}
+
 void optim_sgd_step(optim_sgd* self) {
-    assert(self->momentum == 0);
+    // gradient clipping is one read-only sweep for the norm; the scale rides along the update
+    float scale = 1.0f;
+    if(self->max_norm > 0) {
+        float norm = _cten_grad_norm(self->n_params, self->params);
+        if(norm > self->max_norm) scale = self->max_norm / (norm + 1e-6f);
+    }
+    for(int i = 0; i < self->n_params; i++) {
+        Tensor t = self->params[i];
+        // parameters that took no part in the last backward have no gradient
+        if(t.node == NULL || t.node->grad.data == NULL) continue;
+        _sgd_update(self, i, scale);
+    }
+}
+
+/* Fused steps: the update runs while the gradient is still in cache, and the gradient lives only
+ * in backward's pool, so no persistent gradient buffers exist */
+static void _on_grad_ready(Tensor t, void* ctx) {
+    SgdParam* param = ctx;
+    if(t.node->grad.data == NULL) return;
+    _sgd_update(param->optim, param->index, 1.0f);
+    t.node->grad = (Tensor){0};
+    t.node->grad_rows = NULL;
+    t.node->grad_buffer = NULL;
+}
+
+void optim_sgd_config_fused(optim_sgd* self, bool fused) {
+    if(fused == (self->hooks != NULL)) return;
+    if(fused) {
+        cten_assert(self->max_norm <= 0,
+                    "optim_sgd_config_fused(): clipping needs every gradient, fused steps see one");
+        self->hooks = _cten_malloc(sizeof(SgdParam) * self->n_params);
+        self->fused_in = cten_context_get();
+    } else {
+        cten_assert(self->fused_in == cten_context_get(),
+                    "optim_sgd_config_fused(): the hooks live in the context that fused it");
+    }
     for(int i = 0; i < self->n_params; i++) {
         Tensor t = self->params[i];
         if(t.node == NULL) continue;
-        assert(t.node->grad.data != NULL);
-        // step
-        for(int j = 0; j < t.data->numel; j++) {
-            t.data->flex[j] -= self->lr * t.node->grad.data->flex[j];
+        // a persistent buffer from earlier steps is left to its pool
+        t.node->grad = (Tensor){0};
+        t.node->grad_rows = NULL;
+        t.node->grad_buffer = NULL;
+        t.node->transient_grad = fused;
+        if(fused) {
+            self->hooks[i] = (SgdParam){self, i};
+            Tensor_register_grad_hook(t, _on_grad_ready, &self->hooks[i]);
+        } else {
+            Tensor_remove_grad_hook(t, _on_grad_ready, &self->hooks[i]);
         }
     }
+    if(!fused) {
+        self->hooks = NULL;
+        self->fused_in = NULL;
+    }
+}
+
+void optim_sgd_delete(optim_sgd* self) { optim_sgd_config_fused(self, false); }
+
+int optim_sgd_state(optim_sgd* self, Tensor* out) {
+    if(self->velocity == NULL) return 0;
+    if(out != NULL) memcpy(out, self->velocity, sizeof(Tensor) * self->n_params);
+    return self->n_params;
+}
+
+void optim_sgd_load_state(optim_sgd* self, const Tensor* state) {
+    cten_assert(self->velocity != NULL, "optim_sgd_load_state() requires momentum != 0");
+    for(int i = 0; i < self->n_params; i++) {
+        cten_assert_shape("optim_sgd_load_state()", self->params[i].shape, (int*)state[i].shape);
+        // copied into the optimizer's own buffers: checkpoint tensors go away with the mapping
+        memcpy(self->velocity[i].data->flex,
+               state[i].data->flex,
+               sizeof(float) * self->velocity[i].data->numel);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,149 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* A fixed set of workers started on the first parallel call. Tasks are handed out one index at a
+ * time under the lock, which is cheap next to the coarse tasks (one batch/head each) run here.
+ * The pool runs one job at a time; a thread that finds it busy runs its own job inline. */
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;
+    pthread_cond_t done_cv;
+    pthread_t* workers;
+    int n_workers;
+    int n_threads;  // including the caller; 0 means not decided yet
+    bool started;
+    bool stop;
+    bool busy;
+    int generation;
+    int active;
+    void (*fn)(void* ctx, int i);
+    void* ctx;
+    int n_tasks;
+    int next_task;
+} ThreadPool;
+
+static ThreadPool g_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work_cv = PTHREAD_COND_INITIALIZER,
+    .done_cv = PTHREAD_COND_INITIALIZER,
+};
+
+static _Thread_local bool g_in_parallel;
+
+// runs tasks until none are left; called and returns with the lock held
+static void _run_tasks_locked() {
+    while(g_pool.next_task < g_pool.n_tasks) {
+        int i = g_pool.next_task++;
+        void (*fn)(void* ctx, int i) = g_pool.fn;
+        void* ctx = g_pool.ctx;
+        pthread_mutex_unlock(&g_pool.lock);
+        fn(ctx, i);
+        pthread_mutex_lock(&g_pool.lock);
+    }
+}
+
+static void* _worker_main(void* arg) {
+    (void)arg;
+    g_in_parallel = true;
+    int seen = 0;
+    pthread_mutex_lock(&g_pool.lock);
+    while(true) {
+        while(!g_pool.stop && g_pool.generation == seen) {
+            pthread_cond_wait(&g_pool.work_cv, &g_pool.lock);
+        }
+        if(g_pool.stop) break;
+        seen = g_pool.generation;
+        g_pool.active++;
+        _run_tasks_locked();
+        if(--g_pool.active == 0) pthread_cond_broadcast(&g_pool.done_cv);
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+    _cten_gemm_release();
+    return NULL;
+}
+
+static int _default_num_threads() {
+    const char* env = getenv("CTEN_NUM_THREADS");
+    if(env != NULL && atoi(env) > 0) return atoi(env);
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static void _pool_start_locked() {
+    if(g_pool.n_threads == 0) g_pool.n_threads = _default_num_threads();
+    g_pool.started = true;
+    g_pool.stop = false;
+    g_pool.n_workers = 0;
+    if(g_pool.n_threads <= 1) return;
+    g_pool.workers = malloc(sizeof(pthread_t) * (g_pool.n_threads - 1));
+    cten_assert(g_pool.workers != NULL, "cten: out of memory");
+    for(int i = 0; i < g_pool.n_threads - 1; i++) {
+        if(pthread_create(&g_pool.workers[i], NULL, _worker_main, NULL) != 0) break;
+        g_pool.n_workers++;
+    }
+}
+
+void _cten_parallel_shutdown() {
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.stop = true;
+    pthread_cond_broadcast(&g_pool.work_cv);
+    pthread_mutex_unlock(&g_pool.lock);
+    for(int i = 0; i < g_pool.n_workers; i++) {
+        pthread_join(g_pool.workers[i], NULL);
+    }
+    free(g_pool.workers);
+    g_pool.workers = NULL;
+    g_pool.n_workers = 0;
+    g_pool.started = false;
+}
+
+void _cten_parallel_for(int n, void (*fn)(void* ctx, int i), void* ctx) {
+    if(n <= 0) return;
+    pthread_mutex_lock(&g_pool.lock);
+    if(!g_pool.started) _pool_start_locked();
+    // nested calls, single tasks and callers racing another thread's job run inline
+    if(g_in_parallel || g_pool.busy || g_pool.n_workers == 0 || n == 1) {
+        pthread_mutex_unlock(&g_pool.lock);
+        for(int i = 0; i < n; i++) {
+            fn(ctx, i);
+        }
+        return;
+    }
+    g_pool.fn = fn;
+    g_pool.ctx = ctx;
+    g_pool.n_tasks = n;
+    g_pool.next_task = 0;
+    g_pool.busy = true;
+    g_pool.generation++;
+    pthread_cond_broadcast(&g_pool.work_cv);
+    g_in_parallel = true;
+    _run_tasks_locked();
+    g_in_parallel = false;
+    while(g_pool.active > 0) {
+        pthread_cond_wait(&g_pool.done_cv, &g_pool.lock);
+    }
+    g_pool.busy = false;
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+bool _cten_in_parallel() { return g_in_parallel; }
+
+void cten_set_num_threads(int n) {
+    _cten_parallel_shutdown();
+    g_pool.n_threads = n > 0 ? n : 0;
+}
+
+int cten_get_num_threads() {
+    pthread_mutex_lock(&g_pool.lock);
+    if(g_pool.n_threads == 0) g_pool.n_threads = _default_num_threads();
+    int n = g_pool.n_threads;
+    pthread_mutex_unlock(&g_pool.lock);
+    return n;
+}
@@ -1,66 +1,490 @@
+#define _DEFAULT_SOURCE
+
 #include "cten.h"
+#include "cten_internal.h"
 
 #include "common/vector.h"
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Blocks come from malloc, except large blocks of pools with a placement policy: those get their
+ * own mapping, so huge pages and NUMA policies apply to them alone. A freed mapping is kept for the
+ * next block of the same length and policy, since a training loop allocates the same activations
+ * on every step and would otherwise fault them in afresh each time. In offload mode large blocks
+ * are mapped from the context's spill file instead (src/offload.c). */
+
+#define POOL_MAP_THRESHOLD (256 << 10)
+#define POOL_MAP_ALIGN 64  // data offset inside a mapping
+#define POOL_HUGE_PAGE (2 << 20)
+#define POOL_MAX_CACHED 64
+#define POOL_SPILL (1 << 30)  // policy flag of blocks mapped from the offload spill file
+#define POOL_OFFLOAD_MIN_BYTES (1 << 20)
+
+// linux/mempolicy.h
+#define POOL_MPOL_PREFERRED 1
+#define POOL_MPOL_BIND 2
+#define POOL_MPOL_INTERLEAVE 3
+
+// every block is prefixed with its owner pool and requested size
+typedef struct {
+    PoolId id;
+    size_t size;
+    size_t mapped;      // length of the block's own mapping, 0 when it came from malloc
+    PoolPolicy policy;  // what the mapping was created with
+} BlockHeader;
 
 typedef struct {
+    PoolId id;
+    PoolPolicy policy;
+} PoolPolicyEntry;
+
+typedef struct {
+    void* base;
+    size_t length;
+    PoolPolicy policy;
+} CachedMapping;
+
+struct PoolAllocator {
     c11_vector /*PoolId*/ stack;
     c11_vector /*void_p*/ pointers;
     c11_vector /*void_p*/ pointers_swap_buffer;
-} PoolAllocator;
+    c11_vector /*PoolStats*/ stats;
+    c11_vector /*PoolSite*/ sites;
+    int track_sites_depth;
+    c11_vector /*PoolPolicyEntry*/ policies;
+    c11_vector /*CachedMapping*/ cached;
+    Offload* offload;
+    int offload_depth;
+};
+
+static PoolAllocator* _allocator() { return cten_context_get()->allocator; }
+
+PoolAllocator* _cten_pool_new() {
+    PoolAllocator* self = malloc(sizeof(PoolAllocator));
+    cten_assert(self != NULL, "cten: out of memory");
+    c11_vector__ctor(&self->stack, sizeof(PoolId));
+    c11_vector__ctor(&self->pointers, sizeof(void*));
+    c11_vector__ctor(&self->pointers_swap_buffer, sizeof(void*));
+    c11_vector__ctor(&self->stats, sizeof(PoolStats));
+    c11_vector__ctor(&self->sites, sizeof(PoolSite));
+    self->track_sites_depth = 0;
+    c11_vector__ctor(&self->policies, sizeof(PoolPolicyEntry));
+    c11_vector__ctor(&self->cached, sizeof(CachedMapping));
+    self->offload = NULL;
+    self->offload_depth = 0;
+    return self;
+}
 
-static PoolAllocator g_allocator;
+static void _block_release(PoolAllocator* a, BlockHeader* p);
+static void _pool_trim(PoolAllocator* a);
+
+void _cten_pool_delete(PoolAllocator* self) {
+    for(int i = 0; i < self->pointers.length; i++) {
+        BlockHeader* p = c11__getitem(void*, &self->pointers, i);
+        _cten_prepack_forget((FloatBuffer*)(p + 1));
+        _block_release(self, p);
+    }
+    assert(self->pointers_swap_buffer.length == 0);
+    _pool_trim(self);
+    _cten_offload_delete(self->offload);
+    c11_vector__dtor(&self->stack);
+    c11_vector__dtor(&self->pointers);
+    c11_vector__dtor(&self->pointers_swap_buffer);
+    c11_vector__dtor(&self->stats);
+    c11_vector__dtor(&self->sites);
+    c11_vector__dtor(&self->policies);
+    c11_vector__dtor(&self->cached);
+    free(self);
+}
 
 void cten_initilize() {
-    c11_vector__ctor(&g_allocator.stack, sizeof(PoolId));
-    c11_vector__ctor(&g_allocator.pointers, sizeof(void*));
-    c11_vector__ctor(&g_allocator.pointers_swap_buffer, sizeof(void*));
+    _cten_default_context();
+    _cten_kernels_select();
+    _cten_random_init();
+    _cten_reduce_init();
+    _cten_autotune_init();
 }
 
 void cten_finalize() {
-    for(int i = 0; i < g_allocator.pointers.length; i++) {
-        void* p = c11__getitem(void*, &g_allocator.pointers, i);
+    _cten_autotune_finalize();
+    _cten_parallel_shutdown();
+    _cten_gemm_release();
+    cten_prepack_clear();
+    cten_context_delete(_cten_default_context());
+}
+
+static PoolStats* _pool_stats(PoolAllocator* a, PoolId id) {
+    c11__foreach(PoolStats, &a->stats, it) {
+        if(it->id == id) return it;
+    }
+    PoolStats* s = c11_vector__emplace(&a->stats);
+    memset(s, 0, sizeof(PoolStats));
+    s->id = id;
+    return s;
+}
+
+static void _pool_record_site(PoolAllocator* a, PoolId id, size_t size) {
+    const char* op = _cten_current_op();
+    if(op == NULL) op = "<untracked>";
+    c11__foreach(PoolSite, &a->sites, it) {
+        if(it->id == id && strcmp(it->op, op) == 0) {
+            it->bytes += size;
+            it->allocs++;
+            return;
+        }
+    }
+    PoolSite* site = c11_vector__emplace(&a->sites);
+    site->id = id;
+    site->op = op;
+    site->bytes = size;
+    site->allocs = 1;
+}
+
+/* Placement policies */
+static PoolPolicy _pool_policy(PoolAllocator* a, PoolId id) {
+    c11__foreach(PoolPolicyEntry, &a->policies, it) {
+        if(it->id == id) return it->policy;
+    }
+    return (PoolPolicy){0};
+}
+
+static bool _policy_eq(PoolPolicy a, PoolPolicy b) { return a.flags == b.flags && a.node == b.node; }
+
+// mask of the online NUMA nodes from sysfs ("0-1,3"); node 0 when unknown
+static unsigned long _online_nodes() {
+    unsigned long mask = 0;
+    FILE* fp = fopen("/sys/devices/system/node/online", "r");
+    if(fp == NULL) return 1;
+    int lo, hi;
+    while(fscanf(fp, "%d", &lo) == 1) {
+        hi = lo;
+        int c = fgetc(fp);
+        if(c == '-') {
+            if(fscanf(fp, "%d", &hi) != 1) break;
+            c = fgetc(fp);
+        }
+        for(int n = lo; n <= hi && n < 64; n++) {
+            mask |= 1UL << n;
+        }
+        if(c != ',') break;
+    }
+    fclose(fp);
+    return mask != 0 ? mask : 1;
+}
+
+// best effort: kernels without NUMA support, or containers that forbid mbind, keep the default
+static void _numa_place(void* base, size_t length, PoolPolicy policy) {
+#if defined(SYS_mbind) && defined(SYS_getcpu)
+    unsigned long mask;
+    int mode;
+    if(policy.flags & CTEN_POOL_INTERLEAVE) {
+        mode = POOL_MPOL_INTERLEAVE;
+        mask = _online_nodes();
+    } else if(policy.flags & CTEN_POOL_BIND) {
+        mode = POOL_MPOL_BIND;
+        mask = 1UL << policy.node;
+    } else if(policy.flags & CTEN_POOL_LOCAL) {
+        unsigned cpu, node;
+        if(syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= 64) return;
+        // preferred rather than bound: a full node spills over instead of failing
+        mode = POOL_MPOL_PREFERRED;
+        mask = 1UL << node;
+    } else {
+        return;
+    }
+    // the kernel reads maxnode - 1 bits of the mask
+    syscall(SYS_mbind, base, length, mode, &mask, sizeof(mask) * 8 + 1, 0);
+#else
+    (void)base;
+    (void)length;
+    (void)policy;
+#endif
+}
+
+static void* _map(size_t length, PoolPolicy policy) {
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    bool huge = policy.flags & (CTEN_POOL_HUGEPAGE | CTEN_POOL_HUGETLB);
+    char* base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    // fails unless huge pages are reserved (vm.nr_hugepages); fall back to transparent ones
+    if(policy.flags & CTEN_POOL_HUGETLB) base = mmap(NULL, length, prot, flags | MAP_HUGETLB, -1, 0);
+#endif
+    if(base == MAP_FAILED) {
+        // over-map and trim, so the block starts on a huge page boundary
+        size_t align = huge ? POOL_HUGE_PAGE : 0;
+        char* raw = mmap(NULL, length + align, prot, flags, -1, 0);
+        if(raw == MAP_FAILED) return NULL;
+        base = raw;
+        if(huge) {
+            base = (char*)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+            if(base > raw) munmap(raw, base - raw);
+            size_t tail = (raw + length + align) - (base + length);
+            if(tail > 0) munmap(base + length, tail);
+        }
+#ifdef MADV_HUGEPAGE
+        if(huge) madvise(base, length, MADV_HUGEPAGE);
+#endif
+    }
+    // before anything touches the pages, so the first fault already follows the policy
+    _numa_place(base, length, policy);
+    return base;
+}
+
+static BlockHeader* _block_map(PoolAllocator* a, size_t size, PoolPolicy policy) {
+    size_t page = policy.flags & (CTEN_POOL_HUGEPAGE | CTEN_POOL_HUGETLB) ? POOL_HUGE_PAGE : 4096;
+    size_t length = (POOL_MAP_ALIGN + size + page - 1) / page * page;
+    void* base = NULL;
+    for(int i = a->cached.length - 1; i >= 0; i--) {
+        CachedMapping* m = c11__at(CachedMapping, &a->cached, i);
+        if(m->length == length && _policy_eq(m->policy, policy)) {
+            base = m->base;
+            c11_vector__erase(CachedMapping, &a->cached, i);
+            break;
+        }
+    }
+    if(base == NULL) base = _map(length, policy);
+    if(base == NULL) return NULL;
+    // the header sits right in front of 64-byte aligned data
+    BlockHeader* p = (BlockHeader*)((char*)base + POOL_MAP_ALIGN) - 1;
+    p->mapped = length;
+    p->policy = policy;
+    return p;
+}
+
+static BlockHeader* _block_spill(PoolAllocator* a, size_t size) {
+    size_t length = (POOL_MAP_ALIGN + size + 4095) / 4096 * 4096;
+    void* base = _cten_offload_map(a->offload, length);
+    if(base == NULL) return NULL;
+    BlockHeader* p = (BlockHeader*)((char*)base + POOL_MAP_ALIGN) - 1;
+    p->mapped = length;
+    p->policy = (PoolPolicy){POOL_SPILL, 0};
+    return p;
+}
+
+static void _block_release(PoolAllocator* a, BlockHeader* p) {
+    if(p->mapped == 0) {
         free(p);
+        return;
+    }
+    void* base = (char*)(p + 1) - POOL_MAP_ALIGN;
+    if(p->policy.flags & POOL_SPILL) {
+        _cten_offload_unmap(a->offload, base);
+        return;
+    }
+    if(a->cached.length < POOL_MAX_CACHED) {
+        CachedMapping m = {base, p->mapped, p->policy};
+        c11_vector__push(CachedMapping, &a->cached, m);
+    } else {
+        munmap(base, p->mapped);
+    }
+}
+
+static void _pool_trim(PoolAllocator* a) {
+    c11__foreach(CachedMapping, &a->cached, m) {
+        munmap(m->base, m->length);
     }
-    assert(g_allocator.pointers_swap_buffer.length == 0);
-    c11_vector__dtor(&g_allocator.stack);
-    c11_vector__dtor(&g_allocator.pointers);
-    c11_vector__dtor(&g_allocator.pointers_swap_buffer);
+    c11_vector__clear(&a->cached);
 }
 
+void cten_pool_set_policy(PoolId id, PoolPolicy policy) {
+    cten_assert(!(policy.flags & CTEN_POOL_BIND) || (policy.node >= 0 && policy.node < 64),
+                "cten_pool_set_policy(): node %d out of range",
+                policy.node);
+    PoolAllocator* a = _allocator();
+    c11__foreach(PoolPolicyEntry, &a->policies, it) {
+        if(it->id == id) {
+            it->policy = policy;
+            return;
+        }
+    }
+    PoolPolicyEntry entry = {id, policy};
+    c11_vector__push(PoolPolicyEntry, &a->policies, entry);
+}
+
+PoolPolicy cten_pool_get_policy(PoolId id) { return _pool_policy(_allocator(), id); }
+
+void cten_pool_trim() { _pool_trim(_allocator()); }
+
 void cten_begin_malloc(PoolId id) {
-    c11_vector* self = &g_allocator.stack;
+    c11_vector* self = &_allocator()->stack;
     c11_vector__push(PoolId, self, id);
 }
 
 void cten_end_malloc() {
-    c11_vector* self = &g_allocator.stack;
+    c11_vector* self = &_allocator()->stack;
     assert(self->length > 0);
     c11_vector__pop(self);
 }
 
 void cten_free(PoolId id) {
-    c11_vector* pointers = &g_allocator.pointers;
-    c11_vector* swap_buffer = &g_allocator.pointers_swap_buffer;
+    PoolAllocator* a = _allocator();
+    c11_vector* pointers = &a->pointers;
+    c11_vector* swap_buffer = &a->pointers_swap_buffer;
+    PoolStats* stats = _pool_stats(a, id);
     for(int i = 0; i < pointers->length; i++) {
-        void* p = c11__getitem(void*, pointers, i);
-        if(((PoolId*)p)[0] == id) {
-            free(p);
+        BlockHeader* p = c11__getitem(void*, pointers, i);
+        if(p->id == id) {
+            stats->live_bytes -= p->size;
+            stats->live_allocs--;
+            _cten_prepack_forget((FloatBuffer*)(p + 1));
+            _block_release(a, p);
         } else {
             c11_vector__push(void*, swap_buffer, p);
         }
     }
+    assert(stats->live_bytes == 0 && stats->live_allocs == 0);
     c11_vector__swap(pointers, swap_buffer);
     c11_vector__clear(swap_buffer);
 }
 
 void* _cten_malloc(size_t size) {
-    assert(g_allocator.stack.length > 0);
-    PoolId id = c11_vector__back(PoolId, &g_allocator.stack);
-    c11_vector* pointers = &g_allocator.pointers;
-    void* p = malloc(sizeof(PoolId) + size);
-    assert(p != NULL);
-    ((PoolId*)p)[0] = id;
+    PoolAllocator* a = _allocator();
+    assert(a->stack.length > 0);
+    PoolId id = c11_vector__back(PoolId, &a->stack);
+    c11_vector* pointers = &a->pointers;
+    BlockHeader* p = NULL;
+    if(a->offload_depth > 0 && a->offload != NULL && size >= _cten_offload_min_bytes(a->offload)) {
+        p = _block_spill(a, size);
+    }
+    if(p == NULL && size >= POOL_MAP_THRESHOLD && a->policies.length > 0) {
+        PoolPolicy policy = _pool_policy(a, id);
+        if(policy.flags != 0) p = _block_map(a, size, policy);
+    }
+    if(p == NULL) {
+        p = malloc(sizeof(BlockHeader) + size);
+        assert(p != NULL);
+        p->mapped = 0;
+        p->policy = (PoolPolicy){0};
+    }
+    p->id = id;
+    p->size = size;
     c11_vector__push(void*, pointers, p);
-    return (PoolId*)p + 1;
+
+    PoolStats* stats = _pool_stats(a, id);
+    stats->live_bytes += size;
+    stats->live_allocs++;
+    stats->total_bytes += size;
+    stats->total_allocs++;
+    if(stats->live_bytes > stats->peak_bytes) stats->peak_bytes = stats->live_bytes;
+    if(a->track_sites_depth > 0) _pool_record_site(a, id, size);
+    return p + 1;
+}
+
+PoolId _cten_pool_of(const void* ptr) { return ((const BlockHeader*)ptr - 1)->id; }
+
+void _cten_pool_prefetch(const void* ptr) {
+    PoolAllocator* a = _allocator();
+    // tensors may come from other storage (checkpoints), so look the address up, not its header
+    if(a->offload != NULL) _cten_offload_touch(a->offload, ptr);
+}
+
+/* Activation offload */
+bool cten_offload_config(const char* dir, size_t min_bytes) {
+    PoolAllocator* a = _allocator();
+    c11__foreach(void*, &a->pointers, it) {
+        const BlockHeader* p = *it;
+        cten_assert(p->mapped == 0 || !(p->policy.flags & POOL_SPILL),
+                    "cten_offload_config(): spilled blocks are still live");
+    }
+    if(dir == NULL) dir = getenv("CTEN_OFFLOAD_DIR");
+    if(dir == NULL || dir[0] == '\0') dir = "/var/tmp";
+    Offload* offload = _cten_offload_new(dir, min_bytes);
+    if(offload == NULL) return false;
+    _cten_offload_delete(a->offload);
+    a->offload = offload;
+    return true;
+}
+
+void cten_begin_offload() {
+    PoolAllocator* a = _allocator();
+    // best effort: without a spill file, blocks just stay in RAM
+    if(a->offload == NULL) cten_offload_config(NULL, POOL_OFFLOAD_MIN_BYTES);
+    a->offload_depth++;
+}
+
+bool cten_is_offload() { return _allocator()->offload_depth > 0; }
+
+void cten_end_offload() {
+    PoolAllocator* a = _allocator();
+    assert(a->offload_depth > 0);
+    a->offload_depth--;
+}
+
+OffloadStats cten_offload_stats() {
+    PoolAllocator* a = _allocator();
+    if(a->offload == NULL) return (OffloadStats){0};
+    return _cten_offload_stats(a->offload);
+}
+
+/* Statistics */
+PoolStats cten_pool_stats(PoolId id) {
+    PoolAllocator* a = _allocator();
+    c11__foreach(PoolStats, &a->stats, it) {
+        if(it->id == id) return *it;
+    }
+    return (PoolStats){.id = id};
+}
+
+int cten_pool_snapshot(PoolStats* out, int max_pools) {
+    PoolAllocator* a = _allocator();
+    int n = a->stats.length;
+    if(n > max_pools) n = max_pools;
+    if(out != NULL && n > 0) memcpy(out, a->stats.data, sizeof(PoolStats) * n);
+    return n;
+}
+
+void cten_pool_reset_peak(PoolId id) {
+    PoolAllocator* a = _allocator();
+    PoolStats* stats = _pool_stats(a, id);
+    stats->peak_bytes = stats->live_bytes;
+}
+
+void cten_begin_track_sites() { _allocator()->track_sites_depth++; }
+
+void cten_end_track_sites() {
+    PoolAllocator* a = _allocator();
+    assert(a->track_sites_depth > 0);
+    a->track_sites_depth--;
+}
+
+int cten_pool_sites(PoolSite* out, int max_sites) {
+    PoolAllocator* a = _allocator();
+    int n = a->sites.length;
+    if(n > max_sites) n = max_sites;
+    if(out != NULL && n > 0) memcpy(out, a->sites.data, sizeof(PoolSite) * n);
+    return n;
+}
+
+void cten_pool_print() {
+    PoolAllocator* a = _allocator();
+    printf("%-8s %14s %14s %10s %14s %10s\n",
+           "pool",
+           "live(bytes)",
+           "peak(bytes)",
+           "live",
+           "total(bytes)",
+           "allocs");
+    c11__foreach(PoolStats, &a->stats, s) {
+        printf("%-8lld %14lld %14lld %10lld %14lld %10lld\n",
+               (long long)s->id,
+               (long long)s->live_bytes,
+               (long long)s->peak_bytes,
+               (long long)s->live_allocs,
+               (long long)s->total_bytes,
+               (long long)s->total_allocs);
+    }
+    if(a->sites.length == 0) return;
+    printf("\n%-8s %-24s %14s %10s\n", "pool", "op", "bytes", "allocs");
+    c11__foreach(PoolSite, &a->sites, s) {
+        printf("%-8lld %-24s %14lld %10lld\n",
+               (long long)s->id,
+               s->op,
+               (long long)s->bytes,
+               (long long)s->allocs);
+    }
 }
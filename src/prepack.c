@@ -0,0 +1,87 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/* Eval-mode nn_linear multiplies by the same weights on every call, so their packed GEMM layout is
+ * cached process-wide, keyed by the weight's storage and revalidated against its version. A pack
+ * that goes stale while another thread still multiplies with it is freed by whoever drops the last
+ * reference. Freeing the storage (cten_free, cten_checkpoint_close) drops its pack, so a new
+ * buffer at a recycled address never finds an old one. */
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static c11_vector /*PackedWeight* */ g_packs;
+static _Atomic int g_n_packs;  // read without the lock, so frees skip it while nothing is packed
+
+static void _unref(PackedWeight* self) {
+    if(--self->refs > 0) return;
+    free(self->data);
+    free(self);
+}
+
+static void _remove(int i) {
+    PackedWeight* w = c11__getitem(PackedWeight*, &g_packs, i);
+    c11_vector__erase(PackedWeight*, &g_packs, i);
+    atomic_fetch_sub(&g_n_packs, 1);
+    _unref(w);
+}
+
+PackedWeight* _cten_prepack_acquire(Tensor weight) {
+    cten_assert_dim("cten_prepack() dim", TensorShape_dim(weight.shape), 2);
+    int k = weight.shape[0], n = weight.shape[1];
+    pthread_mutex_lock(&g_lock);
+    if(g_packs.elem_size == 0) c11_vector__ctor(&g_packs, sizeof(PackedWeight*));
+    for(int i = 0; i < g_packs.length; i++) {
+        PackedWeight* w = c11__getitem(PackedWeight*, &g_packs, i);
+        if(w->key != weight.data) continue;
+        if(w->version == weight.data->version && w->k == k && w->n == n) {
+            w->refs++;
+            pthread_mutex_unlock(&g_lock);
+            return w;
+        }
+        _remove(i);
+        break;
+    }
+    PackedWeight* w = malloc(sizeof(PackedWeight));
+    size_t bytes = (sizeof(float) * _cten_gemm_packed_size(k, n) + 63) / 64 * 64;
+    float* data = aligned_alloc(64, bytes);
+    cten_assert(w != NULL && data != NULL, "cten_prepack(): out of memory");
+    _cten_gemm_pack_b(k, n, weight.data->flex, n, 1, data);
+    *w = (PackedWeight){weight.data, weight.data->version, k, n, 2, data};
+    c11_vector__push(PackedWeight*, &g_packs, w);
+    atomic_fetch_add(&g_n_packs, 1);
+    pthread_mutex_unlock(&g_lock);
+    return w;
+}
+
+void _cten_prepack_release(PackedWeight* self) {
+    pthread_mutex_lock(&g_lock);
+    _unref(self);
+    pthread_mutex_unlock(&g_lock);
+}
+
+void _cten_prepack_forget(const FloatBuffer* data) {
+    if(atomic_load_explicit(&g_n_packs, memory_order_relaxed) == 0) return;
+    pthread_mutex_lock(&g_lock);
+    for(int i = 0; i < g_packs.length; i++) {
+        if(c11__getitem(PackedWeight*, &g_packs, i)->key == data) {
+            _remove(i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+void cten_prepack(Tensor weight) { _cten_prepack_release(_cten_prepack_acquire(weight)); }
+
+void cten_prepack_clear() {
+    pthread_mutex_lock(&g_lock);
+    while(g_packs.length > 0) {
+        _remove(g_packs.length - 1);
+    }
+    if(g_packs.elem_size != 0) c11_vector__dtor(&g_packs);
+    g_packs = (c11_vector){0};
+    pthread_mutex_unlock(&g_lock);
+}
@@ -0,0 +1,208 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cten.h"
+#include "cten_internal.h"
+
+#include "common/vector.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct ProfileEvent {
+    const char* name;
+    bool backward;
+    double start;  // microseconds since the profiler was first enabled
+    double duration;
+    TensorShape shape;
+    double flops;
+    double bytes;
+} ProfileEvent;
+
+typedef struct ProfileSummary {
+    const char* name;
+    bool backward;
+    TensorShape shape;
+    int calls;
+    double duration;
+    double flops;
+    double bytes;
+} ProfileSummary;
+
+struct Profiler {
+    int depth;
+    double origin;
+    c11_vector /*ProfileEvent*/ events;
+};
+
+static Profiler* _profiler() { return cten_context_get()->profiler; }
+
+Profiler* _cten_profiler_new() {
+    Profiler* self = calloc(1, sizeof(Profiler));
+    cten_assert(self != NULL, "cten: out of memory");
+    return self;
+}
+
+void _cten_profiler_delete(Profiler* self) {
+    c11_vector__dtor(&self->events);
+    free(self);
+}
+
+static double _now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+void cten_begin_profile() {
+    Profiler* p = _profiler();
+    if(p->events.elem_size == 0) {
+        c11_vector__ctor(&p->events, sizeof(ProfileEvent));
+        p->origin = _now_us();
+    }
+    p->depth++;
+}
+
+bool cten_is_profile() { return _profiler()->depth > 0; }
+
+void cten_end_profile() {
+    Profiler* p = _profiler();
+    assert(p->depth > 0);
+    p->depth--;
+}
+
+void cten_profile_reset() {
+    Profiler* p = _profiler();
+    c11_vector__dtor(&p->events);
+    p->events.elem_size = 0;
+    if(p->depth > 0) {
+        c11_vector__ctor(&p->events, sizeof(ProfileEvent));
+        p->origin = _now_us();
+    }
+}
+
+const char* _cten_current_op() { return cten_context_get()->current_op; }
+
+_cten_ProfileScope _cten_profile_start(const char* op) {
+    cten_context* ctx = cten_context_get();
+    _cten_ProfileScope scope = {-1, ctx->current_op};
+    ctx->current_op = op;
+    if(ctx->profiler->depth > 0) scope.start = _now_us();
+    return scope;
+}
+
+void _cten_profile_record(_cten_ProfileScope scope,
+                          const char* name,
+                          bool backward,
+                          const int* shape,
+                          double flops,
+                          double bytes) {
+    cten_context* ctx = cten_context_get();
+    ctx->current_op = scope.prev_op;
+    if(scope.start < 0) return;
+    double end = _now_us();
+    ProfileEvent* e = c11_vector__emplace(&ctx->profiler->events);
+    e->name = name != NULL ? name : "<unnamed>";
+    e->backward = backward;
+    e->start = scope.start - ctx->profiler->origin;
+    e->duration = end - scope.start;
+    memcpy(e->shape, shape, sizeof(TensorShape));
+    e->flops = flops;
+    e->bytes = bytes;
+}
+
+static int _summary_cmp(const void* a, const void* b) {
+    double da = ((const ProfileSummary*)a)->duration;
+    double db = ((const ProfileSummary*)b)->duration;
+    return (da < db) - (da > db);
+}
+
+void cten_profile_print() {
+    Profiler* p = _profiler();
+#ifndef CTEN_PROFILE
+    printf("cten profiler: library was built without CTEN_PROFILE, nothing recorded\n");
+#endif
+    // aggregate by (op, direction, shape); op times are inclusive of nested ops
+    c11_vector summaries;
+    c11_vector__ctor(&summaries, sizeof(ProfileSummary));
+    double total = 0;
+    c11__foreach(ProfileEvent, &p->events, e) {
+        ProfileSummary* s = NULL;
+        c11__foreach(ProfileSummary, &summaries, it) {
+            if(it->name == e->name && it->backward == e->backward &&
+               memcmp(it->shape, e->shape, sizeof(TensorShape)) == 0) {
+                s = it;
+                break;
+            }
+        }
+        if(s == NULL) {
+            s = c11_vector__emplace(&summaries);
+            memset(s, 0, sizeof(ProfileSummary));
+            s->name = e->name;
+            s->backward = e->backward;
+            memcpy(s->shape, e->shape, sizeof(TensorShape));
+        }
+        s->calls++;
+        s->duration += e->duration;
+        s->flops += e->flops;
+        s->bytes += e->bytes;
+        total += e->duration;
+    }
+    if(summaries.length > 0) {
+        qsort(summaries.data, summaries.length, sizeof(ProfileSummary), _summary_cmp);
+    }
+
+    printf("%-24s %-4s %-20s %8s %12s %10s %9s %9s\n",
+           "op",
+           "dir",
+           "shape",
+           "calls",
+           "total(ms)",
+           "avg(us)",
+           "GFLOP/s",
+           "GB/s");
+    c11__foreach(ProfileSummary, &summaries, s) {
+        char shape[64];
+        TensorShape_tostring(s->shape, shape, sizeof(shape));
+        double us = s->duration > 0 ? s->duration : 1e-3;
+        printf("%-24s %-4s %-20s %8d %12.3f %10.2f %9.3f %9.3f\n",
+               s->name,
+               s->backward ? "bwd" : "fwd",
+               shape,
+               s->calls,
+               s->duration * 1e-3,
+               s->duration / s->calls,
+               s->flops / us * 1e-3,
+               s->bytes / us * 1e-3);
+    }
+    printf("%d events, %.3f ms recorded\n", p->events.length, total * 1e-3);
+    c11_vector__dtor(&summaries);
+}
+
+bool cten_profile_export_trace(const char* path) {
+    Profiler* p = _profiler();
+    FILE* fp = fopen(path, "w");
+    if(fp == NULL) return false;
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for(int i = 0; i < p->events.length; i++) {
+        ProfileEvent* e = c11__at(ProfileEvent, &p->events, i);
+        fprintf(fp,
+                "{\"name\":\"%s%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                "\"pid\":0,\"tid\":0,\"args\":{\"shape\":[%d,%d,%d,%d],\"flops\":%.0f,"
+                "\"bytes\":%.0f}}%s\n",
+                e->name,
+                e->backward ? " (grad_fn)" : "",
+                e->backward ? "backward" : "forward",
+                e->start,
+                e->duration,
+                e->shape[0],
+                e->shape[1],
+                e->shape[2],
+                e->shape[3],
+                e->flops,
+                e->bytes,
+                i + 1 < p->events.length ? "," : "");
+    }
+    fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+    return fclose(fp) == 0;
+}
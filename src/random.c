@@ -0,0 +1,189 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+/* Counter-based random numbers: the Philox4x32-10 kernel maps (seed, stream, counter block) to four
+ * uniforms with no sequential state, so any element can be regenerated later from where it was
+ * drawn. Each thread draws from its own stream; the main thread is stream 0 so single-threaded
+ * runs are reproducible from cten_seed(). */
+
+typedef struct RandomStream {
+    uint64_t seed;
+    uint32_t stream;
+    uint64_t offset;  // next unused counter block
+} RandomStream;
+
+static _Atomic uint64_t g_seed = 0x853c49e6748fea9bull;
+static _Atomic uint32_t g_next_stream = 1;
+static _Thread_local bool g_stream_ready;
+static _Thread_local bool g_is_main_thread;
+static _Thread_local RandomStream g_stream;
+
+static void _philox_uniform(uint64_t seed, uint32_t stream, uint64_t offset, int n, float* out) {
+    _cten_kernels.philox_uniform(seed, stream, offset, n, out);
+}
+
+static RandomStream* _stream() {
+    if(!g_stream_ready) {
+        g_stream.seed = atomic_load(&g_seed);
+        g_stream.stream = g_is_main_thread ? 0 : atomic_fetch_add(&g_next_stream, 1);
+        g_stream.offset = 0;
+        g_stream_ready = true;
+    }
+    return &g_stream;
+}
+
+// reserves counter blocks for n outputs on the calling thread's stream
+static RandomStream _reserve(int n) {
+    RandomStream* s = _stream();
+    RandomStream res = *s;
+    s->offset += (uint64_t)(n + 3) / 4;
+    return res;
+}
+
+void _cten_random_init() {
+    g_is_main_thread = true;
+    g_stream_ready = false;
+}
+
+void cten_seed(uint64_t seed) {
+    atomic_store(&g_seed, seed);
+    g_stream_ready = false;
+}
+
+/* Samplers */
+void Tensor_uniform_(Tensor self, float low, float high) {
+    RandomStream s = _reserve(self.data->numel);
+    float* x = self.data->flex;
+    _philox_uniform(s.seed, s.stream, s.offset, self.data->numel, x);
+    for(int i = 0; i < self.data->numel; i++) {
+        x[i] = low + (high - low) * x[i];
+    }
+    self.data->version++;
+}
+
+void Tensor_normal_(Tensor self, float mean, float std) {
+    enum { CHUNK = 1024 };
+    int n = self.data->numel;
+    RandomStream s = _reserve(n + 1);
+    float u[CHUNK];
+    // Box-Muller on pairs of uniforms; an odd tail draws one extra
+    for(int i = 0; i < n; i += CHUNK) {
+        int len = n - i < CHUNK ? n - i : CHUNK;
+        _philox_uniform(s.seed, s.stream, s.offset + i / 4, (len + 1) & ~1, u);
+        for(int j = 0; j < len; j += 2) {
+            float r = sqrtf(-2.0f * logf(1.0f - u[j]));
+            float theta = 6.28318530718f * u[j + 1];
+            self.data->flex[i + j] = mean + std * r * cosf(theta);
+            if(j + 1 < len) self.data->flex[i + j + 1] = mean + std * r * sinf(theta);
+        }
+    }
+    self.data->version++;
+}
+
+Tensor Tensor_uniform(TensorShape shape, float low, float high, bool requires_grad) {
+    Tensor res = Tensor_new(shape, requires_grad);
+    Tensor_uniform_(res, low, high);
+    return res;
+}
+
+Tensor Tensor_normal(TensorShape shape, float mean, float std, bool requires_grad) {
+    Tensor res = Tensor_new(shape, requires_grad);
+    Tensor_normal_(res, mean, std);
+    return res;
+}
+
+/* Initializers */
+static void _fans(Tensor self, int* fan_in, int* fan_out) {
+    int dim = TensorShape_dim(self.shape);
+    if(dim <= 1) {
+        *fan_in = *fan_out = self.data->numel;
+    } else if(dim == 2) {
+        // linear weights are (in, out) since nn_linear computes input @ weight
+        *fan_in = self.shape[0];
+        *fan_out = self.shape[1];
+    } else {
+        // convolution weights are (out, in, kh, kw)
+        int receptive = self.data->numel / (self.shape[0] * self.shape[1]);
+        *fan_in = self.shape[1] * receptive;
+        *fan_out = self.shape[0] * receptive;
+    }
+}
+
+void nn_init_xavier_uniform(Tensor self) {
+    int fan_in, fan_out;
+    _fans(self, &fan_in, &fan_out);
+    float bound = sqrtf(6.0f / (fan_in + fan_out));
+    Tensor_uniform_(self, -bound, bound);
+}
+
+void nn_init_xavier_normal(Tensor self) {
+    int fan_in, fan_out;
+    _fans(self, &fan_in, &fan_out);
+    Tensor_normal_(self, 0, sqrtf(2.0f / (fan_in + fan_out)));
+}
+
+void nn_init_kaiming_uniform(Tensor self) {
+    int fan_in, fan_out;
+    _fans(self, &fan_in, &fan_out);
+    float bound = sqrtf(6.0f / fan_in);
+    Tensor_uniform_(self, -bound, bound);
+}
+
+void nn_init_kaiming_normal(Tensor self) {
+    int fan_in, fan_out;
+    _fans(self, &fan_in, &fan_out);
+    Tensor_normal_(self, 0, sqrtf(2.0f / fan_in));
+}
+
+/* nn.dropout */
+typedef struct DropoutCtx {
+    RandomStream rng;
+    float p;
+} DropoutCtx;
+
+// y = x * mask / (1 - p), with the mask drawn in chunks so no numel-sized buffer is needed
+static void _dropout_apply(const DropoutCtx* ctx, int n, const float* x, float* y) {
+    enum { CHUNK = 1024 };
+    float u[CHUNK];
+    float scale = 1.0f / (1.0f - ctx->p);
+    for(int i = 0; i < n; i += CHUNK) {
+        int len = n - i < CHUNK ? n - i : CHUNK;
+        _philox_uniform(ctx->rng.seed, ctx->rng.stream, ctx->rng.offset + i / 4, len, u);
+        for(int j = 0; j < len; j++) {
+            y[i + j] = u[j] >= ctx->p ? x[i + j] * scale : 0;
+        }
+    }
+}
+
+static Tensor GradFn_dropout(Tensor self, int i) {
+    // the mask is regenerated from the saved counter instead of being stored
+    Tensor res = Tensor_new(self.shape, false);
+    _dropout_apply(self.node->ctx, res.data->numel, self.node->grad.data->flex, res.data->flex);
+    return res;
+}
+
+Tensor nn_dropout(Tensor input, float p) {
+    cten_assert(p >= 0 && p < 1, "nn_dropout(): p must be in [0, 1)");
+    if(cten_is_eval() || p == 0) return input;
+    CTEN_PROFILE_BEGIN();
+    bool requires_grad = input.node != NULL;
+    Tensor res = Tensor_new(input.shape, requires_grad);
+    DropoutCtx local = {_reserve(input.data->numel), p};
+    DropoutCtx* ctx = requires_grad ? _cten_malloc(sizeof(DropoutCtx)) : &local;
+    *ctx = local;
+    _dropout_apply(ctx, input.data->numel, input.data->flex, res.data->flex);
+
+    if(requires_grad) {
+        res.node->grad_fn = GradFn_dropout;
+        res.node->name = "nn_dropout";
+        res.node->ctx = ctx;
+        res.node->inputs[0] = input;
+        res.node->n_inputs = 1;
+    }
+    CTEN_PROFILE_END(res.shape, 2.0 * res.data->numel, 2 * sizeof(float) * res.data->numel);
+    return res;
+}
@@ -0,0 +1,76 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Sums long enough to split across the worker pool. By default each thread sums one contiguous
+ * slice and the slice sums are added in order, so the result moves with cten_set_num_threads().
+ * In deterministic mode the input is cut into REDUCE_BLOCK floats per task whatever the thread
+ * count, and the block sums are combined by a pairwise tree whose shape depends only on n. */
+
+#define REDUCE_BLOCK (1 << 15)
+
+static atomic_bool g_deterministic;
+
+typedef struct SumCtx {
+    const float* x;
+    int n;
+    int n_tasks;
+    bool fixed_blocks;
+    float* partials;
+} SumCtx;
+
+static void _sum_task(void* ctx, int i) {
+    const SumCtx* c = ctx;
+    int64_t lo, hi;
+    if(c->fixed_blocks) {
+        lo = (int64_t)i * REDUCE_BLOCK;
+        hi = lo + REDUCE_BLOCK < c->n ? lo + REDUCE_BLOCK : c->n;
+    } else {
+        lo = (int64_t)c->n * i / c->n_tasks;
+        hi = (int64_t)c->n * (i + 1) / c->n_tasks;
+    }
+    c->partials[i] = _cten_kernels.sum((int)(hi - lo), c->x + lo);
+}
+
+float _cten_reduce_sum(int n, const float* x) {
+    if(n < 2 * REDUCE_BLOCK) return _cten_kernels.sum(n, x);
+    SumCtx c = {x, n, 0, cten_is_deterministic(), NULL};
+    if(c.fixed_blocks) {
+        c.n_tasks = (n + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+    } else {
+        int n_threads = cten_get_num_threads();
+        c.n_tasks = n_threads < n / REDUCE_BLOCK ? n_threads : n / REDUCE_BLOCK;
+        if(c.n_tasks <= 1) return _cten_kernels.sum(n, x);
+    }
+    c.partials = malloc(sizeof(float) * c.n_tasks);
+    cten_assert(c.partials != NULL, "_cten_reduce_sum(): out of memory");
+    _cten_parallel_for(c.n_tasks, _sum_task, &c);
+
+    float* p = c.partials;
+    if(c.fixed_blocks) {
+        for(int stride = 1; stride < c.n_tasks; stride *= 2) {
+            for(int i = 0; i + stride < c.n_tasks; i += 2 * stride) {
+                p[i] += p[i + stride];
+            }
+        }
+    } else {
+        for(int i = 1; i < c.n_tasks; i++) {
+            p[0] += p[i];
+        }
+    }
+    float sum = p[0];
+    free(p);
+    return sum;
+}
+
+void _cten_reduce_init() {
+    const char* env = getenv("CTEN_DETERMINISTIC");
+    if(env != NULL && atoi(env) > 0) cten_set_deterministic(true);
+}
+
+void cten_set_deterministic(bool enable) { atomic_store(&g_deterministic, enable); }
+
+bool cten_is_deterministic() { return atomic_load_explicit(&g_deterministic, memory_order_relaxed); }
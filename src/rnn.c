@@ -0,0 +1,450 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Recurrent layers. The input projection x @ w_ih (+ bias) of every time step is one GEMM over
+ * (B * T) rows; each step then adds h @ w_hh into its slice of that buffer and runs one fused loop
+ * over the gates. The activated gates (and the cell states / hidden projections) stay in a
+ * workspace owned by the node, which is all backward-through-time needs besides the output. */
+
+typedef struct RnnCtx {
+    int B, T, I, H;
+    Tensor h0, c0;  // (Tensor){0} for zeros
+    float* gates;   // (B * T, n_gates * H), activated
+    float* state;   // lstm: cell states (B * T, H); gru: h @ w_hn + b_hn (B * T, H)
+    Tensor grads[4];
+    Tensor g_h_n, g_c_n;  // gradients of the final states, if they are used
+} RnnCtx;
+
+static float _sigmoid(float x) { return 1.0f / (1.0f + expf(-x)); }
+
+static void* _workspace(size_t numel) {
+    float* p = malloc(sizeof(float) * numel);
+    cten_assert(p != NULL, "rnn: out of memory");
+    return p;
+}
+
+static RnnCtx* _rnn_ctx(RnnCtx* local,
+                        bool requires_grad,
+                        Tensor input,
+                        Tensor w_hh,
+                        int n_gates,
+                        Tensor h0,
+                        Tensor c0) {
+    RnnCtx* c = requires_grad ? _cten_malloc(sizeof(RnnCtx)) : local;
+    memset(c, 0, sizeof(RnnCtx));
+    c->B = input.shape[0];
+    c->T = input.shape[1];
+    c->I = input.shape[2];
+    c->H = w_hh.shape[0];
+    c->h0 = Tensor_detach(h0);
+    c->c0 = Tensor_detach(c0);
+    size_t gates = (size_t)c->B * c->T * n_gates * c->H;
+    size_t state = (size_t)c->B * c->T * c->H;
+    if(requires_grad) {
+        c->gates = _cten_malloc(sizeof(float) * gates);
+        c->state = _cten_malloc(sizeof(float) * state);
+    } else {
+        c->gates = _workspace(gates);
+        c->state = _workspace(state);
+    }
+    return c;
+}
+
+static void _rnn_check(const char* name,
+                       Tensor input,
+                       Tensor w_ih,
+                       Tensor w_hh,
+                       int n_gates,
+                       Tensor h0,
+                       Tensor c0) {
+    cten_assert(TensorShape_dim(input.shape) == 3, "%s(): input must be (B, T, I)", name);
+    cten_assert(TensorShape_dim(w_hh.shape) == 2 && w_hh.shape[1] == n_gates * w_hh.shape[0],
+                "%s(): w_hh must be (H, %d * H)",
+                name,
+                n_gates);
+    int H = w_hh.shape[0];
+    cten_assert(TensorShape_dim(w_ih.shape) == 2 && w_ih.shape[0] == input.shape[2] &&
+                    w_ih.shape[1] == n_gates * H,
+                "%s(): w_ih must be (I, %d * H)",
+                name,
+                n_gates);
+    if(h0.data != NULL) cten_assert_dim("rnn h0 numel", h0.data->numel, input.shape[0] * H);
+    if(c0.data != NULL) cten_assert_dim("rnn c0 numel", c0.data->numel, input.shape[0] * H);
+}
+
+// xp[B * T, G] = x[B * T, I] @ w_ih (+ bias row)
+static void _input_projection(const RnnCtx* c,
+                              Tensor input,
+                              Tensor w_ih,
+                              const float* bias,
+                              int G) {
+    int BT = c->B * c->T;
+    if(bias != NULL) {
+        for(int r = 0; r < BT; r++) {
+            memcpy(c->gates + (size_t)r * G, bias, sizeof(float) * G);
+        }
+    }
+    _cten_gemm(BT,
+               G,
+               c->I,
+               input.data->flex,
+               c->I,
+               1,
+               w_ih.data->flex,
+               G,
+               1,
+               c->gates,
+               G,
+               bias != NULL);
+}
+
+// h_prev[B * T, H]: row (b, t) is the hidden state that step t of batch b started from
+static float* _shifted_hidden(const RnnCtx* c, const float* out) {
+    float* h_prev = _workspace((size_t)c->B * c->T * c->H);
+    for(int b = 0; b < c->B; b++) {
+        float* dst = h_prev + (size_t)b * c->T * c->H;
+        if(c->h0.data != NULL) {
+            memcpy(dst, c->h0.data->flex + b * c->H, sizeof(float) * c->H);
+        } else {
+            memset(dst, 0, sizeof(float) * c->H);
+        }
+        memcpy(dst + c->H, out + (size_t)b * c->T * c->H, sizeof(float) * (c->T - 1) * c->H);
+    }
+    return h_prev;
+}
+
+// the gradients shared by both layers once dgates[B * T, G] is known
+static void _rnn_param_grads(RnnCtx* c,
+                             Tensor self,
+                             const float* dgates,
+                             int G,
+                             const float* dgates_h,
+                             float* dbias) {
+    int BT = c->B * c->T;
+    Tensor input = self.node->inputs[0];
+    Tensor w_ih = self.node->inputs[1];
+    // dx = dgates @ w_ih^T, dw_ih = x^T @ dgates, dw_hh = h_prev^T @ dgates_h
+    float* dx = c->grads[0].data->flex;
+    float* dw_ih = c->grads[1].data->flex;
+    float* dw_hh = c->grads[2].data->flex;
+    _cten_gemm(BT, c->I, G, dgates, G, 1, w_ih.data->flex, 1, G, dx, c->I, false);
+    _cten_gemm(c->I, G, BT, input.data->flex, 1, c->I, dgates, G, 1, dw_ih, G, false);
+    float* h_prev = _shifted_hidden(c, self.data->flex);
+    _cten_gemm(c->H, G, BT, h_prev, 1, c->H, dgates_h, G, 1, dw_hh, G, false);
+    free(h_prev);
+    if(dbias == NULL) return;
+    for(int r = 0; r < BT; r++) {
+        _cten_kernels.add(G, dbias, dgates + (size_t)r * G, dbias);
+    }
+}
+
+// dst = the final state's gradient, or zeros if it was not used
+static void _rnn_init_grad(Tensor g, float* dst, int numel) {
+    if(g.data != NULL) {
+        memcpy(dst, g.data->flex, sizeof(float) * numel);
+    } else {
+        memset(dst, 0, sizeof(float) * numel);
+    }
+}
+
+static void _rnn_alloc_grads(RnnCtx* c, Tensor self) {
+    for(int i = 0; i < self.node->n_inputs; i++) {
+        c->grads[i] = Tensor_zeros(self.node->inputs[i].shape, false);
+    }
+}
+
+/* The final states are copies of the last step. Their gradients are kept in the context for the
+ * layer's grad_fn, which starts backward-through-time from them; the output gets a (zero)
+ * gradient so that grad_fn runs even if nothing else reads the output */
+static Tensor GradFn_h_n(Tensor self, int i) {
+    RnnCtx* c = self.node->inputs[0].node->ctx;
+    c->g_h_n = self.node->grad;
+    _cten_grad_dense(self.node->inputs[i]);
+    return (Tensor){0};
+}
+
+static Tensor GradFn_c_n(Tensor self, int i) {
+    RnnCtx* c = self.node->inputs[0].node->ctx;
+    c->g_c_n = self.node->grad;
+    _cten_grad_dense(self.node->inputs[i]);
+    return (Tensor){0};
+}
+
+static void _rnn_final_state(const RnnCtx* c,
+                             const float* states,
+                             Tensor res,
+                             Tensor (*grad_fn)(Tensor, int),
+                             const char* name,
+                             Tensor* out) {
+    if(out == NULL) return;
+    *out = Tensor_new((TensorShape){c->B, c->H}, res.node != NULL);
+    for(int b = 0; b < c->B; b++) {
+        memcpy(out->data->flex + b * c->H,
+               states + ((size_t)b * c->T + c->T - 1) * c->H,
+               sizeof(float) * c->H);
+    }
+    if(res.node != NULL) {
+        out->node->grad_fn = grad_fn;
+        out->node->name = name;
+        out->node->inputs[0] = res;
+        out->node->n_inputs = 1;
+    }
+}
+
+static void _rnn_set_inputs(Tensor res, Tensor input, Tensor w_ih, Tensor w_hh, Tensor bias) {
+    res.node->inputs[0] = input;
+    res.node->inputs[1] = w_ih;
+    res.node->inputs[2] = w_hh;
+    res.node->n_inputs = 3;
+    if(bias.data != NULL) res.node->inputs[res.node->n_inputs++] = bias;
+}
+
+/* nn.lstm */
+static Tensor GradFn_lstm(Tensor self, int i) {
+    RnnCtx* c = self.node->ctx;
+    if(c->grads[0].data != NULL) return c->grads[i];
+    _rnn_alloc_grads(c, self);
+
+    int B = c->B, T = c->T, H = c->H, G = 4 * H;
+    const float* g_out = self.node->grad.data->flex;
+    const float* w_hh = self.node->inputs[2].data->flex;
+    float* dgates = _workspace((size_t)B * T * G);
+    float* dh_next = _workspace((size_t)B * H);
+    float* dc_next = _workspace((size_t)B * H);
+    _rnn_init_grad(c->g_h_n, dh_next, B * H);
+    _rnn_init_grad(c->g_c_n, dc_next, B * H);
+
+    for(int t = T - 1; t >= 0; t--) {
+        for(int b = 0; b < B; b++) {
+            size_t row = (size_t)b * T + t;
+            const float* gate = c->gates + row * G;
+            const float* c_t = c->state + row * H;
+            const float* c_prev = t > 0                 ? c->state + (row - 1) * H
+                                  : c->c0.data != NULL ? c->c0.data->flex + b * H
+                                                       : NULL;
+            float* dgate = dgates + row * G;
+            for(int j = 0; j < H; j++) {
+                float ig = gate[j], fg = gate[H + j], gg = gate[2 * H + j], og = gate[3 * H + j];
+                float tc = tanhf(c_t[j]);
+                float dh = g_out[row * H + j] + dh_next[b * H + j];
+                float dc = dc_next[b * H + j] + dh * og * (1 - tc * tc);
+                float cp = c_prev != NULL ? c_prev[j] : 0;
+                dgate[j] = dc * gg * ig * (1 - ig);
+                dgate[H + j] = dc * cp * fg * (1 - fg);
+                dgate[2 * H + j] = dc * ig * (1 - gg * gg);
+                dgate[3 * H + j] = dh * tc * og * (1 - og);
+                dc_next[b * H + j] = dc * fg;
+            }
+        }
+        // dh_next = dgates[:, t] @ w_hh^T
+        _cten_gemm(B, H, G, dgates + (size_t)t * G, T * G, 1, w_hh, 1, G, dh_next, H, false);
+    }
+
+    bool has_bias = self.node->n_inputs > 3;
+    _rnn_param_grads(c, self, dgates, G, dgates, has_bias ? c->grads[3].data->flex : NULL);
+    free(dc_next);
+    free(dh_next);
+    free(dgates);
+    return c->grads[i];
+}
+
+Tensor nn_lstm(Tensor input,
+               Tensor w_ih,
+               Tensor w_hh,
+               Tensor bias,
+               Tensor h0,
+               Tensor c0,
+               Tensor* h_n,
+               Tensor* c_n) {
+    CTEN_PROFILE_BEGIN();
+    _rnn_check("nn_lstm", input, w_ih, w_hh, 4, h0, c0);
+    if(bias.data != NULL) cten_assert_dim("nn_lstm() bias numel", bias.data->numel, w_ih.shape[1]);
+    bool requires_grad = !cten_is_eval() && (input.node != NULL || w_ih.node != NULL ||
+                                             w_hh.node != NULL || bias.node != NULL);
+    RnnCtx local;
+    RnnCtx* c = _rnn_ctx(&local, requires_grad, input, w_hh, 4, h0, c0);
+    int B = c->B, T = c->T, H = c->H, G = 4 * H;
+    Tensor res = Tensor_new((TensorShape){B, T, H}, requires_grad);
+    float* out = res.data->flex;
+
+    _input_projection(c, input, w_ih, bias.data != NULL ? bias.data->flex : NULL, G);
+    for(int t = 0; t < T; t++) {
+        // gates[:, t] += h_{t-1} @ w_hh, where h_{t-1} rows are T * H apart in the output
+        const float* h_prev = t > 0 ? out + (t - 1) * H : h0.data != NULL ? h0.data->flex : NULL;
+        int h_rs = t > 0 ? T * H : H;
+        float* gates_t = c->gates + (size_t)t * G;
+        if(h_prev != NULL) {
+            _cten_gemm(B, G, H, h_prev, h_rs, 1, w_hh.data->flex, G, 1, gates_t, T * G, true);
+        }
+        for(int b = 0; b < B; b++) {
+            size_t row = (size_t)b * T + t;
+            float* gate = c->gates + row * G;
+            float* c_t = c->state + row * H;
+            const float* c_prev = t > 0            ? c_t - H
+                                  : c0.data != NULL ? c0.data->flex + b * H
+                                                    : NULL;
+            float* h_t = out + row * H;
+            for(int j = 0; j < H; j++) {
+                float ig = _sigmoid(gate[j]);
+                float fg = _sigmoid(gate[H + j]);
+                float gg = tanhf(gate[2 * H + j]);
+                float og = _sigmoid(gate[3 * H + j]);
+                c_t[j] = fg * (c_prev != NULL ? c_prev[j] : 0) + ig * gg;
+                h_t[j] = og * tanhf(c_t[j]);
+                gate[j] = ig;
+                gate[H + j] = fg;
+                gate[2 * H + j] = gg;
+                gate[3 * H + j] = og;
+            }
+        }
+    }
+    if(requires_grad) {
+        res.node->grad_fn = GradFn_lstm;
+        res.node->name = "nn_lstm";
+        res.node->ctx = c;
+        _rnn_set_inputs(res, input, w_ih, w_hh, bias);
+    }
+    _rnn_final_state(c, out, res, GradFn_h_n, "nn_lstm.h_n", h_n);
+    _rnn_final_state(c, c->state, res, GradFn_c_n, "nn_lstm.c_n", c_n);
+    if(!requires_grad) {
+        free(c->gates);
+        free(c->state);
+    }
+    CTEN_PROFILE_END(res.shape,
+                     2.0 * B * T * G * (c->I + H),
+                     sizeof(float) * (input.data->numel + (size_t)B * T * (G + 2 * H)));
+    return res;
+}
+
+/* nn.gru */
+static Tensor GradFn_gru(Tensor self, int i) {
+    RnnCtx* c = self.node->ctx;
+    if(c->grads[0].data != NULL) return c->grads[i];
+    _rnn_alloc_grads(c, self);
+
+    int B = c->B, T = c->T, H = c->H, G = 3 * H;
+    const float* g_out = self.node->grad.data->flex;
+    const float* out = self.data->flex;
+    const float* w_hh = self.node->inputs[2].data->flex;
+    // dgates: w.r.t. the input projection; dgates_h: w.r.t. h @ w_hh + b_hh (differs in n)
+    float* dgates = _workspace((size_t)B * T * G);
+    float* dgates_h = _workspace((size_t)B * T * G);
+    float* dh_next = _workspace((size_t)B * H);
+    _rnn_init_grad(c->g_h_n, dh_next, B * H);
+
+    for(int t = T - 1; t >= 0; t--) {
+        for(int b = 0; b < B; b++) {
+            size_t row = (size_t)b * T + t;
+            const float* gate = c->gates + row * G;
+            const float* hn = c->state + row * H;
+            const float* h_prev = t > 0                 ? out + (row - 1) * H
+                                  : c->h0.data != NULL ? c->h0.data->flex + b * H
+                                                       : NULL;
+            float* dgate = dgates + row * G;
+            float* dgate_h = dgates_h + row * G;
+            for(int j = 0; j < H; j++) {
+                float r = gate[j], z = gate[H + j], n = gate[2 * H + j];
+                float hp = h_prev != NULL ? h_prev[j] : 0;
+                float dh = g_out[row * H + j] + dh_next[b * H + j];
+                float dn = dh * (1 - z) * (1 - n * n);
+                float dr = dn * hn[j] * r * (1 - r);
+                float dz = dh * (hp - n) * z * (1 - z);
+                dgate[j] = dgate_h[j] = dr;
+                dgate[H + j] = dgate_h[H + j] = dz;
+                dgate[2 * H + j] = dn;
+                dgate_h[2 * H + j] = dn * r;
+                dh_next[b * H + j] = dh * z;
+            }
+        }
+        // dh_next += dgates_h[:, t] @ w_hh^T
+        _cten_gemm(B, H, G, dgates_h + (size_t)t * G, T * G, 1, w_hh, 1, G, dh_next, H, true);
+    }
+
+    bool has_bias = self.node->n_inputs > 3;
+    float* dbias = has_bias ? c->grads[3].data->flex : NULL;
+    _rnn_param_grads(c, self, dgates, G, dgates_h, dbias);
+    if(has_bias) {
+        for(int r = 0; r < B * T; r++) {
+            _cten_kernels.add(G, dbias + G, dgates_h + (size_t)r * G, dbias + G);
+        }
+    }
+    free(dh_next);
+    free(dgates_h);
+    free(dgates);
+    return c->grads[i];
+}
+
+Tensor nn_gru(Tensor input, Tensor w_ih, Tensor w_hh, Tensor bias, Tensor h0, Tensor* h_n) {
+    CTEN_PROFILE_BEGIN();
+    _rnn_check("nn_gru", input, w_ih, w_hh, 3, h0, (Tensor){0});
+    if(bias.data != NULL) {
+        cten_assert_dim("nn_gru() bias numel", bias.data->numel, 2 * w_ih.shape[1]);
+    }
+    bool requires_grad = !cten_is_eval() && (input.node != NULL || w_ih.node != NULL ||
+                                             w_hh.node != NULL || bias.node != NULL);
+    RnnCtx local;
+    RnnCtx* c = _rnn_ctx(&local, requires_grad, input, w_hh, 3, h0, (Tensor){0});
+    int B = c->B, T = c->T, H = c->H, G = 3 * H;
+    Tensor res = Tensor_new((TensorShape){B, T, H}, requires_grad);
+    float* out = res.data->flex;
+    const float* b_hh = bias.data != NULL ? bias.data->flex + G : NULL;
+    float* hidden = _workspace((size_t)B * G);
+
+    _input_projection(c, input, w_ih, bias.data != NULL ? bias.data->flex : NULL, G);
+    for(int t = 0; t < T; t++) {
+        // hidden = h_{t-1} @ w_hh + b_hh, kept apart since r only scales its n part
+        const float* h_prev = t > 0 ? out + (t - 1) * H : h0.data != NULL ? h0.data->flex : NULL;
+        int h_rs = t > 0 ? T * H : H;
+        for(int b = 0; b < B; b++) {
+            if(b_hh != NULL) {
+                memcpy(hidden + b * G, b_hh, sizeof(float) * G);
+            } else {
+                memset(hidden + b * G, 0, sizeof(float) * G);
+            }
+        }
+        if(h_prev != NULL) {
+            _cten_gemm(B, G, H, h_prev, h_rs, 1, w_hh.data->flex, G, 1, hidden, G, true);
+        }
+        for(int b = 0; b < B; b++) {
+            size_t row = (size_t)b * T + t;
+            float* gate = c->gates + row * G;
+            const float* hid = hidden + b * G;
+            const float* hp = t > 0            ? out + (row - 1) * H
+                              : h0.data != NULL ? h0.data->flex + b * H
+                                                : NULL;
+            float* hn = c->state + row * H;
+            float* h_t = out + row * H;
+            for(int j = 0; j < H; j++) {
+                float r = _sigmoid(gate[j] + hid[j]);
+                float z = _sigmoid(gate[H + j] + hid[H + j]);
+                float n = tanhf(gate[2 * H + j] + r * hid[2 * H + j]);
+                hn[j] = hid[2 * H + j];
+                h_t[j] = (1 - z) * n + z * (hp != NULL ? hp[j] : 0);
+                gate[j] = r;
+                gate[H + j] = z;
+                gate[2 * H + j] = n;
+            }
+        }
+    }
+    free(hidden);
+
+    if(requires_grad) {
+        res.node->grad_fn = GradFn_gru;
+        res.node->name = "nn_gru";
+        res.node->ctx = c;
+        _rnn_set_inputs(res, input, w_ih, w_hh, bias);
+    }
+    _rnn_final_state(c, out, res, GradFn_h_n, "nn_gru.h_n", h_n);
+    if(!requires_grad) {
+        free(c->gates);
+        free(c->state);
+    }
+    CTEN_PROFILE_END(res.shape,
+                     2.0 * B * T * G * (c->I + H),
+                     sizeof(float) * (input.data->numel + (size_t)B * T * (G + 2 * H)));
+    return res;
+}
@@ -0,0 +1,364 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cten.h"
+#include "cten_internal.h"
+
+#include "common/vector.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Callers enqueue a Request that lives on their own stack and sleep until a worker has run the
+ * batch it landed in. A worker takes the queue once it holds max_batch requests or the oldest one
+ * has waited max_delay_us, and runs the forward in its own thread's context, so batches never
+ * touch the pools of the threads that submitted them. */
+
+typedef struct Request {
+    const float* input;
+    float* output;
+    struct timespec arrival;
+    bool done;
+    bool ok;
+    struct Request* next;
+} Request;
+
+struct cten_server {
+    cten_forward_fn forward;
+    void* model;
+    int n_inputs;
+    int n_outputs;
+    int max_batch;
+    int max_delay_us;
+
+    pthread_mutex_t lock;
+    pthread_cond_t queue_cv;  // CLOCK_MONOTONIC, for the batching deadline
+    pthread_cond_t done_cv;
+    Request* head;
+    Request* tail;
+    int queued;
+    bool stop;
+    int in_flight;  // cten_server_infer() calls that have not returned
+    ServerStats stats;
+
+    pthread_t* workers;
+    int n_workers;
+
+    // Unix socket front end
+    int listen_fd;
+    char* path;
+    pthread_t acceptor;
+    c11_vector /*int*/ connections;
+};
+
+static struct timespec _deadline(struct timespec t, int delay_us) {
+    t.tv_nsec += (long)delay_us * 1000;
+    t.tv_sec += t.tv_nsec / 1000000000;
+    t.tv_nsec %= 1000000000;
+    return t;
+}
+
+static void _run_batch(cten_server* self, Request** batch, int n) {
+    cten_begin_malloc(0);
+    Tensor input = Tensor_new((TensorShape){n, self->n_inputs}, false);
+    for(int i = 0; i < n; i++) {
+        memcpy(input.data->flex + i * self->n_inputs,
+               batch[i]->input,
+               sizeof(float) * self->n_inputs);
+    }
+    Tensor output = self->forward(self->model, input);
+    cten_assert_dim("cten_server forward() output numel", output.data->numel, n * self->n_outputs);
+    for(int i = 0; i < n; i++) {
+        memcpy(batch[i]->output,
+               output.data->flex + i * self->n_outputs,
+               sizeof(float) * self->n_outputs);
+    }
+    cten_end_malloc();
+    cten_free(0);
+}
+
+static void* _worker_main(void* arg) {
+    cten_server* self = arg;
+    Request** batch = malloc(sizeof(Request*) * self->max_batch);
+    cten_assert(batch != NULL, "cten_server: out of memory");
+    cten_begin_eval();
+    pthread_mutex_lock(&self->lock);
+    while(true) {
+        while(!self->stop && self->head == NULL) {
+            pthread_cond_wait(&self->queue_cv, &self->lock);
+        }
+        if(self->stop) break;
+        struct timespec deadline = _deadline(self->head->arrival, self->max_delay_us);
+        while(!self->stop && self->queued < self->max_batch) {
+            int err = pthread_cond_timedwait(&self->queue_cv, &self->lock, &deadline);
+            if(err == ETIMEDOUT) break;
+        }
+        if(self->stop) break;
+        // another worker may have taken the batch while this one waited
+        if(self->head == NULL) continue;
+
+        int n = 0;
+        while(self->head != NULL && n < self->max_batch) {
+            batch[n++] = self->head;
+            self->head = self->head->next;
+        }
+        if(self->head == NULL) self->tail = NULL;
+        self->queued -= n;
+        pthread_mutex_unlock(&self->lock);
+
+        _run_batch(self, batch, n);
+
+        pthread_mutex_lock(&self->lock);
+        for(int i = 0; i < n; i++) {
+            batch[i]->ok = true;
+            batch[i]->done = true;
+        }
+        self->stats.requests += n;
+        self->stats.batches++;
+        pthread_cond_broadcast(&self->done_cv);
+    }
+    pthread_mutex_unlock(&self->lock);
+    cten_end_eval();
+    free(batch);
+    return NULL;
+}
+
+cten_server* cten_server_new(cten_forward_fn forward,
+                             void* model,
+                             int n_inputs,
+                             int n_outputs,
+                             int max_batch,
+                             int max_delay_us,
+                             int n_workers) {
+    cten_assert(n_inputs > 0 && n_outputs > 0, "cten_server_new(): empty inputs or outputs");
+    cten_assert(max_batch > 0 && max_delay_us >= 0 && n_workers > 0,
+                "cten_server_new(): invalid batching config");
+    cten_server* self = calloc(1, sizeof(cten_server));
+    cten_assert(self != NULL, "cten_server_new(): out of memory");
+    self->forward = forward;
+    self->model = model;
+    self->n_inputs = n_inputs;
+    self->n_outputs = n_outputs;
+    self->max_batch = max_batch;
+    self->max_delay_us = max_delay_us;
+    self->listen_fd = -1;
+    c11_vector__ctor(&self->connections, sizeof(int));
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->queue_cv, &attr);
+    pthread_cond_init(&self->done_cv, NULL);
+    pthread_condattr_destroy(&attr);
+
+    self->workers = malloc(sizeof(pthread_t) * n_workers);
+    cten_assert(self->workers != NULL, "cten_server_new(): out of memory");
+    for(int i = 0; i < n_workers; i++) {
+        int err = pthread_create(&self->workers[i], NULL, _worker_main, self);
+        cten_assert(err == 0, "cten_server_new(): cannot start worker: %s", strerror(err));
+        self->n_workers++;
+    }
+    return self;
+}
+
+bool cten_server_infer(cten_server* self, const float* input, float* output) {
+    Request req = {.input = input, .output = output};
+    clock_gettime(CLOCK_MONOTONIC, &req.arrival);
+    pthread_mutex_lock(&self->lock);
+    if(self->stop) {
+        pthread_mutex_unlock(&self->lock);
+        return false;
+    }
+    self->in_flight++;
+    if(self->tail != NULL) {
+        self->tail->next = &req;
+    } else {
+        self->head = &req;
+    }
+    self->tail = &req;
+    self->queued++;
+    // wake a worker for the first request (to start the deadline) and for a full batch
+    if(self->queued == 1 || self->queued >= self->max_batch) {
+        pthread_cond_broadcast(&self->queue_cv);
+    }
+    while(!req.done) {
+        pthread_cond_wait(&self->done_cv, &self->lock);
+    }
+    self->in_flight--;
+    if(self->in_flight == 0) pthread_cond_broadcast(&self->done_cv);
+    pthread_mutex_unlock(&self->lock);
+    return req.ok;
+}
+
+ServerStats cten_server_stats(cten_server* self) {
+    pthread_mutex_lock(&self->lock);
+    ServerStats stats = self->stats;
+    pthread_mutex_unlock(&self->lock);
+    return stats;
+}
+
+/* Unix socket front end: one thread per connection, each frame is n_inputs native-endian floats
+ * answered by n_outputs floats */
+typedef struct Connection {
+    cten_server* server;
+    int fd;
+} Connection;
+
+static bool _read_full(int fd, void* buf, size_t size) {
+    char* p = buf;
+    while(size > 0) {
+        ssize_t n = read(fd, p, size);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool _write_full(int fd, const void* buf, size_t size) {
+    const char* p = buf;
+    while(size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static void* _connection_main(void* arg) {
+    Connection conn = *(Connection*)arg;
+    free(arg);
+    cten_server* self = conn.server;
+    float* input = malloc(sizeof(float) * (self->n_inputs + self->n_outputs));
+    float* output = input + self->n_inputs;
+    while(input != NULL && _read_full(conn.fd, input, sizeof(float) * self->n_inputs)) {
+        if(!cten_server_infer(self, input, output)) break;
+        if(!_write_full(conn.fd, output, sizeof(float) * self->n_outputs)) break;
+    }
+    free(input);
+
+    pthread_mutex_lock(&self->lock);
+    for(int i = 0; i < self->connections.length; i++) {
+        if(c11__getitem(int, &self->connections, i) == conn.fd) {
+            c11_vector__erase(int, &self->connections, i);
+            break;
+        }
+    }
+    close(conn.fd);
+    pthread_cond_broadcast(&self->done_cv);
+    pthread_mutex_unlock(&self->lock);
+    return NULL;
+}
+
+static void* _acceptor_main(void* arg) {
+    cten_server* self = arg;
+    while(true) {
+        int fd = accept(self->listen_fd, NULL, NULL);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            break;  // shut down by cten_server_delete()
+        }
+        Connection* conn = malloc(sizeof(Connection));
+        pthread_mutex_lock(&self->lock);
+        pthread_t thread;
+        if(self->stop || conn == NULL) {
+            pthread_mutex_unlock(&self->lock);
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->server = self;
+        conn->fd = fd;
+        if(pthread_create(&thread, NULL, _connection_main, conn) != 0) {
+            pthread_mutex_unlock(&self->lock);
+            free(conn);
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+        c11_vector__push(int, &self->connections, fd);
+        pthread_mutex_unlock(&self->lock);
+    }
+    return NULL;
+}
+
+bool cten_server_listen(cten_server* self, const char* path) {
+    cten_assert(self->listen_fd < 0, "cten_server_listen(): already listening");
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if(strlen(path) >= sizeof(addr.sun_path)) return false;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return false;
+    unlink(path);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        close(fd);
+        return false;
+    }
+    self->listen_fd = fd;
+    self->path = malloc(strlen(path) + 1);
+    cten_assert(self->path != NULL, "cten_server_listen(): out of memory");
+    strcpy(self->path, path);
+    if(pthread_create(&self->acceptor, NULL, _acceptor_main, self) != 0) {
+        close(fd);
+        unlink(path);
+        free(self->path);
+        self->path = NULL;
+        self->listen_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void cten_server_delete(cten_server* self) {
+    if(self == NULL) return;
+    pthread_mutex_lock(&self->lock);
+    self->stop = true;
+    pthread_cond_broadcast(&self->queue_cv);
+    pthread_mutex_unlock(&self->lock);
+
+    // no new connections, then wake the connection threads blocked in read()
+    if(self->listen_fd >= 0) {
+        shutdown(self->listen_fd, SHUT_RDWR);
+        pthread_join(self->acceptor, NULL);
+        close(self->listen_fd);
+        unlink(self->path);
+        free(self->path);
+    }
+    pthread_mutex_lock(&self->lock);
+    c11__foreach(int, &self->connections, fd) {
+        shutdown(*fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    for(int i = 0; i < self->n_workers; i++) {
+        pthread_join(self->workers[i], NULL);
+    }
+    // fail whatever never made it into a batch and wait for every caller to leave
+    pthread_mutex_lock(&self->lock);
+    for(Request* req = self->head; req != NULL; req = req->next) {
+        req->done = true;
+    }
+    self->head = self->tail = NULL;
+    self->queued = 0;
+    pthread_cond_broadcast(&self->done_cv);
+    while(self->in_flight > 0 || self->connections.length > 0) {
+        pthread_cond_wait(&self->done_cv, &self->lock);
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    c11_vector__dtor(&self->connections);
+    pthread_cond_destroy(&self->done_cv);
+    pthread_cond_destroy(&self->queue_cv);
+    pthread_mutex_destroy(&self->lock);
+    free(self->workers);
+    free(self);
+}
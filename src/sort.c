@@ -0,0 +1,219 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Selection along one dim, viewed as (outer, d, inner) like in src/index.c. Each (outer, inner)
+ * pair is a row of d elements, strided by inner; rows are split across the worker pool in blocks
+ * of about SORT_TASK_NUMEL elements. Top-k keeps a k-element heap per row, so it costs
+ * O(d log k) rather than a full sort. Only indices are computed here: values come from
+ * Tensor_gather(), which also provides the gradient. */
+
+#define SORT_TASK_NUMEL (1 << 15)
+
+typedef struct Ranked {
+    float value;
+    int index;
+} Ranked;
+
+// whether a ranks before b: larger (or smaller) first with NaN beyond every number, then the lower
+// index, so the order is total and ties are stable
+static inline bool _before(Ranked a, Ranked b, bool largest) {
+    bool a_nan = isnan(a.value), b_nan = isnan(b.value);
+    if(a_nan || b_nan) {
+        if(a_nan != b_nan) return largest ? a_nan : b_nan;
+    } else if(a.value != b.value) {
+        return largest ? a.value > b.value : a.value < b.value;
+    }
+    return a.index < b.index;
+}
+
+static int _cmp_largest(const void* a, const void* b) {
+    return _before(*(const Ranked*)a, *(const Ranked*)b, true) ? -1 : 1;
+}
+
+static int _cmp_smallest(const void* a, const void* b) {
+    return _before(*(const Ranked*)a, *(const Ranked*)b, false) ? -1 : 1;
+}
+
+// heap with the worst-ranked element at the root
+static void _sift_down(Ranked* heap, int n, int i, bool largest) {
+    while(true) {
+        int worst = i, l = 2 * i + 1, r = l + 1;
+        if(l < n && _before(heap[worst], heap[l], largest)) worst = l;
+        if(r < n && _before(heap[worst], heap[r], largest)) worst = r;
+        if(worst == i) return;
+        Ranked tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+// the k best of row[0 .. d - 1] into heap[0 .. k - 1], best first
+static void _select(const float* row, int64_t stride, int d, int k, bool largest, Ranked* heap) {
+    if(k == d) {
+        for(int j = 0; j < d; j++) {
+            heap[j] = (Ranked){row[j * stride], j};
+        }
+        qsort(heap, d, sizeof(Ranked), largest ? _cmp_largest : _cmp_smallest);
+        return;
+    }
+    for(int j = 0; j < k; j++) {
+        heap[j] = (Ranked){row[j * stride], j};
+    }
+    for(int i = k / 2 - 1; i >= 0; i--) {
+        _sift_down(heap, k, i, largest);
+    }
+    for(int j = k; j < d; j++) {
+        Ranked x = {row[j * stride], j};
+        if(_before(x, heap[0], largest)) {
+            heap[0] = x;
+            _sift_down(heap, k, 0, largest);
+        }
+    }
+    // heapsort: the worst moves to the back each round
+    for(int n = k - 1; n > 0; n--) {
+        Ranked tmp = heap[0];
+        heap[0] = heap[n];
+        heap[n] = tmp;
+        _sift_down(heap, n, 0, largest);
+    }
+}
+
+typedef struct SelectCtx {
+    const float* x;
+    int* indices;  // (outer, k, inner)
+    int outer, d, inner, k;
+    bool largest;
+    int rows_per_task;
+} SelectCtx;
+
+static void _select_rows(void* ctx, int task) {
+    const SelectCtx* c = ctx;
+    int n_rows = c->outer * c->inner;
+    int r0 = task * c->rows_per_task;
+    int r1 = r0 + c->rows_per_task < n_rows ? r0 + c->rows_per_task : n_rows;
+    Ranked* heap = malloc(sizeof(Ranked) * c->k);
+    cten_assert(heap != NULL, "Tensor_topk(): out of memory");
+    for(int row = r0; row < r1; row++) {
+        int o = row / c->inner, kk = row % c->inner;
+        const float* x = c->x + (size_t)o * c->d * c->inner + kk;
+        _select(x, c->inner, c->d, c->k, c->largest, heap);
+        int* out = c->indices + (size_t)o * c->k * c->inner + kk;
+        for(int j = 0; j < c->k; j++) {
+            out[(size_t)j * c->inner] = heap[j].index;
+        }
+    }
+    free(heap);
+}
+
+static int _rows_per_task(int d) {
+    int rows = SORT_TASK_NUMEL / d;
+    return rows > 0 ? rows : 1;
+}
+
+Tensor Tensor_topk(Tensor self, int dim, int k, bool largest, int* indices) {
+    CTEN_PROFILE_BEGIN();
+    dim = TensorShape_asdim(self.shape, dim);
+    int d = self.shape[dim];
+    cten_assert(k > 0 && k <= d, "Tensor_topk(): k = %d out of range [1, %d]", k, d);
+    TensorShape shape;
+    memcpy(shape, self.shape, sizeof(TensorShape));
+    shape[dim] = k;
+    int numel = self.data->numel / d * k;
+    int* idx = indices != NULL ? indices : malloc(sizeof(int) * numel);
+    cten_assert(idx != NULL, "Tensor_topk(): out of memory");
+
+    SelectCtx c = {self.data->flex, idx, 1, d, 1, k, largest, _rows_per_task(d)};
+    for(int i = 0; i < dim; i++) {
+        c.outer *= self.shape[i];
+    }
+    c.inner = self.data->numel / (c.outer * d);
+    int n_rows = c.outer * c.inner;
+    _cten_parallel_for((n_rows + c.rows_per_task - 1) / c.rows_per_task, _select_rows, &c);
+    CTEN_PROFILE_END(shape, self.data->numel, sizeof(float) * self.data->numel);
+
+    Tensor res = Tensor_gather(self, dim, idx, shape);
+    if(indices == NULL) free(idx);
+    return res;
+}
+
+Tensor Tensor_sort(Tensor self, int dim, bool descending, int* indices) {
+    dim = TensorShape_asdim(self.shape, dim);
+    return Tensor_topk(self, dim, self.shape[dim], descending, indices);
+}
+
+/* Tensor_argmax_dim, Tensor_argmin_dim */
+typedef struct ArgCtx {
+    const float* x;
+    int* out;  // (outer, inner)
+    int outer, d, inner;
+    bool largest;
+    int units_per_task;
+    int col_block;
+} ArgCtx;
+
+/* every unit is one outer index and a block of inner columns, scanned along d together, so
+ * contiguous columns vectorize */
+static void _arg_rows(void* ctx, int task) {
+    const ArgCtx* c = ctx;
+    int n_blocks = (c->inner + c->col_block - 1) / c->col_block;
+    int n_units = c->outer * n_blocks;
+    int u0 = task * c->units_per_task;
+    int u1 = u0 + c->units_per_task < n_units ? u0 + c->units_per_task : n_units;
+    float best[64];
+    for(int u = u0; u < u1; u++) {
+        int o = u / n_blocks;
+        int k0 = u % n_blocks * c->col_block;
+        int n = k0 + c->col_block < c->inner ? c->col_block : c->inner - k0;
+        const float* x = c->x + (size_t)o * c->d * c->inner + k0;
+        int* out = c->out + (size_t)o * c->inner + k0;
+        for(int k = 0; k < n; k++) {
+            best[k] = x[k];
+            out[k] = 0;
+        }
+        for(int j = 1; j < c->d; j++) {
+            const float* row = x + (size_t)j * c->inner;
+            for(int k = 0; k < n; k++) {
+                // _before() unrolled: NaN beyond every number, and the first of equal values wins
+                bool row_nan = isnan(row[k]), best_nan = isnan(best[k]);
+                bool better = c->largest ? row[k] > best[k] || (row_nan && !best_nan)
+                                         : row[k] < best[k] || (best_nan && !row_nan);
+                best[k] = better ? row[k] : best[k];
+                out[k] = better ? j : out[k];
+            }
+        }
+    }
+}
+
+static void _arg_select(Tensor self, int dim, bool largest, int* out) {
+    dim = TensorShape_asdim(self.shape, dim);
+    ArgCtx c = {self.data->flex, out, 1, self.shape[dim], 1, largest, 0, 0};
+    for(int i = 0; i < dim; i++) {
+        c.outer *= self.shape[i];
+    }
+    c.inner = self.data->numel / (c.outer * c.d);
+    c.col_block = c.inner < 64 ? c.inner : 64;
+    int n_units = c.outer * ((c.inner + c.col_block - 1) / c.col_block);
+    int units = SORT_TASK_NUMEL / (c.d * c.col_block);
+    c.units_per_task = units > 0 ? units : 1;
+    _cten_parallel_for((n_units + c.units_per_task - 1) / c.units_per_task, _arg_rows, &c);
+}
+
+void Tensor_argmax_dim(Tensor self, int dim, int* out) {
+    CTEN_PROFILE_BEGIN();
+    _arg_select(self, dim, true, out);
+    CTEN_PROFILE_END(self.shape, self.data->numel, sizeof(float) * self.data->numel);
+}
+
+void Tensor_argmin_dim(Tensor self, int dim, int* out) {
+    CTEN_PROFILE_BEGIN();
+    _arg_select(self, dim, false, out);
+    CTEN_PROFILE_END(self.shape, self.data->numel, sizeof(float) * self.data->numel);
+}
+
+void Tensor_argmax(Tensor self, int* out) { Tensor_argmax_dim(self, -1, out); }
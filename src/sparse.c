@@ -0,0 +1,275 @@
+#include "cten.h"
+#include "cten_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* CSR matrices as the left operand of a matmul. The forward is an SpMM that walks each row's
+ * nonzeros and accumulates scaled rows of the dense operand. The backward gives the dense operand
+ * A^T @ dY through a transposed copy of the index, so output rows never race, and the nonzero
+ * values dY @ B^T sampled at A's pattern (SDDMM); no dense (n_rows, n_cols) buffer ever exists. */
+
+#define SPARSE_ROWS_PER_TASK 32
+
+static int _max(int a, int b) { return a > b ? a : b; }
+
+static SparseTensor _sparse_alloc(int n_rows, int n_cols, int nnz, bool requires_grad) {
+    SparseTensor res;
+    res.n_rows = n_rows;
+    res.n_cols = n_cols;
+    res.nnz = nnz;
+    res.row_ptr = _cten_malloc(sizeof(int) * (n_rows + 1));
+    res.col_idx = _cten_malloc(sizeof(int) * _max(nnz, 1));
+    // a shape of {0} would read as a scalar
+    res.values = Tensor_new((TensorShape){_max(nnz, 1)}, requires_grad);
+    return res;
+}
+
+SparseTensor SparseTensor_from_dense(Tensor dense, bool requires_grad) {
+    cten_assert_dim("SparseTensor_from_dense() dim", TensorShape_dim(dense.shape), 2);
+    int n_rows = dense.shape[0], n_cols = dense.shape[1];
+    const float* x = dense.data->flex;
+    int nnz = 0;
+    for(int i = 0; i < dense.data->numel; i++) {
+        nnz += x[i] != 0;
+    }
+    SparseTensor res = _sparse_alloc(n_rows, n_cols, nnz, requires_grad);
+    int k = 0;
+    for(int r = 0; r < n_rows; r++) {
+        res.row_ptr[r] = k;
+        for(int c = 0; c < n_cols; c++) {
+            float v = x[r * n_cols + c];
+            if(v == 0) continue;
+            res.col_idx[k] = c;
+            res.values.data->flex[k++] = v;
+        }
+    }
+    res.row_ptr[n_rows] = k;
+    return res;
+}
+
+typedef struct {
+    int col;
+    float value;
+} SparseEntry;
+
+static int SparseEntry__cmp(const void* a, const void* b) {
+    const SparseEntry* x = a;
+    const SparseEntry* y = b;
+    return (x->col > y->col) - (x->col < y->col);
+}
+
+SparseTensor SparseTensor_from_coo(int n_rows,
+                                   int n_cols,
+                                   int nnz,
+                                   const int* rows,
+                                   const int* cols,
+                                   const float* values,
+                                   bool requires_grad) {
+    // bucket by row, sort every row by column and sum duplicates
+    int* row_ptr = calloc(n_rows + 1, sizeof(int));
+    SparseEntry* entries = malloc(sizeof(SparseEntry) * _max(nnz, 1));
+    cten_assert(row_ptr != NULL && entries != NULL, "SparseTensor_from_coo(): out of memory");
+    for(int k = 0; k < nnz; k++) {
+        cten_assert(rows[k] >= 0 && rows[k] < n_rows && cols[k] >= 0 && cols[k] < n_cols,
+                    "SparseTensor_from_coo(): entry %d at (%d, %d) is out of bounds",
+                    k,
+                    rows[k],
+                    cols[k]);
+        row_ptr[rows[k] + 1]++;
+    }
+    for(int r = 0; r < n_rows; r++) {
+        row_ptr[r + 1] += row_ptr[r];
+    }
+    int* fill = malloc(sizeof(int) * _max(n_rows, 1));
+    cten_assert(fill != NULL, "SparseTensor_from_coo(): out of memory");
+    memcpy(fill, row_ptr, sizeof(int) * n_rows);
+    for(int k = 0; k < nnz; k++) {
+        entries[fill[rows[k]]++] = (SparseEntry){cols[k], values[k]};
+    }
+    free(fill);
+
+    int n_unique = 0;
+    for(int r = 0; r < n_rows; r++) {
+        SparseEntry* e = entries + row_ptr[r];
+        int len = row_ptr[r + 1] - row_ptr[r];
+        qsort(e, len, sizeof(SparseEntry), SparseEntry__cmp);
+        for(int j = 0; j < len; j++) {
+            n_unique += j == 0 || e[j].col != e[j - 1].col;
+        }
+    }
+    SparseTensor res = _sparse_alloc(n_rows, n_cols, n_unique, requires_grad);
+    int k = 0;
+    for(int r = 0; r < n_rows; r++) {
+        res.row_ptr[r] = k;
+        for(int j = row_ptr[r]; j < row_ptr[r + 1]; j++) {
+            if(k > res.row_ptr[r] && res.col_idx[k - 1] == entries[j].col) {
+                res.values.data->flex[k - 1] += entries[j].value;
+                continue;
+            }
+            res.col_idx[k] = entries[j].col;
+            res.values.data->flex[k++] = entries[j].value;
+        }
+    }
+    res.row_ptr[n_rows] = k;
+    free(entries);
+    free(row_ptr);
+    return res;
+}
+
+Tensor SparseTensor_to_dense(SparseTensor self) {
+    Tensor res = Tensor_zeros((TensorShape){self.n_rows, self.n_cols}, false);
+    for(int r = 0; r < self.n_rows; r++) {
+        for(int k = self.row_ptr[r]; k < self.row_ptr[r + 1]; k++) {
+            res.data->flex[r * self.n_cols + self.col_idx[k]] = self.values.data->flex[k];
+        }
+    }
+    return res;
+}
+
+/* SpMM kernels */
+typedef struct SpmmCtx {
+    // y[n_rows x n] (+)= a[n_rows x n_cols] @ b[n_cols x n], a in CSR
+    int n_rows, n;
+    const int* row_ptr;
+    const int* col_idx;
+    const float* values;
+    const float* b;
+    float* y;
+    // SDDMM: dvalues[k] = dot(dy[row k], b[col k])
+    const float* dy;
+    float* dvalues;
+} SpmmCtx;
+
+static void _spmm_task(void* ctx, int task) {
+    const SpmmCtx* c = ctx;
+    int r0 = task * SPARSE_ROWS_PER_TASK;
+    int r1 = r0 + SPARSE_ROWS_PER_TASK < c->n_rows ? r0 + SPARSE_ROWS_PER_TASK : c->n_rows;
+    for(int r = r0; r < r1; r++) {
+        float* y = c->y + (size_t)r * c->n;
+        memset(y, 0, sizeof(float) * c->n);
+        for(int k = c->row_ptr[r]; k < c->row_ptr[r + 1]; k++) {
+            _cten_kernels.axpy(c->n, c->values[k], c->b + (size_t)c->col_idx[k] * c->n, y);
+        }
+    }
+}
+
+static void _sddmm_task(void* ctx, int task) {
+    const SpmmCtx* c = ctx;
+    int r0 = task * SPARSE_ROWS_PER_TASK;
+    int r1 = r0 + SPARSE_ROWS_PER_TASK < c->n_rows ? r0 + SPARSE_ROWS_PER_TASK : c->n_rows;
+    for(int r = r0; r < r1; r++) {
+        const float* dy = c->dy + (size_t)r * c->n;
+        for(int k = c->row_ptr[r]; k < c->row_ptr[r + 1]; k++) {
+            c->dvalues[k] = _cten_kernels.dot(c->n, dy, c->b + (size_t)c->col_idx[k] * c->n);
+        }
+    }
+}
+
+static void _spmm(SpmmCtx* c) {
+    int n_tasks = (c->n_rows + SPARSE_ROWS_PER_TASK - 1) / SPARSE_ROWS_PER_TASK;
+    _cten_parallel_for(n_tasks, _spmm_task, c);
+}
+
+/* Sparse.matmul */
+static Tensor GradFn_sparse_matmul(Tensor self, int i) {
+    const SparseTensor* a = self.node->ctx;
+    Tensor b = self.node->inputs[1];
+    Tensor dy = self.node->grad;
+    int n = b.shape[1];
+    if(i == 0) {
+        Tensor res = Tensor_new(self.node->inputs[0].shape, false);
+        SpmmCtx c = {.n_rows = a->n_rows,
+                     .n = n,
+                     .row_ptr = a->row_ptr,
+                     .col_idx = a->col_idx,
+                     .b = b.data->flex,
+                     .dy = dy.data->flex,
+                     .dvalues = res.data->flex};
+        if(a->nnz == 0) res.data->flex[0] = 0;
+        int n_tasks = (a->n_rows + SPARSE_ROWS_PER_TASK - 1) / SPARSE_ROWS_PER_TASK;
+        _cten_parallel_for(n_tasks, _sddmm_task, &c);
+        return res;
+    }
+
+    // dB = A^T @ dY, as an SpMM with the transposed index
+    int nnz = a->nnz;
+    int* t_ptr = calloc(a->n_cols + 1, sizeof(int));
+    int* t_idx = malloc(sizeof(int) * _max(nnz, 1));
+    float* t_val = malloc(sizeof(float) * _max(nnz, 1));
+    cten_assert(t_ptr != NULL && t_idx != NULL && t_val != NULL,
+                "SparseTensor_matmul(): out of memory");
+    for(int k = 0; k < nnz; k++) {
+        t_ptr[a->col_idx[k] + 1]++;
+    }
+    for(int c = 0; c < a->n_cols; c++) {
+        t_ptr[c + 1] += t_ptr[c];
+    }
+    for(int r = 0; r < a->n_rows; r++) {
+        for(int k = a->row_ptr[r]; k < a->row_ptr[r + 1]; k++) {
+            int dst = t_ptr[a->col_idx[k]]++;
+            t_idx[dst] = r;
+            t_val[dst] = a->values.data->flex[k];
+        }
+    }
+    // the fill pass advanced every start to the next column's; shift back
+    memmove(t_ptr + 1, t_ptr, sizeof(int) * a->n_cols);
+    t_ptr[0] = 0;
+
+    Tensor res = Tensor_new(b.shape, false);
+    SpmmCtx c = {.n_rows = a->n_cols,
+                 .n = n,
+                 .row_ptr = t_ptr,
+                 .col_idx = t_idx,
+                 .values = t_val,
+                 .b = dy.data->flex,
+                 .y = res.data->flex};
+    _spmm(&c);
+    free(t_val);
+    free(t_idx);
+    free(t_ptr);
+    return res;
+}
+
+Tensor SparseTensor_matmul(SparseTensor self, Tensor other) {
+    CTEN_PROFILE_BEGIN();
+    cten_assert_dim("SparseTensor_matmul() other dim", TensorShape_dim(other.shape), 2);
+    cten_assert_dim("SparseTensor_matmul() inner dim", other.shape[0], self.n_cols);
+    int n = other.shape[1];
+    bool requires_grad = !cten_is_eval() && (self.values.node != NULL || other.node != NULL);
+    Tensor res = Tensor_new((TensorShape){self.n_rows, n}, requires_grad);
+    SpmmCtx c = {.n_rows = self.n_rows,
+                 .n = n,
+                 .row_ptr = self.row_ptr,
+                 .col_idx = self.col_idx,
+                 .values = self.values.data->flex,
+                 .b = other.data->flex,
+                 .y = res.data->flex};
+    _spmm(&c);
+
+    if(requires_grad) {
+        SparseTensor* ctx = _cten_malloc(sizeof(SparseTensor));
+        *ctx = self;
+        res.node->grad_fn = GradFn_sparse_matmul;
+        res.node->name = "SparseTensor_matmul";
+        res.node->ctx = ctx;
+        res.node->inputs[0] = self.values;
+        res.node->inputs[1] = other;
+        res.node->n_inputs = 2;
+    }
+    CTEN_PROFILE_END(res.shape,
+                     2.0 * self.nnz * n,
+                     sizeof(float) * ((double)self.nnz * (n + 1) + res.data->numel) +
+                         sizeof(int) * (self.nnz + self.n_rows));
+    return res;
+}
+
+Tensor nn_linear_sparse(SparseTensor input, Tensor weight, Tensor bias) {
+    CTEN_PROFILE_BEGIN();
+    Tensor tmp = SparseTensor_matmul(input, weight);
+    tmp = Tensor_add(tmp, bias);
+    CTEN_PROFILE_END(tmp.shape,
+                     2.0 * input.nnz * weight.shape[1] + tmp.data->numel,
+                     sizeof(float) * (input.nnz + weight.data->numel + 2 * tmp.data->numel));
+    return tmp;
+}
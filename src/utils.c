@@ -1,4 +1,5 @@
 #include "cten.h"
+#include "cten_internal.h"
 
 #include <assert.h>
 #include <stdarg.h>
@@ -30,6 +31,68 @@ void cten_assert_dim(const char* title, int a, int b) {
     cten_assert(a == b, "%s: %d != %d", title, a, b);
 }
 
+// columns per task when the broadcast dims lead, e.g. a bias gradient summed over the batch
+#define BROADCAST_COLS 64
+#define BROADCAST_MIN_NUMEL (1 << 15)
+
+typedef struct ColumnSumCtx {
+    const float* g;
+    float* res;
+    int rows, cols;
+} ColumnSumCtx;
+
+// adds the rows of g into res in row order, the same per-column order as the serial loop
+static void _column_sum(void* ctx, int task) {
+    const ColumnSumCtx* c = ctx;
+    int c0 = task * BROADCAST_COLS;
+    int width = c->cols - c0 < BROADCAST_COLS ? c->cols - c0 : BROADCAST_COLS;
+    float* res = c->res + c0;
+    for(int r = 0; r < c->rows; r++) {
+        _cten_kernels.add(width, res, c->g + (size_t)r * c->cols + c0, res);
+    }
+}
+
+static Tensor GradFn_broadcast(Tensor self, int i) {
+    // sum the incoming gradient over every broadcast dim
+    Tensor input = self.node->inputs[i];
+    Tensor g = self.node->grad;
+    Tensor res = Tensor_zeros(input.shape, false);
+    int d[4], s[4];
+    for(int k = 0; k < 4; k++) {
+        d[k] = self.shape[k] == 0 ? 1 : self.shape[k];
+        s[k] = input.shape[k] == 0 ? 1 : input.shape[k];
+    }
+    // broadcast dims all ahead of the kept ones: a column sum, split by columns
+    int p = 4;
+    while(p > 0 && s[p - 1] == d[p - 1]) p--;
+    bool leading = true;
+    for(int k = 0; k < p; k++) {
+        leading = leading && s[k] == 1;
+    }
+    int cols = res.data->numel;
+    if(leading && g.data->numel >= BROADCAST_MIN_NUMEL && cols > BROADCAST_COLS) {
+        ColumnSumCtx c = {g.data->flex, res.data->flex, g.data->numel / cols, cols};
+        _cten_parallel_for((cols + BROADCAST_COLS - 1) / BROADCAST_COLS, _column_sum, &c);
+        return res;
+    }
+    int index = 0;
+    for(int i = 0; i < d[0]; i++) {
+        int i_ = s[0] == 1 ? 0 : i;
+        for(int j = 0; j < d[1]; j++) {
+            int j_ = s[1] == 1 ? 0 : j;
+            for(int k = 0; k < d[2]; k++) {
+                int k_ = s[2] == 1 ? 0 : k;
+                for(int l = 0; l < d[3]; l++) {
+                    int l_ = s[3] == 1 ? 0 : l;
+                    res.data->flex[((i_ * s[1] + j_) * s[2] + k_) * s[3] + l_] +=
+                        g.data->flex[index++];
+                }
+            }
+        }
+    }
+    return res;
+}
+
 bool cten_elemwise_broadcast(Tensor* a, Tensor* b) {
     int a_dim = TensorShape_dim(a->shape);
     int b_dim = TensorShape_dim(b->shape);
@@ -54,24 +117,36 @@ bool cten_elemwise_broadcast(Tensor* a, Tensor* b) {
             b = tmp;
             a_broadcast = 1;
         }
-        Tensor a_ = Tensor_new(b->shape, a->node != NULL);
-        for(int i = 0; i < a_.shape[0]; i++) {
-            int i_ = a->shape[0] == 1 ? 0 : i;
-            for(int j = 0; j < a_.shape[1]; j++) {
-                int j_ = a->shape[1] == 1 ? 0 : j;
-                for(int k = 0; k < a_.shape[2]; k++) {
-                    int k_ = a->shape[2] == 1 ? 0 : k;
-                    for(int l = 0; l < a_.shape[3]; l++) {
-                        int l_ = a->shape[3] == 1 ? 0 : l;
+        bool requires_grad = !cten_is_eval() && a->node != NULL;
+        Tensor a_ = Tensor_new(b->shape, requires_grad);
+        // unused trailing dims are 0 in TensorShape but iterate once
+        int d[4], s[4];
+        for(int k = 0; k < 4; k++) {
+            d[k] = a_.shape[k] == 0 ? 1 : a_.shape[k];
+            s[k] = a->shape[k] == 0 ? 1 : a->shape[k];
+        }
+        int index = 0;
+        for(int i = 0; i < d[0]; i++) {
+            int i_ = s[0] == 1 ? 0 : i;
+            for(int j = 0; j < d[1]; j++) {
+                int j_ = s[1] == 1 ? 0 : j;
+                for(int k = 0; k < d[2]; k++) {
+                    int k_ = s[2] == 1 ? 0 : k;
+                    for(int l = 0; l < d[3]; l++) {
+                        int l_ = s[3] == 1 ? 0 : l;
                         // a_[i][j][k][l] = a[i_][j_][k_][l_]
-                        a_.data->flex[i * a_.shape[1] * a_.shape[2] * a_.shape[3] +
-                                      j * a_.shape[2] * a_.shape[3] + k * a_.shape[3] + l] =
-                            a->data->flex[i_ * a->shape[1] * a->shape[2] * a->shape[3] +
-                                          j_ * a->shape[2] * a->shape[3] + k_ * a->shape[3] + l_];
+                        a_.data->flex[index++] =
+                            a->data->flex[((i_ * s[1] + j_) * s[2] + k_) * s[3] + l_];
                     }
                 }
             }
         }
+        if(requires_grad) {
+            a_.node->grad_fn = GradFn_broadcast;
+            a_.node->name = "cten_elemwise_broadcast";
+            a_.node->inputs[0] = *a;
+            a_.node->n_inputs = 1;
+        }
         *a = a_;
     }
     return true;
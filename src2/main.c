@@ -42,9 +42,12 @@ int main() {
     // create model
     Model model;
     cten_begin_malloc(PoolId_Model);
+    cten_seed(42);
     model.weight_1 = Tensor_new((TensorShape){n_features, 32}, true);
+    nn_init_kaiming_uniform(model.weight_1);
     model.bias_1 = Tensor_zeros((TensorShape){1, 32}, true);
     model.weight_2 = Tensor_new((TensorShape){32, n_classes}, true);
+    nn_init_xavier_uniform(model.weight_2);
     model.bias_2 = Tensor_zeros((TensorShape){1, n_classes}, true);
     cten_end_malloc();
 